@@ -0,0 +1,41 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef CRC8_H
+#define CRC8_H
+
+// Dallas / Maxim 1-Wire CRC-8 (x^8 + x^5 + x^4 + 1, least sig bit first),
+// as used for DS1820 ROM codes and scratchpads.
+// This has no mbed dependencies so that it can be built on the host.
+
+// crc8_table[i] is the CRC of the single byte i starting from 0,
+// see bench/crc8_bench.cpp which checks it against the bitwise CRC
+extern const unsigned char crc8_table[256];
+
+// shift one byte into the CRC
+inline char crc8_byte(char crc, char byte) {
+    return crc8_table[(unsigned char)(crc ^ byte)];
+}
+
+// CRC of length bytes of data
+inline char crc8(const char *data, int length) {
+    char crc = 0x00;
+    for (int i = 0; i < length; i++) {
+        crc = crc8_byte(crc, data[i]);
+    }
+    return crc;
+}
+
+#endif
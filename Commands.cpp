@@ -0,0 +1,119 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "Commands.h"
+
+// both key bytes as one switchable value
+#define COMMAND_KEY(key0, key1) \
+    (((unsigned)(unsigned char)(key0) << 8) | (unsigned char)(key1))
+
+#define COMMAND_NAME(name, key0, key1, parser, handler, flags) name,
+const char *const command_names[] = {
+    COMMAND_TABLE(COMMAND_NAME)
+};
+#undef COMMAND_NAME
+
+const int command_count = sizeof(command_names) / sizeof(command_names[0]);
+
+bool parse_query(const char *arg, int length, int *value) {
+    *value = 0;
+    return length >= 1 && arg[0] == '?';
+}
+
+bool parse_bool(const char *arg, int length, int *value) {
+    if (length < 1 || (arg[0] != '0' && arg[0] != '1')) {
+        return false;
+    }
+    *value = arg[0] - '0';
+    return true;
+}
+
+bool parse_reset(const char *arg, int length, int *value) {
+    *value = 0;
+    return length >= 3 && arg[0] == 'S' && arg[1] == 'E' && arg[2] == 'T';
+}
+
+bool parse_setpoint(const char *arg, int length, int *value) {
+    if (length >= 1 && arg[0] == '?') {
+        *value = -1;
+        return true;
+    }
+    int tenths = 0, digits = 0, i = 0;
+    for (; i < length && arg[i] >= '0' && arg[i] <= '9' && digits < 4; i++, digits++) {
+        tenths = tenths * 10 + (arg[i] - '0');
+    }
+    if (digits == 0) {
+        return false;
+    }
+    tenths *= 10;
+    if (i + 1 < length && arg[i] == '.' && arg[i + 1] >= '0' && arg[i + 1] <= '9') {
+        tenths += arg[i + 1] - '0';
+        i += 2;
+    }
+    // nothing may follow but the line end
+    if (i < length && arg[i] != '\r') {
+        return false;
+    }
+    *value = tenths;
+    return true;
+}
+
+// parse a decimal number of up to 5 digits at arg[*i], advancing *i
+static bool parse_number(const char *arg, int length, int *i, long *number) {
+    int digits = 0;
+    *number = 0;
+    for (; *i < length && arg[*i] >= '0' && arg[*i] <= '9' && digits < 5; (*i)++, digits++) {
+        *number = *number * 10 + (arg[*i] - '0');
+    }
+    return digits > 0;
+}
+
+bool parse_subscription(const char *arg, int length, int *value) {
+    int i = 0;
+    long interval, threshold = 0;
+    if (!parse_number(arg, length, &i, &interval)) {
+        return false;
+    }
+    if (i < length && arg[i] == '/') {
+        i++;
+        if (!parse_number(arg, length, &i, &threshold)) {
+            return false;
+        }
+    }
+    if ((i < length && arg[i] != '\r') || interval > 0xFFFF || threshold > 0xFFFF) {
+        return false;
+    }
+    *value = (int)((unsigned)interval | ((unsigned)threshold << 16));
+    return true;
+}
+
+int dispatch_command(const char *line, int length) {
+    int value;
+    if (length < 2) {
+        return -1;
+    }
+    switch (COMMAND_KEY(line[0], line[1])) {
+#define COMMAND_CASE(name, key0, key1, parser, handler, flags) \
+    case COMMAND_KEY(key0, key1): \
+        if (!parser(line + 2, length - 2, &value)) { \
+            return -1; \
+        } \
+        handler(value); \
+        return flags;
+    COMMAND_TABLE(COMMAND_CASE)
+#undef COMMAND_CASE
+    }
+    return -1;
+}
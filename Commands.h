@@ -0,0 +1,80 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+// Text command registry and dispatch.
+//
+// Every command starts with a two byte key, eg: "S+", followed by an
+// argument checked by the command's parser before its handler is called
+// with the parsed value. Dispatch is a switch on the key, so finding a
+// command does not scan any strings, and duplicate keys fail to compile.
+//
+// New commands only need an entry in COMMAND_TABLE and a handler.
+// This has no mbed dependencies so that it can be built on the host,
+// the handlers are defined by the firmware (main.cpp).
+
+// command flags
+// a valid command feeds the watchdog
+#define COMMAND_FEEDS_WATCHDOG 0x01
+
+// X(name, key0, key1, parser, handler, flags)
+// name is the command as documented, parsers are below
+#define COMMAND_TABLE(X) \
+    X("S+?",   'S', '+', parse_query, command_status,        COMMAND_FEEDS_WATCHDOG) \
+    X("T+?",   'T', '+', parse_query, command_temperature,   COMMAND_FEEDS_WATCHDOG) \
+    X("W+?",   'W', '+', parse_query, command_water_level,   COMMAND_FEEDS_WATCHDOG) \
+    X("E+?",   'E', '+', parse_query, command_serial_errors, COMMAND_FEEDS_WATCHDOG) \
+    X("I+?",   'I', '+', parse_query, command_idle,          COMMAND_FEEDS_WATCHDOG) \
+    X("Q+?",   'Q', '+', parse_query, command_tasks,         COMMAND_FEEDS_WATCHDOG) \
+    X("H+?",   'H', '+', parse_query, command_history,       COMMAND_FEEDS_WATCHDOG) \
+    X("P+?",   'P', '+', parse_query, command_profile,       COMMAND_FEEDS_WATCHDOG) \
+    X("B+0/1", 'B', '+', parse_bool,  command_brew,          COMMAND_FEEDS_WATCHDOG) \
+    X("C+<C>", 'C', '+', parse_setpoint, command_control,    COMMAND_FEEDS_WATCHDOG) \
+    X("U+<ms>", 'U', '+', parse_subscription, command_subscribe, COMMAND_FEEDS_WATCHDOG) \
+    X("RESET", 'R', 'E', parse_reset, command_reset,         COMMAND_FEEDS_WATCHDOG)
+
+// argument parsers, given the bytes after the key, set *value and
+// return true if the argument is valid
+// "?"
+bool parse_query(const char *arg, int length, int *value);
+// "0" or "1"
+bool parse_bool(const char *arg, int length, int *value);
+// the rest of "RESET"
+bool parse_reset(const char *arg, int length, int *value);
+// "?" (-1), or degrees with up to one decimal, eg: "92.5" (in tenths, 925)
+bool parse_setpoint(const char *arg, int length, int *value);
+// "<interval ms>" or "<interval ms>/<change threshold>", both 0 - 65535,
+// packed into one value, unpack with the macros below
+bool parse_subscription(const char *arg, int length, int *value);
+#define SUBSCRIPTION_INTERVAL(value)  ((value) & 0xFFFF)
+#define SUBSCRIPTION_THRESHOLD(value) (((unsigned)(value) >> 16) & 0xFFFF)
+
+// handlers, called with the parsed argument
+#define COMMAND_DECLARE_HANDLER(name, key0, key1, parser, handler, flags) \
+    void handler(int value);
+COMMAND_TABLE(COMMAND_DECLARE_HANDLER)
+#undef COMMAND_DECLARE_HANDLER
+
+// number of commands, and their names in table order
+extern const int command_count;
+extern const char *const command_names[];
+
+// dispatch_command parses line and runs the matching command, returning
+// the command's flags, or -1 if the line is not a valid command
+int dispatch_command(const char *line, int length);
+
+#endif
@@ -31,22 +31,47 @@
 LinkedList<DS1820> DS1820::probes;
  
  
-DS1820::DS1820 (PinName data_pin, PinName power_pin, bool power_polarity) : _datapin(data_pin), _parasitepin(power_pin) {
+DS1820::DS1820 (PinName data_pin, PinName power_pin, bool power_polarity) : _parasitepin(power_pin) {
+    _own_bus = new OneWire(data_pin);
+    _bus = _own_bus;
+    if (!unassignedProbe(_bus, _ROM))
+        error("No unassigned DS1820 found!\n");
+    else
+        attach(power_pin, power_polarity);
+}
+
+DS1820::DS1820 (OneWireTransport *bus, PinName power_pin, bool power_polarity) : _parasitepin(power_pin) {
+    _own_bus = NULL;
+    _bus = bus;
+    if (!unassignedProbe(_bus, _ROM))
+        error("No unassigned DS1820 found!\n");
+    else
+        attach(power_pin, power_polarity);
+}
+
+DS1820::DS1820 (OneWireTransport *bus, const char *ROM_address, PinName power_pin, bool power_polarity) : _parasitepin(power_pin) {
+    _own_bus = NULL;
+    _bus = bus;
+    for (int byte_counter=0;byte_counter<8;byte_counter++)
+        _ROM[byte_counter] = ROM_address[byte_counter];
+    attach(power_pin, power_polarity);
+}
+
+void DS1820::attach(PinName power_pin, bool power_polarity) {
     int byte_counter;
     _power_polarity = power_polarity;
+    _read_pending = false;
+    _resolution = 0;
 
     _power_mosfet = power_pin != NC;
+    if (_power_mosfet)
+        _bus->set_strong_pullup(&_parasitepin, _power_polarity);
     
     for(byte_counter=0;byte_counter<9;byte_counter++)
         RAM[byte_counter] = 0x00;
     
-    if (!unassignedProbe(&_datapin, _ROM))
-        error("No unassigned DS1820 found!\n");
-    else {
-        _datapin.input();
-        probes.append(this);
-        _parasite_power = !read_power_supply();
-    }
+    probes.append(this);
+    _parasite_power = !read_power_supply();
 }
 
 DS1820::~DS1820 (void) {
@@ -59,104 +84,97 @@ DS1820::~DS1820 (void) {
             i -= 1;
         }
     }
+    delete _own_bus;
 }
 
  
-bool DS1820::onewire_reset(DigitalInOut *pin) {
+bool DS1820::onewire_reset(OneWireTransport *bus) {
 // This will return false if no devices are present on the data bus
-    bool presence=false;
-    pin->output();
-    pin->write(0);          // bring low for 500 us
-    wait_us(500);
-    pin->input();       // let the data line float high
-    wait_us(90);            // wait 90us
-    if (pin->read()==0) // see if any devices are pulling the data line low
-        presence=true;
-    wait_us(410);
-    return presence;
+    return bus->reset();
 }
  
-void DS1820::onewire_bit_out (DigitalInOut *pin, bool bit_data) {
-    pin->output();
-    pin->write(0);
-    wait_us(3);                 // DXP modified from 5
-    if (bit_data) {
-        pin->write(1); // bring data line high
-        wait_us(55);
-    } else {
-        wait_us(55);            // keep data line low
-        pin->write(1);
-        wait_us(10);            // DXP added to allow bus to float high before next bit_out
-    }
+void DS1820::onewire_bit_out (OneWireTransport *bus, bool bit_data) {
+    bus->write_bit(bit_data);
 }
  
 void DS1820::onewire_byte_out(char data) { // output data character (least sig bit first).
-    int n;
-    for (n=0; n<8; n++) {
-        onewire_bit_out(&this->_datapin, data & 0x01);
-        data = data >> 1; // now the next bit is in the least sig bit position.
-    }
+    _bus->write_byte(data);
 }
  
-bool DS1820::onewire_bit_in(DigitalInOut *pin) {
-    bool answer;
-    pin->output();
-    pin->write(0);
-    wait_us(3);                 // DXP modofied from 5
-    pin->input();
-    wait_us(10);                // DXP modified from 5
-    answer = pin->read();
-    wait_us(45);                // DXP modified from 50
-    return answer;
+bool DS1820::onewire_bit_in(OneWireTransport *bus) {
+    return bus->read_bit();
 }
  
 char DS1820::onewire_byte_in() { // read byte, least sig byte first
-    char answer = 0x00;
-    int i;
-    for (i=0; i<8; i++) {
-        answer = answer >> 1; // shift over to make room for the next bit
-        if (onewire_bit_in(&this->_datapin))
-            answer = answer | 0x80; // if the data port is high, make this bit a 1
-    }
-    return answer;
+    return _bus->read_byte();
 }
 
 bool DS1820::unassignedProbe(PinName pin) {
-    DigitalInOut _pin(pin);
+    OneWire bus(pin);
+    return unassignedProbe(&bus);
+}
+
+bool DS1820::unassignedProbe(OneWireTransport *bus) {
     char ROM_address[8];
-    return search_ROM_routine(&_pin, 0xF0, ROM_address);
+    return search_ROM_routine(bus, 0xF0, ROM_address);
+}
+ 
+bool DS1820::verifyProbe(OneWireTransport *bus, const char *ROM_address) {
+    char scratchpad[9];
+    if (ROM_checksum_error((char *)ROM_address))
+        return false;
+    // one retry, in case of a corrupted read
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (!onewire_reset(bus))
+            return false;
+        bus->write_byte(0x55);   // Match ROM command
+        for (int i = 0; i < 8; i++)
+            bus->write_byte(ROM_address[i]);
+        bus->write_byte(0xBE);   // Read Scratchpad command
+        bool all_zero = true;
+        for (int i = 0; i < 9; i++) {
+            scratchpad[i] = bus->read_byte();
+            all_zero = all_zero && scratchpad[i] == 0x00;
+        }
+        // no device answering reads as all ones, which fails the CRC,
+        // but a bus held low reads as all zeros, which passes it
+        if (!all_zero && crc8(scratchpad, 8) == scratchpad[8])
+            return true;
+    }
+    return false;
 }
  
-bool DS1820::unassignedProbe(DigitalInOut *pin, char *ROM_address) {
-    return search_ROM_routine(pin, 0xF0, ROM_address);
+bool DS1820::unassignedProbe(OneWireTransport *bus, char *ROM_address) {
+    return search_ROM_routine(bus, 0xF0, ROM_address);
 }
  
-bool DS1820::search_ROM_routine(DigitalInOut *pin, char command, char *ROM_address) {
+bool DS1820::search_ROM_routine(OneWireTransport *bus, char command, char *ROM_address) {
     bool DS1820_done_flag = false;
     int DS1820_last_descrepancy = 0;
     char DS1820_search_ROM[8] = {0, 0, 0, 0, 0, 0, 0, 0};
     
     int descrepancy_marker, ROM_bit_index;
     bool return_value, Bit_A, Bit_B;
-    char byte_counter, bit_mask;
+    int byte_counter;
+    char bit_mask;
  
     return_value=false;
     while (!DS1820_done_flag) {
-        if (!onewire_reset(pin)) {
+        if (!onewire_reset(bus)) {
             return false;
         } else {
             ROM_bit_index=1;
             descrepancy_marker=0;
             char command_shift = command;
             for (int n=0; n<8; n++) {           // Search ROM command or Search Alarm command
-                onewire_bit_out(pin, command_shift & 0x01);
+                onewire_bit_out(bus, command_shift & 0x01);
                 command_shift = command_shift >> 1; // now the next bit is in the least sig bit position.
             } 
             byte_counter = 0;
             bit_mask = 0x01;
             while (ROM_bit_index<=64) {
-                Bit_A = onewire_bit_in(pin);
-                Bit_B = onewire_bit_in(pin);
+                Bit_A = onewire_bit_in(bus);
+                Bit_B = onewire_bit_in(bus);
                 if (Bit_A & Bit_B) {
                     descrepancy_marker = 0; // data read error, this should never happen
                     ROM_bit_index = 0xFF;
@@ -182,7 +200,7 @@ bool DS1820::search_ROM_routine(DigitalInOut *pin, char command, char *ROM_addre
                             }
                         }
                     }
-                    onewire_bit_out (pin, DS1820_search_ROM[byte_counter] & bit_mask);
+                    onewire_bit_out (bus, DS1820_search_ROM[byte_counter] & bit_mask);
                     ROM_bit_index++;
                     if (bit_mask & 0x80) {
                         byte_counter++;
@@ -194,7 +212,7 @@ bool DS1820::search_ROM_routine(DigitalInOut *pin, char command, char *ROM_addre
             }
             DS1820_last_descrepancy = descrepancy_marker;
             if (ROM_bit_index != 0xFF) {
-                int i = 1;
+                int i = 0;
                 DS1820 *probe;
                 while(1) {
                     probe = probes.peek(i);
@@ -231,7 +249,7 @@ bool DS1820::search_ROM_routine(DigitalInOut *pin, char command, char *ROM_addre
 void DS1820::match_ROM() {
 // Used to select a specific device
     int i;
-    onewire_reset(&this->_datapin);
+    onewire_reset(_bus);
     onewire_byte_out( 0x55);  //Match ROM command
     for (i=0;i<8;i++) {
         onewire_byte_out(_ROM[i]);
@@ -239,77 +257,69 @@ void DS1820::match_ROM() {
 }
  
 void DS1820::skip_ROM() {
-    onewire_reset(&this->_datapin);
+    onewire_reset(_bus);
     onewire_byte_out(0xCC);   // Skip ROM command
 }
  
 bool DS1820::ROM_checksum_error(char *_ROM_address) {
-    char _CRC=0x00;
-    int i;
-    for(i=0;i<7;i++) // Only going to shift the lower 7 bytes
-        _CRC = CRC_byte(_CRC, _ROM_address[i]);
     // After 7 bytes CRC should equal the 8th byte (ROM CRC)
-    return (_CRC!=_ROM_address[7]); // will return true if there is a CRC checksum mis-match         
+    return (crc8(_ROM_address, 7)!=_ROM_address[7]); // will return true if there is a CRC checksum mis-match         
 }
  
 bool DS1820::RAM_checksum_error() {
-    char _CRC=0x00;
-    int i;
-    for(i=0;i<8;i++) // Only going to shift the lower 8 bytes
-        _CRC = CRC_byte(_CRC, RAM[i]);
     // After 8 bytes CRC should equal the 9th byte (RAM CRC)
-    return (_CRC!=RAM[8]); // will return true if there is a CRC checksum mis-match        
+    return (crc8(RAM, 8)!=RAM[8]); // will return true if there is a CRC checksum mis-match        
 }
  
 char DS1820::CRC_byte (char _CRC, char byte ) {
-    int j;
-    for(j=0;j<8;j++) {
-        if ((byte & 0x01 ) ^ (_CRC & 0x01)) {
-            // DATA ^ LSB CRC = 1
-            _CRC = _CRC>>1;
-            // Set the MSB to 1
-            _CRC = _CRC | 0x80;
-            // Check bit 3
-            if (_CRC & 0x04) {
-                _CRC = _CRC & 0xFB; // Bit 3 is set, so clear it
-            } else {
-                _CRC = _CRC | 0x04; // Bit 3 is clear, so set it
-            }
-            // Check bit 4
-            if (_CRC & 0x08) {
-                _CRC = _CRC & 0xF7; // Bit 4 is set, so clear it
-            } else {
-                _CRC = _CRC | 0x08; // Bit 4 is clear, so set it
-            }
-        } else {
-            // DATA ^ LSB CRC = 0
-            _CRC = _CRC>>1;
-            // clear MSB
-            _CRC = _CRC & 0x7F;
-            // No need to check bits, with DATA ^ LSB CRC = 0, they will remain unchanged
-        }
-        byte = byte>>1;
+    // Table driven, see CRC8.h
+    return crc8_byte(_CRC, byte);
+}
+ 
+int DS1820::conversionTime() {
+    // Milliseconds for this device to convert at its current resolution
+    int delay_time = 750; // Default delay time, and 12 bits
+    switch (resolution()) {
+        case 9:
+            delay_time = 94;
+            break;
+        case 10:
+            delay_time = 188;
+            break;
+        case 11:
+            delay_time = 375;
+            break;
     }
-return _CRC;
+    // DS1820s always take 750ms
+    if ((FAMILY_CODE != FAMILY_CODE_DS18B20 ) && (FAMILY_CODE != FAMILY_CODE_DS1822 ))
+        delay_time = 750;
+    return delay_time;
+}
+
+int DS1820::resolution() {
+    // As last set or read back, the power on default (from EEPROM) is normally 12 bits
+    if ((FAMILY_CODE != FAMILY_CODE_DS18B20 ) && (FAMILY_CODE != FAMILY_CODE_DS1822 ))
+        return 9;
+    if (_resolution == 0)
+        return 12;
+    return _resolution;
+}
+
+void DS1820::RAM_read_done() {
+    // Note the resolution the device reports, it goes back to the EEPROM's on a power on
+    // reset. The low 5 bits of the configuration register always read as ones.
+    if (!RAM_checksum_error() && ((RAM[4] & 0x1F) == 0x1F))
+        _resolution = 9 + ((RAM[4] >> 5) & 0x03);
 }
  
 int DS1820::convertTemperature(bool wait, devices device) {
     // Convert temperature into scratchpad RAM for all devices at once
     int delay_time = 750; // Default delay time
-    char resolution;
     if (device==all_devices)
         skip_ROM();          // Skip ROM command, will convert for ALL devices
     else {
         match_ROM();
-        if ((FAMILY_CODE == FAMILY_CODE_DS18B20 ) || (FAMILY_CODE == FAMILY_CODE_DS1822 )) {
-            resolution = RAM[4] & 0x60;
-            if (resolution == 0x00) // 9 bits
-                delay_time = 94;
-            if (resolution == 0x20) // 10 bits
-                delay_time = 188;
-            if (resolution == 0x40) // 11 bits. Note 12bits uses the 750ms default
-                delay_time = 375;
-        }
+        delay_time = conversionTime();
     }
     
     onewire_byte_out( 0x44);  // perform temperature conversion
@@ -320,10 +330,9 @@ int DS1820::convertTemperature(bool wait, devices device) {
             _parasitepin = !_power_polarity;
             delay_time = 0;
         } else {
-            _datapin.output();
-            _datapin.write(1);
+            _bus->pull_up();    // drive the data line high
             wait_ms(delay_time);
-            _datapin.input();
+            _bus->release();
         }
     } else {
         if (wait) {
@@ -334,6 +343,31 @@ int DS1820::convertTemperature(bool wait, devices device) {
     return delay_time;
 }
  
+int DS1820::startConvert(devices device) {
+    char command[10];
+    int i, length = 0;
+    int delay_time = 750; // Default delay time
+    if (_bus->busy())
+        return -1;
+    if (device==all_devices)
+        command[length++] = 0xCC;  // Skip ROM command, will convert for ALL devices
+    else {
+        command[length++] = 0x55;  // Match ROM command
+        for (i=0;i<8;i++)
+            command[length++] = _ROM[i];
+        delay_time = conversionTime();
+    }
+    command[length++] = 0x44;      // perform temperature conversion
+    if (!_bus->start(true, command, length, NULL, 0, _parasite_power))
+        return -1;
+    return delay_time;
+}
+ 
+void DS1820::finishConvert() {
+    if (_parasite_power)
+        _bus->release();
+}
+ 
 void DS1820::read_RAM() {
     // This will copy the DS1820's 9 bytes of RAM data
     // into the objects RAM array. Functions that use
@@ -344,6 +378,7 @@ void DS1820::read_RAM() {
     for(i=0;i<9;i++) {
         RAM[i] = onewire_byte_in();
     }
+    RAM_read_done();
 //    if (!RAM_checksum_error())
 //       crcerr = 1;
 }
@@ -352,14 +387,47 @@ bool DS1820::setResolution(unsigned int resolution) {
     bool answer = false;
     resolution = resolution - 9;
     if (resolution < 4) {
+        _resolution = resolution + 9;
         resolution = resolution<<5; // align the bits
-        RAM[4] = (RAM[4] & 0x60) | resolution; // mask out old data, insert new
+        RAM[4] = (RAM[4] & ~0x60) | resolution; // mask out old data, insert new
         write_scratchpad ((RAM[2]<<8) + RAM[3]);
 //        store_scratchpad (DS1820::this_device); // Need to test if this is required
         answer = true;
     }
     return answer;
 }
+
+bool DS1820::startSetResolution(unsigned int resolution, devices device) {
+    char command[OneWireTransport::max_write_bytes];
+    int i, length = 0;
+    DS1820 *probe;
+    resolution = resolution - 9;
+    if (resolution >= 4 || _bus->busy())
+        return false;
+    if (device==all_devices)
+        command[length++] = 0xCC;  // Skip ROM command, will write ALL devices
+    else {
+        command[length++] = 0x55;  // Match ROM command
+        for (i=0;i<8;i++)
+            command[length++] = _ROM[i];
+    }
+    command[length++] = 0x4E;      // Write scratchpad
+    command[length++] = RAM[2];    // T(H)
+    command[length++] = RAM[3];    // T(L)
+    command[length++] = (RAM[4] & ~0x60) | (resolution<<5); // Configuration register
+    if (!_bus->start(true, command, length, NULL, 0))
+        return false;
+    // The DS1820s on the bus ignore the configuration register
+    if (device==all_devices) {
+        for (i = 0; i < probes.length(); i++) {
+            probe = probes.peek(i);
+            if (probe->_bus == _bus)
+                probe->_resolution = resolution + 9;
+        }
+    } else
+        _resolution = resolution + 9;
+    return true;
+}
  
 void DS1820::write_scratchpad(int data) {
     RAM[3] = data;
@@ -374,36 +442,84 @@ void DS1820::write_scratchpad(int data) {
 }
  
 float DS1820::temperature(char scale) {
+    read_RAM();
+    return RAM_temperature(scale).to_float();
+}
+
+bool DS1820::startRead() {
+    char command[10];
+    int i;
+    if (_bus->busy())
+        return false;
+    command[0] = 0x55;      // Match ROM command
+    for (i=0;i<8;i++)
+        command[i+1] = _ROM[i];
+    command[9] = 0xBE;      // Read Scratchpad command
+    _read_pending = _bus->start(true, command, 10, RAM, 9);
+    return _read_pending;
+}
+
+bool DS1820::poll() {
+    if (_read_pending && !_bus->busy()) {
+        _read_pending = false;
+        RAM_read_done();
+        return true;
+    }
+    return false;
+}
+
+bool DS1820::busy() {
+    return _bus->busy();
+}
+
+float DS1820::lastTemperature(char scale) {
+    return lastTemperatureFixed(scale).to_float();
+}
+
+FixedDegrees DS1820::lastTemperatureFixed(char scale) {
+    if (!_bus->presence())
+        return FixedDegrees::from_int(invalid_conversion);
+    return RAM_temperature(scale);
+}
+
+FixedDegrees DS1820::RAM_temperature(char scale) {
 // The data specs state that count_per_degree should be 0x10 (16), I found my devices
 // to have a count_per_degree of 0x4B (75). With the standard resolution of 1/2 deg C
 // this allowed an expanded resolution of 1/150th of a deg C. I wouldn't rely on this
 // being super acurate, but it does allow for a smooth display in the 1/10ths of a
 // deg C or F scales.
-    float answer, remaining_count, count_per_degree;
+// This is all integer math in FixedDegrees (1/10000ths of a degree), the M3 has no FPU.
+    long answer, remaining_count, count_per_degree, half_degrees;
     int reading;
-    read_RAM();
     if (RAM_checksum_error())
         // Indicate we got a CRC error
-        answer = invalid_conversion;
+        return FixedDegrees::from_int(invalid_conversion);
+    reading = ((unsigned char)RAM[1] << 8) + (unsigned char)RAM[0];
+    if ((FAMILY_CODE == FAMILY_CODE_DS18B20 ) || (FAMILY_CODE == FAMILY_CODE_DS1822 )) {
+        // The bits below the resolution in the configuration register are undefined
+        reading &= ~((1 << (3 - ((RAM[4] >> 5) & 0x03))) - 1);
+    }
+    if (reading & 0x8000) { // negative degrees C
+        reading = 0-((reading ^ 0xffff) + 1); // 2's comp then convert to signed int
+    }
+    if ((FAMILY_CODE == FAMILY_CODE_DS18B20 ) || (FAMILY_CODE == FAMILY_CODE_DS1822 )) {
+        // 1/16ths of a degree
+        answer = reading * (FixedDegrees::from_int(1).raw / 16);
+    }
     else {
-        reading = (RAM[1] << 8) + RAM[0];
-        if (reading & 0x8000) { // negative degrees C
-            reading = 0-((reading ^ 0xffff) + 1); // 2's comp then convert to signed int
-        }
-        answer = reading +0.0; // convert to floating point
-        if ((FAMILY_CODE == FAMILY_CODE_DS18B20 ) || (FAMILY_CODE == FAMILY_CODE_DS1822 )) {
-            answer = answer / 16.0f;
-        }
-        else {
-            remaining_count = RAM[6];
-            count_per_degree = RAM[7];
-            answer = floor(answer/2.0f) - 0.25f + (count_per_degree - remaining_count) / count_per_degree;
-        }
-        if (scale=='F' or scale=='f')
-            // Convert to deg F
-            answer = answer * 9.0f / 5.0f + 32.0f;
+        remaining_count = (unsigned char)RAM[6];
+        count_per_degree = (unsigned char)RAM[7];
+        if (count_per_degree == 0)
+            return FixedDegrees::from_int(invalid_conversion);
+        // floor(reading / 2), rounding negative readings down too
+        half_degrees = reading >= 0 ? reading / 2 : -((1 - reading) / 2);
+        answer = FixedDegrees::from_int(half_degrees).raw - FixedDegrees::from_int(1).raw / 4
+               + (count_per_degree - remaining_count) * FixedDegrees::from_int(1).raw / count_per_degree;
     }
-    return answer;
+    if (scale=='F' or scale=='f')
+        // Convert to deg F
+        answer = round_divide(answer * 9, 5) + FixedDegrees::from_int(32).raw;
+    return FixedDegrees(answer);
 }
  
 bool DS1820::read_power_supply(devices device) {
@@ -414,7 +530,7 @@ bool DS1820::read_power_supply(devices device) {
     else
         match_ROM();
     onewire_byte_out(0xB4);   // Read power supply command
-    return onewire_bit_in(&this->_datapin);
+    return onewire_bit_in(_bus);
 }
 
 
@@ -31,7 +31,10 @@
 #define MBED_DS1820_H
 
 #include "mbed.h"
+#include "CRC8.h"
+#include "Fixed.h"
 #include "LinkedList.h"
+#include "OneWire.h"
 
 #define FAMILY_CODE _ROM[0]
 #define FAMILY_CODE_DS1820 0x10
@@ -79,6 +82,23 @@ public:
      * @param power_polarity bool (optional) which sets active state (0 for active low (default), 1 for active high)
      */
     DS1820(PinName data_pin, PinName power_pin = NC, bool power_polarity = 0); // Constructor with parasite power pin
+
+    /** Create a probe object on a bus shared with other probes, eg: a OneWireUart
+     *
+     * @param bus the 1-Wire bus master, which must outlive the probe
+     * @param power_pin DigitalOut (optional) pin to control the power MOSFET
+     * @param power_polarity bool (optional) which sets active state (0 for active low (default), 1 for active high)
+     */
+    DS1820(OneWireTransport *bus, PinName power_pin = NC, bool power_polarity = 0);
+
+    /** Create a probe object for a device whose ROM code is already known, without searching the bus
+     *
+     * @param bus the 1-Wire bus master, which must outlive the probe
+     * @param ROM_address the device's 8 byte ROM code, eg: one that passed verifyProbe()
+     * @param power_pin DigitalOut (optional) pin to control the power MOSFET
+     * @param power_polarity bool (optional) which sets active state (0 for active low (default), 1 for active high)
+     */
+    DS1820(OneWireTransport *bus, const char *ROM_address, PinName power_pin = NC, bool power_polarity = 0);
     ~DS1820();
 
     /** Function to see if there are DS1820 devices left on a pin which do not have a corresponding DS1820 object
@@ -86,6 +106,21 @@ public:
     * @return - true if there are one or more unassigned devices, otherwise false
       */
     static bool unassignedProbe(PinName pin);
+    static bool unassignedProbe(OneWireTransport *bus);
+
+    /** Function to check that a device with a known ROM code is on a pin, by addressing it with
+    * match ROM and reading its scratchpad back, which is much quicker than searching the bus for it.
+    *
+    * @param bus the 1-Wire bus master
+    * @param ROM_address the device's 8 byte ROM code
+    * @return - true if the device answered with a scratchpad that passed its CRC check
+      */
+    static bool verifyProbe(OneWireTransport *bus, const char *ROM_address);
+
+    /** @returns this probe's 8 byte ROM code */
+    const char *ROMAddress() const {
+        return _ROM;
+    }
 
     /** This routine will initiate the temperature conversion within
       * one or all DS1820 probes. 
@@ -114,29 +149,118 @@ public:
       */ 
     bool setResolution(unsigned int resolution);       
 
+    /** This function starts setting the temperature resolution of one or all
+      * DS18B20s in the background, without blocking on the 1-Wire bus.
+      * For all devices, every probe on the bus gets this probe's alarm (TH / TL) values.
+      *
+      * @param a number between 9 and 12 to specify resolution
+      * @param device allows the function to apply to a specific device or
+      * to all devices on the 1-Wire bus.
+      * @returns true if started, false if the bus is busy or the resolution isn't valid
+      */
+    bool startSetResolution(unsigned int resolution, devices device=this_device);
+
+    /** This function returns the resolution this probe converts at, as last set or
+      * read back from the probe. DS1820s always report 9 bits.
+      *
+      * @returns bits, 9 to 12
+      */
+    int resolution();
+
+    /** This function returns how long this probe takes to convert at
+      * its current resolution, see resolution().
+      *
+      * @returns milliseconds per conversion
+      */
+    int conversionTime();
+
+    /** This routine will initiate the temperature conversion within
+      * one or all DS1820 probes in the background, without blocking on
+      * the 1-Wire bus or waiting for the conversion.
+      * Parasite powered probes are held on strong pullup until finishConvert().
+      *
+      * @param device allows the function to apply to a specific device or
+      * to all devices on the 1-Wire bus.
+      * @returns milliseconds untill conversion will complete, counted from
+      * when busy() returns false, or -1 if the bus is busy.
+      */
+    int startConvert(devices device=this_device);
+
+    /** This function ends a conversion started by startConvert(),
+      * releasing the strong pullup on parasite powered probes.
+      */
+    void finishConvert();
+
+    /** This function starts reading the probe's RAM in the background, 
+      * without blocking on the 1-Wire bus. Do not call the blocking functions
+      * on this probe until poll() reports the read is finished.
+      *
+      * @returns true if the read was started, false if a read is already in progress
+      */
+    bool startRead();
+
+    /** This function checks on a read started by startRead().
+      *
+      * @returns true once when the read has finished, after which
+      * lastTemperature() returns the new reading
+      */
+    bool poll();
+
+    /** This function returns true while a read started by startRead() is in progress.
+      */
+    bool busy();
+
+    /** This function will return the temperature from the last read finished
+      * by poll(), without touching the 1-Wire bus.
+      *
+      * @param scale, may be either 'c' or 'f'
+      * @returns temperature for that scale, or DS1820::invalid_conversion (-1000) if 
+      * no device answered or a CRC error was detected.
+      */
+    float lastTemperature(char scale='c');
+
+    /** This function is lastTemperature() without any floating point math.
+      *
+      * @param scale, may be either 'c' or 'f'
+      * @returns temperature for that scale, or DS1820::invalid_conversion (-1000) if 
+      * no device answered or a CRC error was detected.
+      */
+    FixedDegrees lastTemperatureFixed(char scale='c');
+
 private:
+    // the host benchmarks time the private routines, see bench/driver_bench.cpp
+    friend class DS1820Bench;
+
     bool _parasite_power;
     bool _power_mosfet;
     bool _power_polarity;
     
     static char CRC_byte(char _CRC, char byte );
-    static bool onewire_reset(DigitalInOut *pin);
+    static bool onewire_reset(OneWireTransport *bus);
     void match_ROM();
     void skip_ROM();
-    static bool search_ROM_routine(DigitalInOut *pin, char command, char *ROM_address);
-    static void onewire_bit_out (DigitalInOut *pin, bool bit_data);
+    static bool search_ROM_routine(OneWireTransport *bus, char command, char *ROM_address);
+    static void onewire_bit_out (OneWireTransport *bus, bool bit_data);
     void onewire_byte_out(char data);
-    static bool onewire_bit_in(DigitalInOut *pin);
+    static bool onewire_bit_in(OneWireTransport *bus);
     char onewire_byte_in();
     static bool ROM_checksum_error(char *_ROM_address);
     bool RAM_checksum_error();
     void read_RAM();
-    static bool unassignedProbe(DigitalInOut *pin, char *ROM_address);
+    void RAM_read_done();
+    static bool unassignedProbe(OneWireTransport *bus, char *ROM_address);
     void write_scratchpad(int data);
     bool read_power_supply(devices device=this_device);
+    void attach(PinName power_pin, bool power_polarity);
+    FixedDegrees RAM_temperature(char scale);
 
-    DigitalInOut _datapin;
     DigitalOut _parasitepin;
+    OneWireTransport *_bus;
+    // the bus, if this probe made it
+    OneWire *_own_bus;
+    bool _read_pending;
+    // Configured resolution in bits, 0 until set or read back
+    char _resolution;
     
     char _ROM[8];
     char RAM[9];
@@ -0,0 +1,207 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "DS1820Bus.h"
+
+DS1820Bus::DS1820Bus(PinName data_pin, RomStore *store) {
+    _own_bus = new OneWire(data_pin);
+    _bus = _own_bus;
+    find(store);
+}
+
+DS1820Bus::DS1820Bus(OneWireTransport *bus, RomStore *store) {
+    _own_bus = NULL;
+    _bus = bus;
+    find(store);
+}
+
+void DS1820Bus::find(RomStore *store) {
+    _count = 0;
+    _reading = -1;
+    _read_started = false;
+    _restored = false;
+    char roms[max_probes][8];
+    int saved = store ? store->load(roms, max_probes) : 0;
+    // a match ROM read per probe, rather than a search pass (or more) each
+    bool verified = saved > 0;
+    for (int i = 0; i < saved && verified; i++) {
+        verified = DS1820::verifyProbe(_bus, roms[i]);
+    }
+    if (verified) {
+        for (; _count < saved; _count++) {
+            _probes[_count] = new DS1820(_bus, roms[_count]);
+            _samples[_count] = FixedDegrees::from_int(DS1820::invalid_conversion);
+        }
+        _restored = true;
+        return;
+    }
+
+    while (_count < max_probes && DS1820::unassignedProbe(_bus)) {
+        _probes[_count] = new DS1820(_bus);
+        _samples[_count] = FixedDegrees::from_int(DS1820::invalid_conversion);
+        _count++;
+    }
+    if (_count == 0) {
+        error("No DS1820 found!\n");
+    }
+    if (store) {
+        for (int i = 0; i < _count; i++) {
+            memcpy(roms[i], _probes[i]->ROMAddress(), 8);
+        }
+        store->save(roms, _count);
+    }
+}
+
+DS1820Bus::~DS1820Bus() {
+    for (int i = 0; i < _count; i++) {
+        delete _probes[i];
+    }
+    delete _own_bus;
+}
+
+int DS1820Bus::count() {
+    return _count;
+}
+
+DS1820 *DS1820Bus::probe(int index) {
+    if (index < 0 || index >= _count) {
+        return NULL;
+    }
+    return _probes[index];
+}
+
+bool DS1820Bus::restored() {
+    return _restored;
+}
+
+int DS1820Bus::conversionTime() {
+    int slowest = 0;
+    for (int i = 0; i < _count; i++) {
+        int delay_time = _probes[i]->conversionTime();
+        if (delay_time > slowest) {
+            slowest = delay_time;
+        }
+    }
+    return slowest;
+}
+
+int DS1820Bus::resolution() {
+    int coarsest = 12;
+    for (int i = 0; i < _count; i++) {
+        int bits = _probes[i]->resolution();
+        if (bits < coarsest) {
+            coarsest = bits;
+        }
+    }
+    return coarsest;
+}
+
+bool DS1820Bus::startSetResolution(int bits) {
+    if (this->busy()) {
+        return false;
+    }
+    // a skip ROM write reaches every probe, like startConvert
+    return _probes[0]->startSetResolution(bits, DS1820::all_devices);
+}
+
+int DS1820Bus::startConvert() {
+    if (this->busy()) {
+        return -1;
+    }
+    // any probe can send the skip ROM convert, they share the bus
+    if (_probes[0]->startConvert(DS1820::all_devices) < 0) {
+        return -1;
+    }
+    return this->conversionTime();
+}
+
+void DS1820Bus::finishConvert() {
+    _probes[0]->finishConvert();
+}
+
+bool DS1820Bus::startRead() {
+    if (this->busy()) {
+        return false;
+    }
+    _reading = 0;
+    if (!_probes[0]->startRead()) {
+        _reading = -1;
+        return false;
+    }
+    _read_started = true;
+    return true;
+}
+
+bool DS1820Bus::poll() {
+    if (_reading < 0) {
+        return false;
+    }
+    if (!_read_started) {
+        // the bus wasn't free for this probe's read yet, try again
+        _read_started = _probes[_reading]->startRead();
+        return false;
+    }
+    if (!_probes[_reading]->poll()) {
+        return false;
+    }
+    _samples[_reading] = _probes[_reading]->lastTemperatureFixed();
+    _reading++;
+    if (_reading == _count) {
+        _reading = -1;
+        return true;
+    }
+    // the previous read is done, so the bus should be free
+    _read_started = _probes[_reading]->startRead();
+    return false;
+}
+
+bool DS1820Bus::busy() {
+    if (_reading >= 0) {
+        return true;
+    }
+    for (int i = 0; i < _count; i++) {
+        if (_probes[i]->busy()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+const FixedDegrees *DS1820Bus::samples() {
+    return _samples;
+}
+
+int DS1820Bus::sample(float *samples) {
+    int delay_time;
+    // a byte takes ~600us, wait rather than spin on the ISR's progress
+    while ((delay_time = this->startConvert()) < 0) {
+        wait_us(1000);
+    }
+    while (this->busy()) {
+        wait_us(1000);
+    }
+    wait_ms(delay_time);
+    this->finishConvert();
+    while (!this->startRead()) {
+        wait_us(1000);
+    }
+    while (!this->poll()) {
+        wait_us(1000);
+    }
+    for (int i = 0; i < _count; i++) {
+        samples[i] = _samples[i].to_float();
+    }
+    return _count;
+}
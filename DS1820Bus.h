@@ -0,0 +1,142 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef DS1820_BUS_H
+#define DS1820_BUS_H
+
+#include "mbed.h"
+
+#include "DS1820.h"
+#include "RomStore.h"
+
+/** DS1820Bus samples every DS1820 probe on one 1-Wire bus together:
+ * a single skip ROM conversion for all of them, one wait for the slowest
+ * probe's resolution, then each probe's scratchpad is read back in turn
+ * into a contiguous array of samples.
+ *
+ * The conversion and reads run in the background like DS1820's
+ * startConvert() / startRead() / poll(), or use sample() to block.
+ */
+class DS1820Bus {
+public:
+    enum {
+        // as many as the store keeps
+        max_probes = RomStore::max_roms
+    };
+
+    /** Find and create a DS1820 for every probe on the pin, up to max_probes
+     *
+     * With a store, the probes saved there by the last boot are checked for
+     * with DS1820::verifyProbe() instead of searching the bus. The bus is
+     * only searched (and what it finds saved) if one of them doesn't answer,
+     * so a probe added alongside the saved ones isn't found until then.
+     *
+     * @param data_pin DigitalInOut pin for the data bus, bit banged by a OneWire
+     * @param store (optional) where to keep the probes' ROM codes between boots
+     */
+    DS1820Bus(PinName data_pin, RomStore *store = NULL);
+
+    /** As above, on a bus master such as a OneWireUart
+     *
+     * @param bus the 1-Wire bus master, which must outlive this
+     * @param store (optional) where to keep the probes' ROM codes between boots
+     */
+    DS1820Bus(OneWireTransport *bus, RomStore *store = NULL);
+    ~DS1820Bus();
+
+    /** @returns the number of probes found on the bus */
+    int count();
+
+    /** @returns the probe at index, or NULL if out of range */
+    DS1820 *probe(int index);
+
+    /** @returns true if the probes were the ones saved in the store, rather than searched for */
+    bool restored();
+
+    /** This function returns how long the slowest probe on the bus takes to
+      * convert at its current resolution.
+      *
+      * @returns milliseconds per conversion
+      */
+    int conversionTime();
+
+    /** This function returns the coarsest resolution of the probes on the bus.
+      *
+      * @returns bits, 9 to 12
+      */
+    int resolution();
+
+    /** Start setting every probe's resolution at once in the background.
+      *
+      * @param bits between 9 and 12
+      * @returns true if started, false if the bus is busy or bits isn't valid
+      */
+    bool startSetResolution(int bits);
+
+    /** Start a conversion on every probe at once in the background.
+      *
+      * @returns milliseconds untill conversion will complete for all probes,
+      * counted from when busy() returns false, or -1 if the bus is busy.
+      */
+    int startConvert();
+
+    /** End a conversion started by startConvert() */
+    void finishConvert();
+
+    /** Start reading every probe's scratchpad in the background, one after another
+      *
+      * @returns true if the reads were started, false if the bus is busy
+      */
+    bool startRead();
+
+    /** Advance the reads started by startRead(), call regularly.
+      *
+      * @returns true once when every probe has been read, after
+      * which samples() holds the new readings
+      */
+    bool poll();
+
+    /** @returns true while a conversion command or read is in progress */
+    bool busy();
+
+    /** @returns count() readings in degrees C from the last finished reads, in probe order,
+      * each may be DS1820::invalid_conversion
+      */
+    const FixedDegrees *samples();
+
+    /** Convert and read every probe, blocking until done.
+      *
+      * @param samples array of at least count() readings to fill in
+      * @returns the number of readings
+      */
+    int sample(float *samples);
+
+private:
+    OneWireTransport *_bus;
+    // the bus, if made from a pin
+    OneWire *_own_bus;
+    DS1820 *_probes[max_probes];
+    int _count;
+    bool _restored;
+    FixedDegrees _samples[max_probes];
+    // index of the probe being read, or -1 if not reading
+    int _reading;
+    // whether that probe's read has been started
+    bool _read_started;
+
+    void find(RomStore *store);
+};
+
+#endif
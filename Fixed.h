@@ -0,0 +1,89 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef FIXED_H
+#define FIXED_H
+
+// value / divisor rounded to the nearest integer, ties to even
+// (the way printf rounds), divisor must be positive
+inline long long round_divide(long long value, long long divisor) {
+    unsigned long long magnitude = value < 0 ? 0ULL - (unsigned long long)value
+                                             : (unsigned long long)value;
+    unsigned long long quotient = magnitude / divisor;
+    unsigned long long remainder = magnitude % divisor;
+    if (2 * remainder > (unsigned long long)divisor
+        || (2 * remainder == (unsigned long long)divisor && (quotient & 1))) {
+        quotient++;
+    }
+    return value < 0 ? -(long long)quotient : (long long)quotient;
+}
+
+// Fixed is a decimal fixed-point number, raw / SCALE, eg: a Fixed<1000>
+// with raw = 1500 is 1.5. Sensor readings are carried as these from the raw
+// scratchpad / echo timings all the way to the serial output, as the M3 has
+// no FPU and every float operation is a soft float library call.
+// This has no mbed dependencies so that it can be built on the host.
+template<long SCALE>
+class Fixed {
+public:
+    long raw;
+
+    Fixed() : raw(0) {}
+    explicit Fixed(long raw) : raw(raw) {}
+
+    static Fixed from_int(long value) {
+        return Fixed(value * SCALE);
+    }
+
+    // the value rounded to decimals digits after the point, scaled to an
+    // int, eg: 1.25 rounded to 1 decimal is 12, decimals must be no more
+    // than SCALE has
+    long round(int decimals) const {
+        long divisor = SCALE;
+        for (int i = 0; i < decimals; i++) {
+            divisor /= 10;
+        }
+        return (long)round_divide(this->raw, divisor);
+    }
+
+    // conversions for the float APIs, these are not used by the firmware
+    float to_float() const {
+        return (float)this->raw / SCALE;
+    }
+
+    double to_double() const {
+        return (double)this->raw / SCALE;
+    }
+
+    bool operator==(const Fixed &other) const {
+        return this->raw == other.raw;
+    }
+
+    bool operator!=(const Fixed &other) const {
+        return this->raw != other.raw;
+    }
+
+    bool operator<(const Fixed &other) const {
+        return this->raw < other.raw;
+    }
+};
+
+// degrees in ten thousandths, exact for the DS18B20's 1/16 degree steps
+typedef Fixed<10000> FixedDegrees;
+
+// inches in millionths
+typedef Fixed<1000000> FixedInches;
+
+#endif
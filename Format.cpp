@@ -0,0 +1,65 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "Format.h"
+
+char *format_fixed(char *out, long value, int decimals) {
+    // digits are generated least significant first
+    char digits[24];
+    int count = 0;
+    unsigned long magnitude = value < 0 ? 0UL - (unsigned long)value : (unsigned long)value;
+    if (value < 0) {
+        *out++ = '-';
+    }
+    do {
+        digits[count++] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude != 0 || count <= decimals);
+    while (count > 0) {
+        if (count == decimals) {
+            *out++ = '.';
+        }
+        *out++ = digits[--count];
+    }
+    return out;
+}
+
+char *format_int(char *out, long value) {
+    return format_fixed(out, value, 0);
+}
+
+char *format_text(char *out, const char *text) {
+    while (*text) {
+        *out++ = *text++;
+    }
+    return out;
+}
+
+int format_status(char *out, long water_centi_inches, long temperature_deci_c, bool heater) {
+    char *end = out;
+    *end++ = 'W';
+    *end++ = '+';
+    end = format_fixed(end, water_centi_inches, 2);
+    *end++ = ',';
+    *end++ = 'T';
+    *end++ = '+';
+    end = format_fixed(end, temperature_deci_c, 1);
+    *end++ = ',';
+    *end++ = 'B';
+    *end++ = '+';
+    *end++ = heater ? '1' : '0';
+    *end++ = '\n';
+    return end - out;
+}
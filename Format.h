@@ -0,0 +1,41 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef FORMAT_H
+#define FORMAT_H
+
+// printf free formatting of fixed-point values for the serial protocol,
+// printf's %f pulls in soft float formatting on the LPC1768 and is slow.
+// This has no mbed dependencies so that it can be built on the host.
+
+// longest line format_status can write, with the newline
+#define STATUS_LINE_MAX 32
+
+// write value / 10^decimals with exactly decimals digits after the point,
+// eg: format_fixed(out, -1234, 2) writes "-12.34"
+// returns a pointer to the end of what was written, there is no terminator
+char *format_fixed(char *out, long value, int decimals);
+
+// write value as a decimal integer, returns a pointer to the end
+char *format_int(char *out, long value);
+
+// copy text (without its terminator), returns a pointer to the end
+char *format_text(char *out, const char *text);
+
+// write the status line "W+<water>,T+<temperature>,B+<0|1>\n",
+// returns its length, out must have room for STATUS_LINE_MAX bytes
+int format_status(char *out, long water_centi_inches, long temperature_deci_c, bool heater);
+
+#endif
@@ -18,21 +18,88 @@ limitations under the License.
 
 #include "mbed.h"
 
+#include "Fixed.h"
+
 // HC-SR04 sensor
+// The echo pulse is timed by interrupts on its edges against a free running
+// timer, so a measurement can be started with start() and collected later
+// with poll() without busy waiting. A deadline bounds how long a missing
+// or overlong echo can take.
 class HCSR04 {
 private:
-    DigitalOut trig;
-    DigitalIn echo;
-    int       max_read_usec;
+    DigitalOut  trig;
+    InterruptIn echo;
+    Timer       clock;
+    Timeout     deadline;
+    int         max_read_usec;
+    volatile bool measuring;
+    volatile bool done;
+    volatile bool saw_rise;
+    volatile bool timed_out;
+    volatile int  rise_us;
+    volatile int  result_us;
+    void (*done_callback)(void);
+
+    void finish(int raw_us, bool timeout) {
+        this->deadline.detach();
+        this->result_us = raw_us;
+        this->timed_out = timeout;
+        this->measuring = false;
+        this->done = true;
+        if (this->done_callback) {
+            this->done_callback();
+        }
+    }
+
+    // echo ISRs, timing low to high to low
+    void on_rise() {
+        if (this->measuring) {
+            this->rise_us = this->clock.read_us();
+            this->saw_rise = true;
+        }
+    }
+
+    void on_fall() {
+        if (this->measuring && this->saw_rise) {
+            int raw_us = this->clock.read_us() - this->rise_us;
+            this->finish(raw_us < this->max_read_usec ? raw_us : this->max_read_usec, false);
+        }
+    }
+
+    // no echo, or no end to it, in time: report the maximum like a timed out read
+    void on_deadline() {
+        if (this->measuring) {
+            this->finish(this->max_read_usec, true);
+        }
+    }
+
 public:
+    // the sensor raises echo a few hundred us after the trigger,
+    // allow this long for it before the echo itself is timed
+    static const int max_echo_start_usec = 2000;
+    // how often read_raw checks on the measurement
+    static const int blocking_poll_usec = 100;
+
     HCSR04(PinName trigger_pin, PinName echo_pin) : trig(trigger_pin), echo(echo_pin) {
-        this->set_max_read_inches(72);
+        this->set_max_read_usec(74 * 2 * 72);
+        this->measuring = false;
+        this->done = false;
+        this->saw_rise = false;
+        this->timed_out = false;
+        this->rise_us = 0;
+        this->result_us = 0;
+        this->done_callback = NULL;
+        this->clock.start();
+        this->echo.rise(callback(this, &HCSR04::on_rise));
+        this->echo.fall(callback(this, &HCSR04::on_fall));
     }
 
-    // trigger sensor and read raw timing in us
-    int read_raw() {
-        Timer tmr;
-        const int max_read = this->max_read_usec;
+    // trigger sensor, the echo is timed in the background
+    // returns false if a measurement is already in progress
+    bool start() {
+        if (this->measuring) {
+            return false;
+        }
         // clear trigger pin low
         this->trig.write(0);
         wait_us(5);
@@ -40,18 +107,73 @@ public:
         this->trig.write(1);
         wait_us(10);
         this->trig.write(0);
-        // read result, time low to high
-        // wait for low first, then start timing
-        while (!echo);
-        tmr.start();
-        while (echo && tmr.read_us() < max_read);
-        tmr.stop();
-        return tmr.read_us();
+        this->saw_rise = false;
+        this->done = false;
+        this->measuring = true;
+        this->deadline.attach_us(callback(this, &HCSR04::on_deadline),
+                                 max_echo_start_usec + this->max_read_usec);
+        return true;
+    }
+
+    // returns true once when a measurement started by start() has finished
+    bool poll() {
+        if (this->done) {
+            this->done = false;
+            return true;
+        }
+        return false;
+    }
+
+    // raw timing in us of the last finished measurement
+    int last_raw() {
+        return this->result_us;
+    }
+
+    // inches of the last finished measurement
+    FixedInches last_fixed_inches() {
+        return fixed_inches_from_raw(this->last_raw());
+    }
+
+    double last_inches() {
+        return this->last_fixed_inches().to_double();
+    }
+
+    // set a function to call (from interrupt context) when a measurement
+    // finishes, or NULL to disable
+    void set_done_callback(void (*f)(void)) {
+        this->done_callback = f;
+    }
+
+    // true if the last finished measurement hit the deadline,
+    // eg: because the sensor is unplugged
+    bool last_timed_out() {
+        return this->timed_out;
+    }
+
+    // trigger sensor and read raw timing in us, blocking until
+    // the echo finishes or the deadline passes
+    int read_raw() {
+        // wait between checks rather than spin on the flags the ISRs set,
+        // time only passes in waits when simulated (see sim/)
+        while (!this->start()) {
+            wait_us(blocking_poll_usec);
+        }
+        while (!this->poll()) {
+            wait_us(blocking_poll_usec);
+        }
+        return this->last_raw();
+    }
+
+    // convert raw us timing to inches, (raw_us / 2) / 74
+    static FixedInches fixed_inches_from_raw(int raw_us) {
+        // 1000000 / 148 = 250000 / 37, split to keep raw_us * 250000 in range
+        long whole = raw_us / 37;
+        long part = raw_us % 37;
+        return FixedInches(whole * 250000 + (part * 250000 + 18) / 37);
     }
 
-    // convert raw us timing to inches
     static double inches_from_raw(int raw_us) {
-        return (raw_us/2.) / 74.;
+        return fixed_inches_from_raw(raw_us).to_double();
     }
 
     // trigger sensor and return inches read
@@ -63,7 +185,11 @@ public:
     // note that this avoids hanging while reading the sensor
     // setting a very high value with negatively impact pathological reads
     void set_max_read_inches(double max_inches) {
-        this->max_read_usec = 74 * 2 * max_inches;
+        this->set_max_read_usec(74 * 2 * max_inches);
+    }
+
+    void set_max_read_usec(int max_usec) {
+        this->max_read_usec = max_usec;
     }
 };
 
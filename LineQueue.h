@@ -0,0 +1,162 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef LINE_QUEUE_H
+#define LINE_QUEUE_H
+
+// LineQueue is a lock free single producer / single consumer ring of
+// received lines, meant to be filled a byte at a time from a serial RX
+// interrupt and drained from the main loop.
+//
+// The producer splits the bytes into text lines (ending in a newline) and
+// binary frames (between zero bytes, see Protocol.h) as they arrive, writing
+// each straight into its slot in the ring, so the consumer gets a pointer +
+// length view of each message without any copying.
+// Lines too long for a slot are dropped and counted, as are lines that
+// arrive while every slot is full.
+//
+// SLOTS must be a power of two.
+template<int SLOTS, int LINE_SIZE>
+class LineQueue {
+private:
+    struct slot {
+        char data[LINE_SIZE];
+        int  length;
+        bool frame;
+    };
+
+    slot slots[SLOTS];
+    // head is only written by the producer, tail only by the consumer,
+    // both count up forever and are masked to index into slots
+    volatile unsigned head;
+    volatile unsigned tail;
+
+    // producer state
+    int  fill;
+    bool in_frame;
+    bool discarding;
+    volatile unsigned overruns;
+    volatile unsigned overlong;
+
+    // keep the compiler from moving slot writes past head / tail updates,
+    // this only needs to order memory against an ISR on the same core
+    static void barrier() {
+        __asm volatile ("" : : : "memory");
+    }
+
+    void commit() {
+        slot &s = this->slots[this->head & (SLOTS - 1)];
+        s.length = this->fill;
+        s.frame = this->in_frame;
+        barrier();
+        this->head = this->head + 1;
+        this->fill = 0;
+        this->in_frame = false;
+    }
+
+    // drop whatever is in progress, and everything up to the next terminator
+    void discard() {
+        this->fill = 0;
+        this->discarding = true;
+    }
+
+public:
+    LineQueue() {
+        this->head = 0;
+        this->tail = 0;
+        this->fill = 0;
+        this->in_frame = false;
+        this->discarding = false;
+        this->overruns = 0;
+        this->overlong = 0;
+    }
+
+    // producer: add a received byte,
+    // returns true if it completed a message for the consumer
+    bool push(char c) {
+        bool terminator = this->in_frame ? (c == 0) : (c == '\n');
+        if (this->discarding && terminator) {
+            this->discarding = false;
+            this->in_frame = false;
+            return false;
+        }
+        if (c == 0 && (!this->in_frame || this->fill == 0)) {
+            // a zero byte starts a binary frame, dropping any partial line
+            this->fill = 0;
+            this->in_frame = true;
+            this->discarding = false;
+            return false;
+        }
+        if (this->discarding) {
+            return false;
+        }
+        if (this->head - this->tail == SLOTS) {
+            // no free slot to receive into, drop this message
+            this->overruns = this->overruns + 1;
+            if (terminator) {
+                this->fill = 0;
+                this->in_frame = false;
+            } else {
+                this->discard();
+            }
+            return false;
+        }
+        if (terminator) {
+            this->commit();
+            return true;
+        }
+        if (this->fill == LINE_SIZE) {
+            this->overlong = this->overlong + 1;
+            this->discard();
+            return false;
+        }
+        this->slots[this->head & (SLOTS - 1)].data[this->fill++] = c;
+        return false;
+    }
+
+    // consumer: view the oldest complete message without removing it,
+    // frame is set if it is a binary frame rather than a text line.
+    // lines do not include the newline, frames do not include the zeros.
+    // returns false if there is none
+    bool front(const char **line, int *length, bool *frame) {
+        if (this->tail == this->head) {
+            return false;
+        }
+        barrier();
+        const slot &s = this->slots[this->tail & (SLOTS - 1)];
+        *line = s.data;
+        *length = s.length;
+        *frame = s.frame;
+        return true;
+    }
+
+    // consumer: release the message returned by front()
+    void pop() {
+        barrier();
+        this->tail = this->tail + 1;
+    }
+
+    // messages dropped because every slot was full
+    unsigned overrun_count() const {
+        return this->overruns;
+    }
+
+    // messages dropped because they did not fit in a slot
+    unsigned overlong_count() const {
+        return this->overlong;
+    }
+};
+
+#endif
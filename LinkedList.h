@@ -54,8 +54,9 @@ public:
         Node<T>* curr = this->head;
         while (curr != NULL && curr_index != index) {
             curr = curr->next;
+            curr_index++;
         }
-        if (curr_index == index) {
+        if (curr != NULL) {
             return curr->data;
         }
         return NULL;
@@ -74,10 +75,15 @@ public:
         while (curr != NULL && curr_index != index) {
             prev = curr;
             curr = curr->next;
+            curr_index++;
         }
-        if (curr_index == index) {
+        if (curr != NULL) {
             T* data = curr->data;
-            prev->next = curr->next;
+            if (prev == NULL) {
+                this->head = curr->next;
+            } else {
+                prev->next = curr->next;
+            }
             delete curr;
             return data;
         }
@@ -0,0 +1,182 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "OneWire.h"
+
+// The slot timings below match the blocking routines at the end.
+// Every low period of a slot is waited out in the ISR with interrupts
+// masked, a late Timeout releasing a write 0 could stretch it past the
+// end of the slot (~120us) or even into a reset pulse (480us).
+// The Timeouts only time the gaps between slots, and the reset pulse,
+// where firing late just stretches the recovery time.
+
+OneWire::OneWire(PinName pin) : pin(pin) {
+    this->current_state = state_idle;
+}
+
+void OneWire::begin(bool reset) {
+    if (reset) {
+        // bring low for 500 us
+        this->pin.output();
+        this->pin.write(0);
+        this->schedule(state_reset_release, 500);
+    } else {
+        this->schedule(state_slot, 1);
+    }
+}
+
+void OneWire::schedule(state next, int us) {
+    this->current_state = next;
+    this->timeout.attach_us(callback(this, &OneWire::step), us);
+}
+
+void OneWire::drive_high() {
+    this->pin.output();
+    this->pin.write(1);
+}
+
+void OneWire::float_bus() {
+    this->pin.input();
+}
+
+// step runs from the Timeout interrupt and advances the transaction
+void OneWire::step() {
+    switch (this->current_state) {
+    case state_reset_release:
+        // let the data line float high, then look for a presence pulse
+        this->pin.input();
+        this->schedule(state_reset_sample, 90);
+        break;
+
+    case state_reset_sample:
+        // see if any devices are pulling the data line low
+        this->presence_detected = (this->pin.read() == 0);
+        if (!this->presence_detected) {
+            this->current_state = state_idle;
+            this->finish();
+        } else {
+            this->schedule(state_slot, 410);
+        }
+        break;
+
+    case state_slot:
+        if (this->tx_bit < this->tx_bits) {
+            // output data least sig bit first
+            bool bit = (this->tx[this->tx_bit / 8] >> (this->tx_bit % 8)) & 0x01;
+            this->tx_bit++;
+            __disable_irq();
+            this->pin.output();
+            this->pin.write(0);
+            wait_us(3);
+            if (!bit) {
+                // keep data line low for the rest of the slot
+                wait_us(55);
+            }
+            this->pin.write(1);
+            __enable_irq();
+            if (bit) {
+                // data line high for the rest of the slot
+                this->schedule(state_slot, 55);
+            } else {
+                // allow the bus to float high before the next slot
+                this->schedule(state_slot, 10);
+            }
+        } else if (this->rx_bit < this->rx_bits) {
+            __disable_irq();
+            this->pin.output();
+            this->pin.write(0);
+            wait_us(3);
+            this->pin.input();
+            wait_us(10);
+            bool bit = this->pin.read();
+            __enable_irq();
+            if (bit) {
+                // read data least sig bit first
+                this->rx[this->rx_bit / 8] |= 0x01 << (this->rx_bit % 8);
+            }
+            this->rx_bit++;
+            this->schedule(state_slot, 45);
+        } else {
+            this->current_state = state_idle;
+            this->finish();
+        }
+        break;
+
+    case state_idle:
+        break;
+    }
+}
+
+// The blocking routines wait out the same timings as step(), after waiting
+// for any transaction step() is running, so that their slots don't interleave
+
+bool OneWire::reset() {
+    this->wait();
+    // low for 500us, then look for a presence pulse 90us after letting go
+    this->pin.output();
+    this->pin.write(0);
+    wait_us(500);
+    this->pin.input();
+    wait_us(90);
+    bool presence = this->pin.read() == 0;
+    wait_us(410);
+    return presence;
+}
+
+void OneWire::write_bit(bool bit) {
+    this->wait();
+    this->pin.output();
+    this->pin.write(0);
+    wait_us(3);
+    if (bit) {
+        this->pin.write(1);
+        wait_us(55);
+    } else {
+        wait_us(55);
+        this->pin.write(1);
+        // recovery, before the next slot
+        wait_us(10);
+    }
+}
+
+bool OneWire::read_bit() {
+    this->wait();
+    this->pin.output();
+    this->pin.write(0);
+    wait_us(3);
+    this->pin.input();
+    wait_us(10);
+    bool bit = this->pin.read();
+    wait_us(45);
+    return bit;
+}
+
+void OneWire::write_byte(char data) {
+    this->wait();
+    for (int i = 0; i < 8; i++) {
+        this->write_bit((data >> i) & 0x01);
+    }
+}
+
+char OneWire::read_byte() {
+    char data = 0x00;
+    this->wait();
+    for (int i = 0; i < 8; i++) {
+        if (this->read_bit()) {
+            data |= 0x01 << i;
+        }
+    }
+    return data;
+}
@@ -0,0 +1,61 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef ONE_WIRE_H
+#define ONE_WIRE_H
+
+#include "mbed.h"
+
+#include "OneWireTransport.h"
+
+// OneWire runs 1-Wire transactions (reset, bytes out, bytes in) on a pin in
+// the background, driven by a Timeout instead of spinning in wait_us.
+// Only the timing critical low part of each slot runs with interrupts masked,
+// up to 13us for a read or a 1 and 58us for a 0. The recovery between slots
+// and the reset pulse are left to the timer.
+// The blocking routines bit bang the pin with wait_us.
+class OneWire : public OneWireTransport {
+public:
+    OneWire(PinName pin);
+
+    bool reset();
+    void write_bit(bool bit);
+    bool read_bit();
+    void write_byte(char data);
+    char read_byte();
+
+protected:
+    void begin(bool reset);
+    void drive_high();
+    void float_bus();
+
+private:
+    enum state {
+        state_idle,
+        state_reset_release,
+        state_reset_sample,
+        state_slot
+    };
+
+    DigitalInOut pin;
+    Timeout timeout;
+
+    volatile state current_state;
+
+    void schedule(state next, int us);
+    void step();
+};
+
+#endif
@@ -0,0 +1,127 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "OneWireTransport.h"
+
+// how often the blocking routines check on a transaction, a slot is ~70us
+#define WAIT_POLL_US 50
+
+OneWireTransport::OneWireTransport() {
+    this->done_callback = NULL;
+    this->pullup = NULL;
+    this->pullup_active = true;
+    this->pullup_requested = false;
+    this->in_progress = false;
+    this->presence_detected = false;
+    this->tx_bits = 0;
+    this->tx_bit = 0;
+    this->rx = NULL;
+    this->rx_bits = 0;
+    this->rx_bit = 0;
+}
+
+bool OneWireTransport::start_bits(bool reset, const char *tx, int tx_bits, char *rx, int rx_bits,
+                                  bool strong_pullup) {
+    if (this->in_progress || tx_bits > max_write_bytes * 8) {
+        return false;
+    }
+    this->in_progress = true;
+    this->pullup_requested = strong_pullup;
+    for (int i = 0; i < (tx_bits + 7) / 8; i++) {
+        this->tx[i] = tx[i];
+    }
+    this->tx_bits = tx_bits;
+    this->tx_bit = 0;
+    this->rx = rx;
+    this->rx_bits = rx_bits;
+    this->rx_bit = 0;
+    for (int i = 0; i < (rx_bits + 7) / 8; i++) {
+        rx[i] = 0x00;
+    }
+    if (!reset) {
+        this->presence_detected = true;
+    }
+    this->begin(reset);
+    return true;
+}
+
+void OneWireTransport::pull_up() {
+    if (this->pullup) {
+        this->float_bus();
+        this->pullup->write(this->pullup_active);
+    } else {
+        this->drive_high();
+    }
+}
+
+void OneWireTransport::release() {
+    if (this->pullup) {
+        this->pullup->write(!this->pullup_active);
+    }
+    this->float_bus();
+}
+
+void OneWireTransport::finish() {
+    // parasite powered devices need the strong pullup within 10us
+    if (this->pullup_requested && this->presence_detected) {
+        this->pull_up();
+    }
+    this->in_progress = false;
+    if (this->done_callback) {
+        this->done_callback();
+    }
+}
+
+void OneWireTransport::wait() {
+    while (this->in_progress) {
+        wait_us(WAIT_POLL_US);
+    }
+}
+
+bool OneWireTransport::reset() {
+    this->wait();
+    this->start_bits(true, NULL, 0, NULL, 0);
+    this->wait();
+    return this->presence_detected;
+}
+
+void OneWireTransport::write_bit(bool bit) {
+    char data = bit;
+    this->wait();
+    this->start_bits(false, &data, 1, NULL, 0);
+    this->wait();
+}
+
+bool OneWireTransport::read_bit() {
+    char data;
+    this->wait();
+    this->start_bits(false, NULL, 0, &data, 1);
+    this->wait();
+    return data & 0x01;
+}
+
+void OneWireTransport::write_byte(char data) {
+    this->wait();
+    this->start_bits(false, &data, 8, NULL, 0);
+    this->wait();
+}
+
+char OneWireTransport::read_byte() {
+    char data;
+    this->wait();
+    this->start_bits(false, NULL, 0, &data, 8);
+    this->wait();
+    return data;
+}
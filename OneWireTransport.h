@@ -0,0 +1,121 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef ONE_WIRE_TRANSPORT_H
+#define ONE_WIRE_TRANSPORT_H
+
+#include "mbed.h"
+
+// OneWireTransport is a 1-Wire bus master, either bit banged on a pin
+// (OneWire) or run by a UART (OneWireUart), so that DS1820 can use either.
+//
+// Transactions (reset, bits out, bits in) run in the background, the
+// blocking routines below are for the search and the other rare
+// operations, and wait for a transaction by default.
+class OneWireTransport {
+public:
+    enum {
+        // match ROM (1 + 8 bytes) + write scratchpad (1 + 3)
+        max_write_bytes = 13
+    };
+
+    OneWireTransport();
+    virtual ~OneWireTransport() {}
+
+    // start a transaction in the background: an optional reset pulse,
+    // then tx_len bytes from tx, then rx_len bytes read into rx.
+    // rx must stay valid until the transaction completes.
+    // if strong_pullup is set the bus is held high when the transaction
+    // completes (for parasite powered devices) until release() is called.
+    // returns false without doing anything if a transaction is in progress
+    bool start(bool reset, const char *tx, int tx_len, char *rx, int rx_len,
+               bool strong_pullup = false) {
+        return this->start_bits(reset, tx, tx_len * 8, rx, rx_len * 8, strong_pullup);
+    }
+
+    // start() counting bits rather than bytes, least sig bit first
+    bool start_bits(bool reset, const char *tx, int tx_bits, char *rx, int rx_bits,
+                    bool strong_pullup = false);
+
+    // hold the bus high now, for parasite powered devices
+    void pull_up();
+
+    // drop the strong pullup left on by a transaction, and let the bus float
+    void release();
+
+    // use an external pullup (eg: a MOSFET connecting data to Vdd) rather
+    // than driving the data pin, active is the level that switches it on
+    void set_strong_pullup(DigitalOut *pullup, bool active) {
+        this->pullup = pullup;
+        this->pullup_active = active;
+    }
+
+    // true while a transaction is in progress
+    bool busy() const {
+        return this->in_progress;
+    }
+
+    // true if any device answered the last reset pulse, a transaction
+    // without presence is abandoned before any bytes are sent
+    bool presence() const {
+        return this->presence_detected;
+    }
+
+    // set a function to call (from interrupt context) when a transaction
+    // completes, or NULL to disable
+    void set_done_callback(void (*f)(void)) {
+        this->done_callback = f;
+    }
+
+    // blocking, returns true if any device answered the reset pulse
+    virtual bool reset();
+    virtual void write_bit(bool bit);
+    virtual bool read_bit();
+    // least sig bit first
+    virtual void write_byte(char data);
+    virtual char read_byte();
+
+protected:
+    // start the transaction set up by start_bits, with a reset pulse first
+    // if reset, then call finish() when it is done
+    virtual void begin(bool reset) = 0;
+    // drive the bus high, for the strong pullup without an external one
+    virtual void drive_high() = 0;
+    // stop driving the bus
+    virtual void float_bus() = 0;
+
+    void finish();
+
+    // wait for the transaction in progress to finish
+    void wait();
+
+    volatile bool in_progress;
+    volatile bool presence_detected;
+
+    char tx[max_write_bytes];
+    int tx_bits;
+    int tx_bit;
+    char *rx;
+    int rx_bits;
+    int rx_bit;
+
+private:
+    DigitalOut *pullup;
+    bool pullup_active;
+    bool pullup_requested;
+    void (*done_callback)(void);
+};
+
+#endif
@@ -0,0 +1,94 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "OneWireUart.h"
+
+// the reset byte, start bit and 4 low bits
+#define RESET_BYTE 0xF0
+// a 1 or read slot, just the start bit
+#define SLOT_ONE 0xFF
+// a 0 slot, start bit and 8 low bits
+#define SLOT_ZERO 0x00
+
+OneWireUart::OneWireUart(PinName tx, PinName rx) : uart(tx, rx, slot_baud) {
+    this->resetting = false;
+    this->sent = 0;
+    this->echoed = 0;
+    // whatever is in the RX FIFO
+    while (this->uart.readable()) {
+        this->uart.getc();
+    }
+    this->uart.attach(callback(this, &OneWireUart::on_rx), SerialBase::RxIrq);
+}
+
+void OneWireUart::begin(bool reset) {
+    this->sent = 0;
+    this->echoed = 0;
+    if (reset) {
+        this->resetting = true;
+        this->uart.baud(reset_baud);
+        this->uart.putc(RESET_BYTE);
+    } else {
+        // the RX interrupt tops up the slots too
+        __disable_irq();
+        this->send_slots();
+        __enable_irq();
+    }
+}
+
+// top up the slots in flight
+void OneWireUart::send_slots() {
+    int total = this->tx_bits + this->rx_bits;
+    if (this->echoed == total) {
+        this->finish();
+        return;
+    }
+    while (this->sent < total && this->sent - this->echoed < max_queued) {
+        bool one = true;
+        if (this->sent < this->tx_bits) {
+            one = (this->tx[this->sent / 8] >> (this->sent % 8)) & 0x01;
+        }
+        this->uart.putc(one ? SLOT_ONE : SLOT_ZERO);
+        this->sent++;
+    }
+}
+
+// the echo of each byte sent, from the RX interrupt
+void OneWireUart::on_rx() {
+    while (this->uart.readable()) {
+        int echo = this->uart.getc();
+        if (!this->in_progress) {
+            continue;
+        }
+        if (this->resetting) {
+            this->resetting = false;
+            this->uart.baud(slot_baud);
+            this->presence_detected = echo != RESET_BYTE;
+            if (!this->presence_detected) {
+                this->finish();
+            } else {
+                this->send_slots();
+            }
+            continue;
+        }
+        if (this->echoed >= this->tx_bits && echo == SLOT_ONE) {
+            // read data least sig bit first
+            this->rx_bit = this->echoed - this->tx_bits;
+            this->rx[this->rx_bit / 8] |= 0x01 << (this->rx_bit % 8);
+        }
+        this->echoed++;
+        this->send_slots();
+    }
+}
@@ -0,0 +1,66 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef ONE_WIRE_UART_H
+#define ONE_WIRE_UART_H
+
+#include "mbed.h"
+
+#include "OneWireTransport.h"
+
+// OneWireUart runs the 1-Wire bus from a UART whose TX drives the bus
+// through an open drain buffer (or a diode, cathode to TX) and whose RX is
+// wired to the bus, so that it receives an echo of every byte sent as the
+// devices left it:
+//  - a reset is 0xF0 at 9600 baud, 520us low, and a presence pulse pulls
+//    down some of the high bits of the echo
+//  - every other slot is a byte at 115200 baud: 0xFF to write a 1 or read
+//    (the start bit is the 8.7us low pulse), 0x00 to write a 0 (78us low).
+//    reading, a device sending a 0 holds the bus low into the data bits,
+//    so anything but 0xFF echoed is a 0
+//
+// The UART times every pulse, the RX interrupt just takes each echo and
+// queues another slot, keeping up to 8 in the FIFO, so interrupts that
+// delay it only stretch the recovery time between slots.
+// The bus can't be held high through the buffer, parasite powered probes
+// need a strong pullup, see set_strong_pullup.
+class OneWireUart : public OneWireTransport {
+public:
+    OneWireUart(PinName tx, PinName rx);
+
+protected:
+    void begin(bool reset);
+    void drive_high() {}
+    void float_bus() {}
+
+private:
+    enum {
+        reset_baud = 9600,
+        slot_baud = 115200,
+        // slots in flight, half the UART's 16 byte FIFOs
+        max_queued = 8
+    };
+
+    RawSerial uart;
+    volatile bool resetting;
+    // slots sent / echoed in this transaction
+    int sent;
+    int echoed;
+
+    void send_slots();
+    void on_rx();
+};
+
+#endif
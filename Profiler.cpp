@@ -0,0 +1,66 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "Profiler.h"
+
+#ifndef NO_PROFILING
+
+Profiler profiler;
+bool Profiler::has_cycle_counter;
+bool Profiler::started;
+
+void Profiler::start() {
+#if defined(DWT_CTRL_CYCCNTENA_Msk)
+    // the cycle counter is part of the debug trace unit, enable it
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    if (!(DWT->CTRL & DWT_CTRL_NOCYCCNT_Msk)) {
+        DWT->CYCCNT = 0;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+        has_cycle_counter = true;
+    }
+#endif
+    started = true;
+}
+
+int Profiler::add(const char *name) {
+    if (!started) {
+        start();
+    }
+    if (this->num_sections == max_sections) {
+        return -1;
+    }
+    int id = this->num_sections++;
+    this->sections[id].name = name;
+    return id;
+}
+
+void Profiler::reset() {
+    for (int i = 0; i < this->num_sections; i++) {
+        section &s = this->sections[i];
+        s.count = 0;
+        s.min = 0;
+        s.max = 0;
+        s.total = 0;
+        for (int b = 0; b < buckets; b++) {
+            s.histogram[b] = 0;
+        }
+    }
+}
+
+unsigned Profiler::frequency() {
+    return has_cycle_counter ? SystemCoreClock : 1000000;
+}
+
+#endif
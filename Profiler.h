@@ -0,0 +1,131 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "mbed.h"
+
+// Profiler times named sections of code with the Cortex-M3 DWT cycle
+// counter, falling back to the microsecond ticker (as used by Timer) on
+// cores without one, and keeps the count, min / average / max and a log2
+// histogram of each section's time in ticks.
+//
+// Time a block with PROFILE_SCOPE(id), with id from PROFILE_SECTION(name).
+// Sections must each only be used from one context (thread or ISR).
+// Building with NO_PROFILING defined compiles all of this out, leaving
+// PROFILE_SECTION as -1 and PROFILE_SCOPE as nothing.
+
+#ifdef NO_PROFILING
+
+#define PROFILE_SECTION(name) (-1)
+#define PROFILE_SCOPE(id)
+
+#else
+
+class Profiler {
+public:
+    enum {
+        max_sections = 16,
+        // bucket i counts times of 2^i to 2^(i+1) - 1 ticks (0 in bucket 0)
+        buckets = 32
+    };
+
+    struct section {
+        const char *name;
+        unsigned count;
+        unsigned min;
+        unsigned max;
+        unsigned long long total;
+        unsigned histogram[buckets];
+    };
+
+    // NOTE: there is no constructor, Profiler is used during static
+    // initialization and relies on being zero initialized before it
+
+    // add a section, returns its id or -1 if there are already max_sections
+    int add(const char *name);
+
+    // record a section taking ticks
+    void record(int id, unsigned ticks) {
+        if (id < 0) {
+            return;
+        }
+        section &s = this->sections[id];
+        if (s.count == 0 || ticks < s.min) {
+            s.min = ticks;
+        }
+        if (ticks > s.max) {
+            s.max = ticks;
+        }
+        s.count++;
+        s.total += ticks;
+        s.histogram[ticks ? 31 - __builtin_clz(ticks) : 0]++;
+    }
+
+    int count() const {
+        return this->num_sections;
+    }
+
+    const section &get(int id) const {
+        return this->sections[id];
+    }
+
+    // clear every section's stats
+    void reset();
+
+    // the current time in ticks
+    static unsigned now() {
+#if defined(DWT_CTRL_CYCCNTENA_Msk)
+        if (has_cycle_counter) {
+            return DWT->CYCCNT;
+        }
+#endif
+        return us_ticker_read();
+    }
+
+    // ticks per second
+    static unsigned frequency();
+
+private:
+    section sections[max_sections];
+    int num_sections;
+    static bool has_cycle_counter;
+    static bool started;
+    static void start();
+};
+
+extern Profiler profiler;
+
+// times its own lifetime into a section
+class ProfileScope {
+private:
+    int id;
+    unsigned start;
+
+public:
+    ProfileScope(int id) : id(id), start(Profiler::now()) {}
+
+    ~ProfileScope() {
+        profiler.record(this->id, Profiler::now() - this->start);
+    }
+};
+
+#define PROFILE_SECTION(name) profiler.add(name)
+#define PROFILE_SCOPE(id) ProfileScope profile_scope(id)
+
+#endif
+
+#endif
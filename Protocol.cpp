@@ -0,0 +1,116 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "Protocol.h"
+
+#include "CRC8.h"
+
+int cobs_encode(const char *in, int length, char *out) {
+    // out[code_index] holds the distance to the next zero
+    int code_index = 0;
+    int out_index = 1;
+    char code = 1;
+    for (int i = 0; i < length; i++) {
+        if (in[i] != 0) {
+            out[out_index++] = in[i];
+            code++;
+        }
+        if (in[i] == 0 || code == (char)0xFF) {
+            out[code_index] = code;
+            code = 1;
+            code_index = out_index++;
+        }
+    }
+    out[code_index] = code;
+    return out_index;
+}
+
+int cobs_decode(const char *in, int length, char *out) {
+    int in_index = 0;
+    int out_index = 0;
+    while (in_index < length) {
+        unsigned char code = in[in_index++];
+        if (code == 0 || in_index + code - 1 > length) {
+            return -1;
+        }
+        for (int i = 1; i < code; i++) {
+            if (in[in_index] == 0) {
+                return -1;
+            }
+            out[out_index++] = in[in_index++];
+        }
+        // a full block has no implied zero, nor does the end of the frame
+        if (code != 0xFF && in_index < length) {
+            out[out_index++] = 0;
+        }
+    }
+    return out_index;
+}
+
+int frame_encode(char type, char sequence, const char *payload, int length, char *out) {
+    char frame[FRAME_OVERHEAD + FRAME_MAX_PAYLOAD];
+    if (length > FRAME_MAX_PAYLOAD) {
+        return -1;
+    }
+    frame[0] = type;
+    frame[1] = sequence;
+    for (int i = 0; i < length; i++) {
+        frame[2 + i] = payload[i];
+    }
+    frame[2 + length] = crc8(frame, 2 + length);
+    int encoded = cobs_encode(frame, FRAME_OVERHEAD + length, out);
+    out[encoded++] = 0;
+    return encoded;
+}
+
+int frame_decode(const char *in, int length, char *type, char *sequence, char *payload) {
+    char frame[FRAME_OVERHEAD + FRAME_MAX_PAYLOAD + 1];
+    // decoding never grows the data, so this bounds the decoded length
+    if (length > (int)sizeof(frame)) {
+        return -1;
+    }
+    int decoded = cobs_decode(in, length, frame);
+    if (decoded < FRAME_OVERHEAD || decoded > FRAME_OVERHEAD + FRAME_MAX_PAYLOAD) {
+        return -1;
+    }
+    if (crc8(frame, decoded - 1) != frame[decoded - 1]) {
+        return -1;
+    }
+    *type = frame[0];
+    *sequence = frame[1];
+    int payload_length = decoded - FRAME_OVERHEAD;
+    for (int i = 0; i < payload_length; i++) {
+        payload[i] = frame[2 + i];
+    }
+    return payload_length;
+}
+
+int status_payload(char *out, int water_centi_inches, int temperature_deci_c, bool heater) {
+    out[0] = water_centi_inches & 0xFF;
+    out[1] = (water_centi_inches >> 8) & 0xFF;
+    out[2] = temperature_deci_c & 0xFF;
+    out[3] = (temperature_deci_c >> 8) & 0xFF;
+    out[4] = heater ? FRAME_STATUS_FLAG_HEATER : 0;
+    return FRAME_STATUS_PAYLOAD_SIZE;
+}
+
+int telemetry_payload(char *out, int water_centi_inches, int temperature_deci_c, bool heater,
+                      unsigned long timestamp_ms) {
+    int length = status_payload(out, water_centi_inches, temperature_deci_c, heater);
+    for (int i = 0; i < 4; i++) {
+        out[length++] = (timestamp_ms >> (8 * i)) & 0xFF;
+    }
+    return length;
+}
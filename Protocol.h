@@ -0,0 +1,104 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+// Binary protocol, spoken alongside the text commands.
+//
+// A frame is [type][sequence][payload...][CRC-8 of the preceding bytes]
+// (CRC8.h), COBS encoded so that it contains no zero bytes and terminated
+// by a zero byte. Requests must also start with a zero byte, which is how
+// the controller tells them apart from text commands. Responses echo the
+// request's sequence number.
+// This has no mbed dependencies so that it can be built on the host.
+
+// request frame types
+#define FRAME_STATUS_REQUEST 0x01
+#define FRAME_BREW_ENABLE    0x02
+#define FRAME_BREW_DISABLE   0x03
+#define FRAME_RESET          0x04
+#define FRAME_SUBSCRIBE      0x05
+#define FRAME_HISTORY_REQUEST 0x06
+// response frame types
+#define FRAME_STATUS         0x81
+#define FRAME_TELEMETRY      0x82
+#define FRAME_HISTORY        0x83
+#define FRAME_HISTORY_END    0x84
+#define FRAME_ERROR          0xFF
+
+// FRAME_STATUS payload, all little endian:
+// int16 water level in 1/100 inches, int16 temperature in 1/10 degrees C,
+// uint8 flags (bit 0 = heater enabled)
+#define FRAME_STATUS_PAYLOAD_SIZE 5
+#define FRAME_STATUS_FLAG_HEATER  0x01
+
+// FRAME_SUBSCRIBE payload, all little endian:
+// uint16 interval in ms (0 for none), uint16 change threshold (0 for none)
+// in the units of the status payload, both 0 to unsubscribe
+#define FRAME_SUBSCRIBE_PAYLOAD_SIZE 4
+
+// FRAME_TELEMETRY payload, sent unrequested to a subscriber with the
+// sample's sequence number (mod 256) as the frame's sequence number:
+// the FRAME_STATUS payload, then uint32 LE ms since boot
+#define FRAME_TELEMETRY_PAYLOAD_SIZE (FRAME_STATUS_PAYLOAD_SIZE + 4)
+
+// FRAME_HISTORY_REQUEST is answered with the whole sample history (see
+// SampleHistory.h) oldest first, as FRAME_HISTORY frames numbered from 0
+// (mod 256) in their sequence numbers, then a FRAME_HISTORY_END echoing
+// the request's sequence number.
+// FRAME_HISTORY payload: uint8 flags, then up to FRAME_HISTORY_MAX_DATA
+// bytes of encoded samples, continuing the previous frame's block unless
+// FRAME_HISTORY_FLAG_BLOCK is set
+#define FRAME_HISTORY_FLAG_BLOCK 0x01
+#define FRAME_HISTORY_MAX_DATA   (FRAME_MAX_PAYLOAD - 1)
+// FRAME_HISTORY_END payload, little endian:
+// uint16 FRAME_HISTORY frames sent, uint32 samples sent
+#define FRAME_HISTORY_END_PAYLOAD_SIZE 6
+
+// largest payload supported
+#define FRAME_MAX_PAYLOAD 32
+// type + sequence + CRC
+#define FRAME_OVERHEAD 3
+// worst case encoded size of a frame, with the terminating zero
+#define FRAME_MAX_ENCODED (FRAME_OVERHEAD + FRAME_MAX_PAYLOAD + 2)
+
+// COBS encode length bytes of in to out, which must have room for
+// length + length / 254 + 1 bytes. returns the encoded length
+int cobs_encode(const char *in, int length, char *out);
+
+// COBS decode length bytes of in (without the terminating zero) to out,
+// which must have room for length bytes. returns the decoded length, or
+// -1 if in is not valid COBS
+int cobs_decode(const char *in, int length, char *out);
+
+// build the frame for type / sequence / payload in out, COBS encoded and
+// zero terminated, out must have room for FRAME_MAX_ENCODED bytes.
+// returns the number of bytes to send, or -1 if the payload is too big
+int frame_encode(char type, char sequence, const char *payload, int length, char *out);
+
+// decode an encoded frame of length bytes (without the zero bytes around it).
+// payload must have room for FRAME_MAX_PAYLOAD bytes.
+// returns the payload length, or -1 if the frame is malformed or fails its CRC
+int frame_decode(const char *in, int length, char *type, char *sequence, char *payload);
+
+// fill in a FRAME_STATUS payload, returns its length
+int status_payload(char *out, int water_centi_inches, int temperature_deci_c, bool heater);
+
+// fill in a FRAME_TELEMETRY payload, returns its length
+int telemetry_payload(char *out, int water_centi_inches, int temperature_deci_c, bool heater,
+                      unsigned long timestamp_ms);
+
+#endif
@@ -19,6 +19,9 @@ limitations under the License.
 #include "mbed.h"
 
 // RateLimiter throttles calls to a method
+// NOTE: this is kept for compatibility, new code should use a Scheduler
+// task (Scheduler.h), which doesn't drift by the time fn takes and keeps
+// latency / overrun stats
 class RateLimiter {
 private:
     Timer timer;
@@ -0,0 +1,93 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef RESOLUTION_POLICY_H
+#define RESOLUTION_POLICY_H
+
+// ResolutionPolicy picks the resolution the temperature probes convert at:
+// 9 bits (94ms conversions, 0.5 C) while the temperature is changing fast
+// or the heater is at full power, for ~8x the readings when the controller
+// needs them, and 12 bits (750ms, 1/16 C) once it has been steady for
+// hold_ms. The temperature controller's pulses holding a temperature
+// aren't full power.
+// The rate is measured over window_ms, so that the 0.5 C steps of 9 bit
+// readings don't look like fast changes.
+class ResolutionPolicy {
+public:
+    enum {
+        fast_bits = 9,
+        precise_bits = 12
+    };
+
+private:
+    long fast_rate;
+    int hold_ms;
+    int window_ms;
+
+    int current_bits;
+    bool has_reference;
+    unsigned reference_ms;
+    long reference_deci_c;
+    bool changing;
+    unsigned fast_ms;
+
+public:
+    // fast_rate is in 1/10 C per second
+    ResolutionPolicy(long fast_rate, int hold_ms, int window_ms) {
+        this->fast_rate = fast_rate;
+        this->hold_ms = hold_ms;
+        this->window_ms = window_ms;
+        this->current_bits = precise_bits;
+        this->has_reference = false;
+        this->reference_ms = 0;
+        this->reference_deci_c = 0;
+        this->changing = false;
+        this->fast_ms = 0;
+    }
+
+    // take a reading at now_ms and whether the heater is at full power,
+    // returns the resolution to convert at from now on
+    int update(unsigned now_ms, long temperature_deci_c, bool heating) {
+        if (!this->has_reference) {
+            this->has_reference = true;
+            this->reference_ms = now_ms;
+            this->reference_deci_c = temperature_deci_c;
+        }
+        int elapsed_ms = (int)(now_ms - this->reference_ms);
+        if (elapsed_ms >= this->window_ms) {
+            long change = temperature_deci_c - this->reference_deci_c;
+            if (change < 0) {
+                change = -change;
+            }
+            this->changing = change * 1000 > this->fast_rate * elapsed_ms;
+            this->reference_ms = now_ms;
+            this->reference_deci_c = temperature_deci_c;
+        }
+
+        if (heating || this->changing) {
+            this->fast_ms = now_ms;
+            this->current_bits = fast_bits;
+        } else if ((int)(now_ms - this->fast_ms) >= this->hold_ms) {
+            this->current_bits = precise_bits;
+        }
+        return this->current_bits;
+    }
+
+    int bits() const {
+        return this->current_bits;
+    }
+};
+
+#endif
@@ -0,0 +1,112 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "RomStore.h"
+
+#include "CRC8.h"
+
+static const char record_magic[4] = {'M', 'C', 'B', 'R'};
+
+#if defined(__arm__)
+// from the GCC_ARM linker script: the code ends at __etext and the
+// initial values of .data are loaded from flash right after it
+extern "C" char __etext[], __data_start__[], __data_end__[];
+
+// the first flash address after the firmware image
+static uint32_t image_end() {
+    return (uint32_t)__etext + (uint32_t)(__data_end__ - __data_start__);
+}
+#else
+// built for the host, the simulated flash holds no image
+static uint32_t image_end() {
+    return 0;
+}
+#endif
+
+RomStore::RomStore() {
+    this->ready = this->flash.init() == 0;
+    // the last sector
+    uint32_t end = this->flash.get_flash_start() + this->flash.get_flash_size();
+    this->address = end - this->flash.get_sector_size(end - 1);
+    // never erase the firmware
+    if (image_end() >= this->address) {
+        this->ready = false;
+    }
+}
+
+unsigned char RomStore::record_crc(const record &r) {
+    char crc = crc8((const char *)&r, 7);
+    for (int i = 0; i < r.count && i < max_roms; i++) {
+        for (int b = 0; b < 8; b++) {
+            crc = crc8_byte(crc, r.roms[i][b]);
+        }
+    }
+    return (unsigned char)crc;
+}
+
+int RomStore::load(char roms[][8], int max) {
+    record r;
+    if (!this->ready || this->flash.read(&r, this->address, sizeof(r)) != 0) {
+        return 0;
+    }
+    if (memcmp(r.magic, record_magic, sizeof(record_magic)) != 0 || r.version != version
+        || r.count > max_roms || r.crc != record_crc(r)) {
+        return 0;
+    }
+    int count = r.count < max ? r.count : max;
+    for (int i = 0; i < count; i++) {
+        memcpy(roms[i], r.roms[i], 8);
+    }
+    return count;
+}
+
+bool RomStore::save(const char roms[][8], int count) {
+    if (!this->ready || count < 0 || count > max_roms) {
+        return false;
+    }
+    char saved[max_roms][8];
+    if (this->load(saved, max_roms) == count) {
+        bool same = true;
+        for (int i = 0; i < count && same; i++) {
+            same = memcmp(saved[i], roms[i], 8) == 0;
+        }
+        // don't wear the flash rewriting the same record every boot
+        if (same) {
+            return true;
+        }
+    }
+
+    // IAP programs whole pages from word aligned RAM, unused bytes are left erased
+    uint32_t page_size = this->flash.get_page_size();
+    if (page_size < sizeof(record)) {
+        page_size = (sizeof(record) + page_size - 1) / page_size * page_size;
+    }
+    uint32_t *page = new uint32_t[page_size / 4];
+    memset(page, 0xFF, page_size);
+    record *r = (record *)page;
+    memcpy(r->magic, record_magic, sizeof(record_magic));
+    r->version = version;
+    r->count = (unsigned char)count;
+    r->reserved = 0;
+    for (int i = 0; i < count; i++) {
+        memcpy(r->roms[i], roms[i], 8);
+    }
+    r->crc = record_crc(*r);
+
+    bool saved_ok = this->flash.erase(this->address, this->flash.get_sector_size(this->address)) == 0
+        && this->flash.program(page, this->address, page_size) == 0;
+    delete[] page;
+    return saved_ok;
+}
@@ -0,0 +1,69 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef ROM_STORE_H
+#define ROM_STORE_H
+
+#include "mbed.h"
+
+// RomStore keeps the ROM codes of the probes found on the 1-Wire bus in
+// the last sector of the LPC1768's flash (sector 29, 32KB at 0x78000),
+// written through IAP, so that the next boot can check those probes are
+// still there rather than searching the bus for them, see DS1820Bus.
+// mbed_app.json ends the firmware image below that sector, and a build
+// whose image reaches it anyway leaves the store unusable (nothing saved,
+// saving fails) rather than erasing its own code.
+//
+// The record is a header (magic, version, count and a CRC-8 over the rest
+// of the record) followed by the ROM codes. A record that doesn't check
+// out, eg: erased flash or an older layout, loads as nothing saved.
+class RomStore {
+public:
+    enum {
+        max_roms = 8,
+        // bump when the record layout changes
+        version = 1
+    };
+
+    RomStore();
+
+    // copy up to max of the saved ROM codes into roms,
+    // returns how many, 0 if there is no valid record
+    int load(char roms[][8], int max);
+
+    // save count ROM codes, erasing the sector and programming one page,
+    // which stalls the CPU for ~100ms. does nothing if they are already
+    // saved, returns false if the flash couldn't be written
+    bool save(const char roms[][8], int count);
+
+private:
+    struct record {
+        char magic[4];
+        unsigned char version;
+        unsigned char count;
+        unsigned char reserved;
+        // of the bytes above and roms
+        unsigned char crc;
+        char roms[max_roms][8];
+    };
+
+    FlashIAP flash;
+    uint32_t address;
+    bool ready;
+
+    static unsigned char record_crc(const record &r);
+};
+
+#endif
@@ -0,0 +1,201 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef SAMPLE_FILTER_H
+#define SAMPLE_FILTER_H
+
+// SampleFilter smooths a stream of sensor samples over a window of the
+// last N samples with:
+// - a running median, kept in a sorted copy of the window
+// - Hampel outlier rejection: a sample further than k * 1.4826 * MAD from
+//   the window median is replaced by the median
+// - an exponential moving average of the (outlier free) samples, the output
+// - the variance of the raw samples in the window
+// Adding a sample finds its place in the sorted window with a binary search
+// and only shifts the samples between the evicted and new positions, there
+// is no allocation. N is meant to be small (5 - 15).
+//
+// T is the sample type, A a wider type to accumulate sums of squares in.
+template<class T, class A, int N>
+class SampleFilter {
+private:
+    // samples in arrival order, oldest at head once full
+    T   window[N];
+    // the same samples, sorted
+    T   sorted[N];
+    int head;
+    int size;
+    A   sum;
+    A   sum_squares;
+    T   ema;
+    int ema_shift;
+    long hampel_k_milli;
+    T   min_threshold;
+    unsigned samples;
+    unsigned rejected;
+
+    // index of the first sorted sample >= value
+    int lower_bound(T value) const {
+        int lo = 0, hi = this->size;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (this->sorted[mid] < value) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return lo;
+    }
+
+    // replace old_value in the sorted window with value, shifting only
+    // the samples in between
+    void sorted_replace(T old_value, T value) {
+        int i = this->lower_bound(old_value);
+        while (i > 0 && value < this->sorted[i - 1]) {
+            this->sorted[i] = this->sorted[i - 1];
+            i--;
+        }
+        while (i < this->size - 1 && this->sorted[i + 1] < value) {
+            this->sorted[i] = this->sorted[i + 1];
+            i++;
+        }
+        this->sorted[i] = value;
+    }
+
+    void sorted_insert(T value) {
+        int i = this->size;
+        while (i > 0 && value < this->sorted[i - 1]) {
+            this->sorted[i] = this->sorted[i - 1];
+            i--;
+        }
+        this->sorted[i] = value;
+    }
+
+    // median absolute deviation of the window, the deviations of the
+    // sorted samples grow outwards from the median on both sides, so
+    // merge outwards from it until reaching the middle deviation
+    T mad() const {
+        int mid = this->size / 2;
+        T m = this->sorted[mid];
+        int lo = mid - 1, hi = mid + 1;
+        T deviation = 0;
+        for (int k = 0; k < this->size / 2; k++) {
+            if (hi >= this->size || (lo >= 0 && m - this->sorted[lo] < this->sorted[hi] - m)) {
+                deviation = m - this->sorted[lo--];
+            } else {
+                deviation = this->sorted[hi++] - m;
+            }
+        }
+        return deviation;
+    }
+
+public:
+    // ema_shift sets the EMA weight of each new sample to 1 / 2^ema_shift.
+    // hampel_k_milli is k in thousandths, eg: 3000 for the usual k = 3,
+    // min_threshold keeps a window of near identical samples from rejecting
+    // every sample that differs at all.
+    SampleFilter(int ema_shift, long hampel_k_milli, T min_threshold) {
+        this->ema_shift = ema_shift;
+        this->hampel_k_milli = hampel_k_milli;
+        this->min_threshold = min_threshold;
+        this->reset();
+    }
+
+    void reset() {
+        this->head = 0;
+        this->size = 0;
+        this->sum = 0;
+        this->sum_squares = 0;
+        this->ema = 0;
+        this->samples = 0;
+        this->rejected = 0;
+    }
+
+    // add a sample, returns false if it was rejected as an outlier,
+    // rejected samples still enter the window so real steps get through
+    bool add(T sample) {
+        bool accepted = true;
+        T filtered = sample;
+        // need a few samples before the median means anything
+        if (this->size >= 3) {
+            T m = this->median();
+            T deviation = sample < m ? m - sample : sample - m;
+            // 1.4826 * MAD estimates the standard deviation
+            A threshold = (A)this->mad() * (A)this->hampel_k_milli * 14826 / 10000000;
+            if (threshold < (A)this->min_threshold) {
+                threshold = this->min_threshold;
+            }
+            if ((A)deviation > threshold) {
+                accepted = false;
+                filtered = m;
+                this->rejected++;
+            }
+        }
+
+        if (this->size < N) {
+            this->window[this->size] = sample;
+            this->sorted_insert(sample);
+            this->size++;
+        } else {
+            T evicted = this->window[this->head];
+            this->window[this->head] = sample;
+            this->head = (this->head + 1) % N;
+            this->sorted_replace(evicted, sample);
+            this->sum -= evicted;
+            this->sum_squares -= (A)evicted * evicted;
+        }
+        this->sum += sample;
+        this->sum_squares += (A)sample * sample;
+
+        if (this->samples == 0) {
+            this->ema = filtered;
+        } else {
+            this->ema += (filtered - this->ema) / (1 << this->ema_shift);
+        }
+        this->samples++;
+        return accepted;
+    }
+
+    // the filtered value
+    T value() const {
+        return this->ema;
+    }
+
+    // median of the samples in the window
+    T median() const {
+        return this->sorted[this->size / 2];
+    }
+
+    // sample variance of the samples in the window
+    A variance() const {
+        if (this->size < 2) {
+            return 0;
+        }
+        return (this->sum_squares - this->sum * this->sum / this->size) / (this->size - 1);
+    }
+
+    // total samples added since reset
+    unsigned count() const {
+        return this->samples;
+    }
+
+    // total samples rejected as outliers since reset
+    unsigned outliers() const {
+        return this->rejected;
+    }
+};
+
+#endif
@@ -0,0 +1,217 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef SAMPLE_HISTORY_H
+#define SAMPLE_HISTORY_H
+
+// one recorded sample, at the status line's precision
+struct history_sample {
+    // time in tenths of a second, eg: since boot, must not go backwards
+    unsigned long time_ds;
+    long temperature_deci_c;
+    long water_centi_inches;
+    bool heater;
+};
+
+// SampleHistory records samples into a fixed buffer (eg: the LPC1768's
+// otherwise unused AHB SRAM) as a ring of blocks, evicting the oldest block
+// when it is full. Each sample is stored as three varints of its difference
+// from the previous sample: the time delta (with the heater state as its
+// low bit) and the zigzag encoded temperature and water level deltas, so a
+// steady sample every couple of seconds takes 3 bytes. Each block starts
+// from an all zero sample, so its first sample holds absolute values and
+// every block can be decoded on its own, see decode_block().
+// This has no mbed dependencies so that it can be built on the host.
+class SampleHistory {
+public:
+    enum {
+        block_size = 256,
+        max_blocks = 64,
+        // three varints of up to 5 bytes
+        max_record_size = 15
+    };
+
+    // buffer is used for the history, up to max_blocks * block_size bytes
+    SampleHistory(char *buffer, int size) : buffer(buffer) {
+        this->num_blocks = size / block_size;
+        if (this->num_blocks > max_blocks) {
+            this->num_blocks = max_blocks;
+        }
+        this->clear();
+    }
+
+    void clear() {
+        this->first = 0;
+        this->filled = 0;
+        this->records = 0;
+    }
+
+    void add(const history_sample &sample) {
+        int current = (this->first + this->filled - 1) % this->num_blocks;
+        if (this->filled == 0 || this->used[current] + max_record_size > block_size) {
+            current = this->start_block();
+        }
+        char *out = this->buffer + current * block_size + this->used[current];
+        int length = encode(&this->last, sample, out);
+        this->used[current] += length;
+        this->block_records[current]++;
+        this->records++;
+        this->last = sample;
+    }
+
+    // the number of samples held
+    unsigned count() const {
+        return this->records;
+    }
+
+    // bytes of the buffer in use
+    int size() const {
+        int total = 0;
+        for (int i = 0; i < this->filled; i++) {
+            total += this->used[(this->first + i) % this->num_blocks];
+        }
+        return total;
+    }
+
+    // the oldest / newest sample, returns false if there are none
+    bool oldest(history_sample *sample) const {
+        int length;
+        const char *data = this->block(0, &length);
+        return this->records > 0 && decode_block(data, length, sample, 1) == 1;
+    }
+
+    bool newest(history_sample *sample) const {
+        *sample = this->last;
+        return this->records > 0;
+    }
+
+    // the number of blocks holding samples
+    int blocks() const {
+        return this->filled;
+    }
+
+    // the encoded samples in a block, 0 is the oldest
+    const char *block(int index, int *length) const {
+        int b = (this->first + index) % this->num_blocks;
+        *length = this->used[b];
+        return this->buffer + b * block_size;
+    }
+
+    // decode up to max samples from an encoded block, returns the number
+    // decoded or -1 if the block is malformed
+    static int decode_block(const char *data, int length, history_sample *samples, int max) {
+        history_sample last = zero();
+        int offset = 0, count = 0;
+        while (offset < length && count < max) {
+            unsigned long time_heater, temperature, water;
+            int n;
+            if ((n = get_varint(data + offset, length - offset, &time_heater)) < 0) {
+                return -1;
+            }
+            offset += n;
+            if ((n = get_varint(data + offset, length - offset, &temperature)) < 0) {
+                return -1;
+            }
+            offset += n;
+            if ((n = get_varint(data + offset, length - offset, &water)) < 0) {
+                return -1;
+            }
+            offset += n;
+            history_sample &s = samples[count++];
+            s.time_ds = last.time_ds + (time_heater >> 1);
+            s.heater = time_heater & 1;
+            s.temperature_deci_c = last.temperature_deci_c + unzigzag(temperature);
+            s.water_centi_inches = last.water_centi_inches + unzigzag(water);
+            last = s;
+        }
+        return count;
+    }
+
+private:
+    char *buffer;
+    int num_blocks;
+    // index of the oldest block, and the number of blocks in use
+    int first;
+    int filled;
+    unsigned records;
+    int used[max_blocks];
+    unsigned block_records[max_blocks];
+    // the last sample added, deltas are from this
+    history_sample last;
+
+    static history_sample zero() {
+        history_sample s;
+        s.time_ds = 0;
+        s.temperature_deci_c = 0;
+        s.water_centi_inches = 0;
+        s.heater = false;
+        return s;
+    }
+
+    // take the next block, evicting the oldest if they are all in use
+    int start_block() {
+        if (this->filled == this->num_blocks) {
+            this->records -= this->block_records[this->first];
+            this->first = (this->first + 1) % this->num_blocks;
+        } else {
+            this->filled++;
+        }
+        int current = (this->first + this->filled - 1) % this->num_blocks;
+        this->used[current] = 0;
+        this->block_records[current] = 0;
+        this->last = zero();
+        return current;
+    }
+
+    // small magnitudes of either sign to small unsigned values
+    static unsigned long zigzag(long n) {
+        return n < 0 ? ~((unsigned long)n << 1) : (unsigned long)n << 1;
+    }
+
+    static long unzigzag(unsigned long n) {
+        return (n & 1) ? -(long)(n >> 1) - 1 : (long)(n >> 1);
+    }
+
+    // 7 bits per byte, low bits first, the high bit set on all but the last
+    static int put_varint(char *out, unsigned long value) {
+        int n = 0;
+        while (value >= 0x80) {
+            out[n++] = (char)((value & 0x7F) | 0x80);
+            value >>= 7;
+        }
+        out[n++] = (char)value;
+        return n;
+    }
+
+    static int get_varint(const char *in, int length, unsigned long *value) {
+        *value = 0;
+        for (int n = 0; n < length && n < 5; n++) {
+            *value |= (unsigned long)(in[n] & 0x7F) << (7 * n);
+            if (!(in[n] & 0x80)) {
+                return n + 1;
+            }
+        }
+        return -1;
+    }
+
+    static int encode(const history_sample *last, const history_sample &sample, char *out) {
+        int n = put_varint(out, ((sample.time_ds - last->time_ds) << 1) | (sample.heater ? 1 : 0));
+        n += put_varint(out + n, zigzag(sample.temperature_deci_c - last->temperature_deci_c));
+        n += put_varint(out + n, zigzag(sample.water_centi_inches - last->water_centi_inches));
+        return n;
+    }
+};
+
+#endif
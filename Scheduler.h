@@ -0,0 +1,264 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "mbed.h"
+
+#include "Profiler.h"
+
+// Scheduler runs periodic and one-shot tasks from one free running
+// microsecond clock, in deadline order from a binary min-heap.
+// Periodic tasks are fixed rate: each deadline is the last plus the period,
+// not the time the last run finished plus the period, so they don't drift.
+// A run that ends after the task's next deadline is an overrun, the periods
+// missed are skipped rather than run back to back.
+// Either call run() regularly, or set a wake callback to be told when to.
+// Each task's runs are also timed as a Profiler section of the same name.
+class Scheduler {
+public:
+    enum {
+        max_tasks = 8
+    };
+
+    struct task_stats {
+        unsigned runs;
+        // the most a run started after its deadline
+        int worst_latency_us;
+        // periods missed because a run ended after the next deadline
+        unsigned overruns;
+    };
+
+private:
+    struct task {
+        const char *name;
+        void (*fn)(void);
+        int period_us;
+        unsigned deadline;
+        task_stats stats;
+        int profile_id;
+        // set by cancel(), so that a task cancelling itself while it runs
+        // isn't put back at its next period
+        bool cancelled;
+    };
+
+    Timer clock;
+    Timeout wakeup;
+    void (*wake_callback)(void);
+    task tasks[max_tasks];
+    int num_tasks;
+    // task ids ordered as a min-heap by deadline, and each task's heap
+    // index or -1 when it isn't scheduled
+    int heap[max_tasks];
+    int heap_size;
+    int heap_index[max_tasks];
+
+    // wrap safe now - then
+    int since(unsigned then) {
+        return (int)((unsigned)this->clock.read_us() - then);
+    }
+
+    bool before(int a, int b) const {
+        return (int)(this->tasks[this->heap[a]].deadline - this->tasks[this->heap[b]].deadline) < 0;
+    }
+
+    void swap(int a, int b) {
+        int id = this->heap[a];
+        this->heap[a] = this->heap[b];
+        this->heap[b] = id;
+        this->heap_index[this->heap[a]] = a;
+        this->heap_index[this->heap[b]] = b;
+    }
+
+    void sift_up(int i) {
+        while (i > 0 && this->before(i, (i - 1) / 2)) {
+            this->swap(i, (i - 1) / 2);
+            i = (i - 1) / 2;
+        }
+    }
+
+    void sift_down(int i) {
+        while (true) {
+            int smallest = i;
+            int left = 2 * i + 1, right = 2 * i + 2;
+            if (left < this->heap_size && this->before(left, smallest)) {
+                smallest = left;
+            }
+            if (right < this->heap_size && this->before(right, smallest)) {
+                smallest = right;
+            }
+            if (smallest == i) {
+                return;
+            }
+            this->swap(i, smallest);
+            i = smallest;
+        }
+    }
+
+    void push(int id) {
+        int i = this->heap_size++;
+        this->heap[i] = id;
+        this->heap_index[id] = i;
+        this->sift_up(i);
+    }
+
+    void remove(int id) {
+        int i = this->heap_index[id];
+        this->heap_index[id] = -1;
+        this->heap_size--;
+        if (i == this->heap_size) {
+            return;
+        }
+        this->heap[i] = this->heap[this->heap_size];
+        this->heap_index[this->heap[i]] = i;
+        this->sift_down(i);
+        this->sift_up(i);
+    }
+
+    // set the wakeup for the earliest deadline
+    void arm() {
+        if (!this->wake_callback) {
+            return;
+        }
+        int wait_us = this->next_deadline_us();
+        if (wait_us < 0) {
+            this->wakeup.detach();
+        } else {
+            this->wakeup.attach_us(this->wake_callback, wait_us);
+        }
+    }
+
+public:
+    Scheduler() {
+        this->wake_callback = NULL;
+        this->num_tasks = 0;
+        this->heap_size = 0;
+        this->clock.start();
+    }
+
+    // set a function to call (from interrupt context) when a task is due,
+    // eg: to post run() to an EventQueue, or NULL to disable
+    void set_wake_callback(void (*f)(void)) {
+        this->wake_callback = f;
+        this->arm();
+    }
+
+    // add a task, first due phase_us from now. period_us > 0 runs it every
+    // period_us, 0 runs it once, after which it can be rescheduled with
+    // schedule(). use different phases to keep tasks with the same period
+    // from running at the same time.
+    // returns the task's id, or -1 if there are already max_tasks
+    int add(const char *name, void (*fn)(void), int period_us, int phase_us = 0) {
+        if (this->num_tasks == max_tasks) {
+            return -1;
+        }
+        int id = this->num_tasks++;
+        task &t = this->tasks[id];
+        t.name = name;
+        t.fn = fn;
+        t.period_us = period_us;
+        t.stats.runs = 0;
+        t.stats.worst_latency_us = 0;
+        t.stats.overruns = 0;
+        t.profile_id = PROFILE_SECTION(name);
+        t.cancelled = false;
+        this->heap_index[id] = -1;
+        this->schedule(id, phase_us);
+        return id;
+    }
+
+    // (re)schedule a task to be due delay_us from now,
+    // periodic tasks continue at their period from then
+    void schedule(int id, int delay_us) {
+        if (this->heap_index[id] >= 0) {
+            this->remove(id);
+        }
+        this->tasks[id].deadline = (unsigned)this->clock.read_us() + delay_us;
+        this->tasks[id].cancelled = false;
+        this->push(id);
+        this->arm();
+    }
+
+    // stop a task from running until it is next scheduled
+    void cancel(int id) {
+        this->tasks[id].cancelled = true;
+        if (this->heap_index[id] >= 0) {
+            this->remove(id);
+            this->arm();
+        }
+    }
+
+    // run every task that is due, returns microseconds until the next
+    // deadline, or -1 if nothing is scheduled
+    int run() {
+        while (this->heap_size > 0) {
+            int id = this->heap[0];
+            task &t = this->tasks[id];
+            int latency_us = this->since(t.deadline);
+            if (latency_us < 0) {
+                break;
+            }
+            this->remove(id);
+            t.cancelled = false;
+            t.stats.runs++;
+            if (latency_us > t.stats.worst_latency_us) {
+                t.stats.worst_latency_us = latency_us;
+            }
+            {
+                PROFILE_SCOPE(t.profile_id);
+                t.fn();
+            }
+            // fn may have rescheduled or cancelled its own task
+            if (t.period_us > 0 && this->heap_index[id] < 0 && !t.cancelled) {
+                t.deadline += t.period_us;
+                int behind_us = this->since(t.deadline);
+                if (behind_us >= 0) {
+                    unsigned missed = behind_us / t.period_us + 1;
+                    t.stats.overruns += missed;
+                    t.deadline += missed * t.period_us;
+                }
+                this->push(id);
+            }
+        }
+        this->arm();
+        return this->next_deadline_us();
+    }
+
+    // microseconds until the earliest deadline (0 if overdue),
+    // or -1 if nothing is scheduled
+    int next_deadline_us() {
+        if (this->heap_size == 0) {
+            return -1;
+        }
+        int wait_us = -this->since(this->tasks[this->heap[0]].deadline);
+        return wait_us > 0 ? wait_us : 0;
+    }
+
+    // the number of tasks added
+    int count() const {
+        return this->num_tasks;
+    }
+
+    const char *name(int id) const {
+        return this->tasks[id].name;
+    }
+
+    const task_stats &stats(int id) const {
+        return this->tasks[id].stats;
+    }
+};
+
+#endif
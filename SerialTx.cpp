@@ -0,0 +1,164 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "SerialTx.h"
+
+// how often a blocked write checks for room, about a byte at 115200 baud
+#define WAIT_POLL_US 100
+
+// keep the compiler from moving buffer writes past head / tail updates,
+// this only needs to order memory against an ISR on the same core
+static inline void barrier() {
+    __asm volatile ("" : : : "memory");
+}
+
+SerialTx::SerialTx(RawSerial *serial, policy default_policy) : serial(serial) {
+    this->default_policy = default_policy;
+    this->head = 0;
+    this->tail = 0;
+    this->messages_head = 0;
+    this->messages_tail = 0;
+    this->front_start = 0;
+    this->draining = false;
+    this->drops = 0;
+    this->waits = 0;
+    this->peak_queued = 0;
+}
+
+bool SerialTx::write(const char *data, int length, policy write_policy) {
+    if (length <= 0) {
+        return true;
+    }
+    if (write_policy == policy_block) {
+        bool waited = false;
+        while (length > 0) {
+            int n = length < buffer_size ? length : (int)buffer_size;
+            while (this->space() < n) {
+                waited = true;
+                wait_us(WAIT_POLL_US);
+            }
+            this->append(data, n);
+            data += n;
+            length -= n;
+        }
+        if (waited) {
+            this->waits++;
+        }
+        return true;
+    }
+    if (this->space() < length &&
+        (write_policy == policy_drop_newest || !this->drop_oldest(length))) {
+        this->drops++;
+        return false;
+    }
+    this->append(data, length);
+    return true;
+}
+
+int SerialTx::space() const {
+    if (this->messages_head - this->messages_tail == max_messages) {
+        return 0;
+    }
+    return buffer_size - this->queued();
+}
+
+void SerialTx::append(const char *data, int length) {
+    unsigned end = this->head + length;
+    for (int i = 0; i < length; i++) {
+        this->buffer[(this->head + i) & (buffer_size - 1)] = data[i];
+    }
+    // the message before the bytes, so the interrupt never passes its end
+    // without seeing it
+    this->ends[this->messages_head & (max_messages - 1)] = end;
+    barrier();
+    this->messages_head = this->messages_head + 1;
+    barrier();
+    this->head = end;
+    if (this->queued() > this->peak_queued) {
+        this->peak_queued = this->queued();
+    }
+    this->kick();
+}
+
+// make room for length bytes by dropping the oldest messages,
+// returns false if there still isn't room
+bool SerialTx::drop_oldest(int length) {
+    __disable_irq();
+    while (this->space() < length && this->messages_tail != this->messages_head) {
+        unsigned front = this->messages_tail;
+        unsigned front_end = this->ends[front & (max_messages - 1)];
+        if (this->tail == this->front_start) {
+            // the UART hasn't started on the oldest message, drop it
+            this->tail = front_end;
+            this->front_start = front_end;
+        } else if (front + 1 != this->messages_head) {
+            // finish the message the UART is on, drop the one after it by
+            // moving what's left of the first up against the third
+            unsigned next_end = this->ends[(front + 1) & (max_messages - 1)];
+            unsigned shift = next_end - front_end;
+            for (unsigned i = front_end; i != this->tail; i--) {
+                this->buffer[(i - 1 + shift) & (buffer_size - 1)] =
+                    this->buffer[(i - 1) & (buffer_size - 1)];
+            }
+            this->tail = this->tail + shift;
+            this->front_start = this->front_start + shift;
+        } else {
+            // only the message the UART is on is left
+            break;
+        }
+        // the front message now ends where the next one did
+        this->messages_tail = front + 1;
+        this->drops++;
+    }
+    bool fits = this->space() >= length;
+    __enable_irq();
+    return fits;
+}
+
+// start the interrupt draining the queue, if it isn't already
+void SerialTx::kick() {
+    __disable_irq();
+    if (!this->draining) {
+        // THRE only interrupts when the FIFO empties, so prime it
+        this->fill_fifo();
+        if (this->tail != this->head) {
+            this->draining = true;
+            this->serial->attach(callback(this, &SerialTx::on_tx), RawSerial::TxIrq);
+        }
+    }
+    __enable_irq();
+}
+
+// move queued bytes into the UART's FIFO until it is full
+void SerialTx::fill_fifo() {
+    while (this->tail != this->head && this->serial->writeable()) {
+        this->serial->putc(this->buffer[this->tail & (buffer_size - 1)]);
+        this->tail = this->tail + 1;
+        while (this->messages_tail != this->messages_head &&
+               this->ends[this->messages_tail & (max_messages - 1)] == this->tail) {
+            this->front_start = this->tail;
+            this->messages_tail = this->messages_tail + 1;
+        }
+    }
+}
+
+// the TX interrupt, the FIFO is empty
+void SerialTx::on_tx() {
+    this->fill_fifo();
+    if (this->tail == this->head) {
+        this->draining = false;
+        this->serial->attach(Callback<void()>(), RawSerial::TxIrq);
+    }
+}
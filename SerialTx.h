@@ -0,0 +1,110 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef SERIAL_TX_H
+#define SERIAL_TX_H
+
+#include "mbed.h"
+
+// SerialTx queues bytes to send on a RawSerial, so that writing a reply
+// copies it into a ring and returns rather than waiting ~87us a byte on the
+// UART at 115200 baud. The TX interrupt (THRE, the UART's 16 byte FIFO
+// emptying) moves the ring into the FIFO.
+//
+// Each write is a message, and what happens when one doesn't fit is the
+// write's policy:
+//  - policy_block waits for the interrupt to make room, writing messages
+//    bigger than the ring a ring full at a time
+//  - policy_drop_newest drops the message being written
+//  - policy_drop_oldest drops the oldest queued messages until it fits, or
+//    drops it if that isn't enough. a message the UART has started on
+//    is always sent whole, so the host never sees half a line / frame
+// Writes are from the main thread only, not from interrupts.
+class SerialTx {
+public:
+    enum policy {
+        policy_block,
+        policy_drop_newest,
+        policy_drop_oldest
+    };
+
+    enum {
+        // both must be powers of two
+        buffer_size = 1024,
+        max_messages = 64
+    };
+
+    SerialTx(RawSerial *serial, policy default_policy = policy_block);
+
+    // queue length bytes, returns false if they were dropped
+    bool write(const char *data, int length) {
+        return this->write(data, length, this->default_policy);
+    }
+    bool write(const char *data, int length, policy write_policy);
+
+    // bytes that can be written now without waiting or dropping
+    int space() const;
+
+    // bytes queued and not yet in the UART
+    int queued() const {
+        return (int)(this->head - this->tail);
+    }
+
+    // messages dropped, by either drop policy
+    unsigned dropped() const {
+        return this->drops;
+    }
+
+    // writes that had to wait for room
+    unsigned stalls() const {
+        return this->waits;
+    }
+
+    // the most bytes ever queued at once
+    int peak() const {
+        return this->peak_queued;
+    }
+
+private:
+    RawSerial *serial;
+    policy default_policy;
+
+    char buffer[buffer_size];
+    // head is only written by write(), tail by the interrupt (and by
+    // dropping oldest with it masked), both count up forever and are
+    // masked to index into buffer
+    volatile unsigned head;
+    volatile unsigned tail;
+    // where each queued message ends, in head / tail counts, the message
+    // at messages_tail starts at front_start
+    unsigned ends[max_messages];
+    volatile unsigned messages_head;
+    volatile unsigned messages_tail;
+    volatile unsigned front_start;
+    // the TX interrupt is attached
+    volatile bool draining;
+
+    unsigned drops;
+    unsigned waits;
+    int peak_queued;
+
+    void append(const char *data, int length);
+    bool drop_oldest(int length);
+    void kick();
+    void fill_fifo();
+    void on_tx();
+};
+
+#endif
@@ -0,0 +1,114 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+// Telemetry decides when to push status samples to a subscribed host:
+// every interval_ms, and / or as soon as the water level or temperature
+// has changed by threshold (in the units of the status line's last digit,
+// 1/100 inches and 1/10 degrees) or the heater has switched since the last
+// sample sent. Every sample gets the next sequence number, including
+// samples dropped because the serial port was backed up, so the host can
+// see the gaps.
+class Telemetry {
+private:
+    bool subscribed;
+    bool binary;
+    int interval_ms;
+    long threshold;
+    bool has_last;
+    unsigned last_ms;
+    long last_water;
+    long last_temperature;
+    bool last_heater;
+    unsigned sequence;
+    unsigned drops;
+
+    static long difference(long a, long b) {
+        return a < b ? b - a : a - b;
+    }
+
+public:
+    Telemetry() {
+        this->subscribed = false;
+        this->binary = false;
+        this->interval_ms = 0;
+        this->threshold = 0;
+        this->sequence = 0;
+        this->drops = 0;
+        this->has_last = false;
+    }
+
+    // start pushing samples every interval_ms (0 for none) and / or on
+    // changes of threshold (0 for none), as binary frames or text lines,
+    // both 0 to unsubscribe
+    void subscribe(int interval_ms, long threshold, bool binary) {
+        this->subscribed = interval_ms > 0 || threshold > 0;
+        this->interval_ms = interval_ms;
+        this->threshold = threshold;
+        this->binary = binary;
+        this->has_last = false;
+    }
+
+    bool active() const {
+        return this->subscribed;
+    }
+
+    bool is_binary() const {
+        return this->binary;
+    }
+
+    // true if a sample should be pushed now
+    bool due(unsigned now_ms, long water_centi_inches, long temperature_deci_c, bool heater) const {
+        if (!this->subscribed) {
+            return false;
+        }
+        if (!this->has_last) {
+            return true;
+        }
+        if (this->interval_ms > 0 && (int)(now_ms - this->last_ms) >= this->interval_ms) {
+            return true;
+        }
+        if (this->threshold > 0
+            && (difference(water_centi_inches, this->last_water) >= this->threshold
+                || difference(temperature_deci_c, this->last_temperature) >= this->threshold)) {
+            return true;
+        }
+        return heater != this->last_heater;
+    }
+
+    // take the next sequence number for a sample due now, sent or not.
+    // the next interval / change is measured from this sample
+    unsigned take(unsigned now_ms, long water_centi_inches, long temperature_deci_c, bool heater) {
+        this->has_last = true;
+        this->last_ms = now_ms;
+        this->last_water = water_centi_inches;
+        this->last_temperature = temperature_deci_c;
+        this->last_heater = heater;
+        return this->sequence++;
+    }
+
+    // count a sample that was due but not sent
+    void dropped() {
+        this->drops++;
+    }
+
+    unsigned drop_count() const {
+        return this->drops;
+    }
+};
+
+#endif
@@ -0,0 +1,140 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef TEMPERATURE_CONTROLLER_H
+#define TEMPERATURE_CONTROLLER_H
+
+#include "Fixed.h"
+
+// TemperatureController is an integer PID controller computing the heater
+// duty cycle (in permille) needed to hold a target temperature, for driving
+// the heater with time proportional output (on for duty of each window).
+// - the derivative is of the measurement rather than the error, so changing
+//   the target doesn't kick the output
+// - anti-windup: the integral is clamped to the output range and doesn't
+//   grow while the output is saturated in the same direction
+// - at or above max_temperature the output is always 0
+class TemperatureController {
+private:
+    // output permille per degree of error, per degree-second of error,
+    // and per degree per second of measurement change
+    long kp;
+    long ki;
+    long kd;
+    FixedDegrees max_temperature;
+    bool enabled;
+    FixedDegrees target_temperature;
+    // integral term in permille scaled by integral_scale
+    long long integral;
+    bool has_last;
+    FixedDegrees last_temperature;
+    int last_duty;
+
+    // raw degrees * ms per degree-second
+    static long long integral_scale() {
+        return (long long)FixedDegrees::from_int(1).raw * 1000;
+    }
+
+    static long clamp_duty(long long duty) {
+        if (duty < 0) {
+            return 0;
+        }
+        if (duty > 1000) {
+            return 1000;
+        }
+        return (long)duty;
+    }
+
+public:
+    TemperatureController(long kp, long ki, long kd, FixedDegrees max_temperature)
+        : kp(kp), ki(ki), kd(kd), max_temperature(max_temperature) {
+        this->enabled = false;
+        this->reset();
+    }
+
+    // forget the integral and last measurement
+    void reset() {
+        this->integral = 0;
+        this->has_last = false;
+        this->last_duty = 0;
+    }
+
+    // start holding target, which must be below max_temperature
+    // returns false (and leaves the controller as it was) if it isn't
+    bool set_target(FixedDegrees target) {
+        if (!(target < this->max_temperature)) {
+            return false;
+        }
+        if (!this->enabled) {
+            this->reset();
+        }
+        this->target_temperature = target;
+        this->enabled = true;
+        return true;
+    }
+
+    void disable() {
+        this->enabled = false;
+        this->reset();
+    }
+
+    bool active() const {
+        return this->enabled;
+    }
+
+    FixedDegrees target() const {
+        return this->target_temperature;
+    }
+
+    // the duty returned by the last update()
+    int duty() const {
+        return this->last_duty;
+    }
+
+    // compute the duty for the next dt_ms from the latest measurement,
+    // returns permille of dt_ms the heater should be on
+    int update(FixedDegrees measured, int dt_ms) {
+        if (!this->enabled || !(measured < this->max_temperature)) {
+            this->reset();
+            return 0;
+        }
+        const long one_degree = FixedDegrees::from_int(1).raw;
+        long long error = (long long)this->target_temperature.raw - measured.raw;
+        long long proportional = this->kp * error / one_degree;
+        long long derivative = 0;
+        if (this->has_last && dt_ms > 0) {
+            long long change = (long long)measured.raw - this->last_temperature.raw;
+            derivative = -this->kd * change * 1000 / dt_ms / one_degree;
+        }
+        this->last_temperature = measured;
+        this->has_last = true;
+
+        // only integrate while it could help, and keep it within the output range
+        long long unclamped = proportional + this->integral / integral_scale() + derivative;
+        if ((unclamped < 1000 || error < 0) && (unclamped > 0 || error > 0)) {
+            this->integral += this->ki * error * dt_ms;
+            if (this->integral < 0) {
+                this->integral = 0;
+            }
+            if (this->integral > 1000 * integral_scale()) {
+                this->integral = 1000 * integral_scale();
+            }
+        }
+        this->last_duty = clamp_duty(proportional + this->integral / integral_scale() + derivative);
+        return this->last_duty;
+    }
+};
+
+#endif
@@ -0,0 +1,246 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef TEMPERATURE_SAMPLER_H
+#define TEMPERATURE_SAMPLER_H
+
+#include "mbed.h"
+
+#include "DS1820Bus.h"
+
+// TemperatureSampler runs the conversion and scratchpad reads for every
+// probe on a bus as two background phases: the conversion is started on all
+// probes at once, the reads are scheduled for when the slowest conversion
+// will have finished, and the readings are published together along with
+// the time the conversion started.
+// The probes' resolution can be changed between conversions with
+// set_resolution, trading precision for faster conversions.
+// requires calling .poll() when next_poll_us() says, and when each bus
+// transaction finishes (see OneWireTransport::set_done_callback)
+class TemperatureSampler {
+private:
+    enum state {
+        state_idle,
+        state_configure,
+        state_convert_command,
+        state_converting,
+        state_reading
+    };
+
+    DS1820Bus *bus;
+    // free running, never reset, all times below are read_us() values
+    Timer   clock;
+    int     period_us;
+    state   current_state;
+    int     convert_time_us;
+    int     convert_start_us;
+    int     read_due_us;
+    bool    has_sample;
+    FixedDegrees samples[DS1820Bus::max_probes];
+    int     sample_us;
+    // between the last two published samples' conversions, -1 if unknown
+    int     last_period_us;
+    // resolution to convert at (0 to leave it), as last written, and what
+    // the bus reported after writing it, to see a probe lose it (power on)
+    int     requested_bits;
+    int     applied_bits;
+    int     expected_bits;
+
+    // how often to check on a bus transaction when blocking, a byte takes ~600us
+    static const int poll_interval_us = 1000;
+    // when to check on a bus transaction anyway, in case its done callback
+    // was missed, the longest (a probe's read) takes ~15ms
+    static const int done_timeout_us = 100000;
+
+    // wrap safe now - then
+    int since(int then) {
+        return (int)((unsigned)this->clock.read_us() - (unsigned)then);
+    }
+
+public:
+    // period_us is the minimum time between the start of each conversion,
+    // 0 samples back to back as fast as the probe's resolution allows
+    TemperatureSampler(DS1820Bus *bus, int period_us) : bus(bus) {
+        this->period_us = period_us;
+        this->current_state = state_idle;
+        this->convert_time_us = 0;
+        this->convert_start_us = 0;
+        this->read_due_us = 0;
+        this->has_sample = false;
+        for (int i = 0; i < DS1820Bus::max_probes; i++) {
+            this->samples[i] = FixedDegrees::from_int(DS1820::invalid_conversion);
+        }
+        this->sample_us = 0;
+        this->last_period_us = -1;
+        this->requested_bits = 0;
+        this->applied_bits = 0;
+        this->expected_bits = 0;
+        this->clock.start();
+    }
+
+    // advance the pipeline without blocking, returns true if a new
+    // sample was published
+    bool poll() {
+        switch (this->current_state) {
+        case state_idle:
+            if (this->has_sample && this->since(this->convert_start_us) < this->period_us) {
+                return false;
+            }
+            if (this->requested_bits != 0 &&
+                (this->requested_bits != this->applied_bits ||
+                 this->bus->resolution() != this->expected_bits)) {
+                if (this->bus->startSetResolution(this->requested_bits)) {
+                    this->applied_bits = this->requested_bits;
+                    this->expected_bits = this->bus->resolution();
+                    this->current_state = state_configure;
+                }
+                return false;
+            }
+            this->convert_time_us = this->bus->startConvert() * 1000;
+            if (this->convert_time_us >= 0) {
+                this->current_state = state_convert_command;
+            }
+            return false;
+
+        case state_configure:
+            if (!this->bus->busy()) {
+                this->current_state = state_idle;
+            }
+            return false;
+
+        case state_convert_command:
+            // the conversion starts once the command is on the wire
+            if (this->bus->busy()) {
+                return false;
+            }
+            this->convert_start_us = this->clock.read_us();
+            this->read_due_us = this->convert_start_us + this->convert_time_us;
+            this->current_state = state_converting;
+            return false;
+
+        case state_converting:
+            if (this->since(this->read_due_us) < 0) {
+                return false;
+            }
+            this->bus->finishConvert();
+            if (this->bus->startRead()) {
+                this->current_state = state_reading;
+            }
+            return false;
+
+        case state_reading:
+            if (!this->bus->poll()) {
+                return false;
+            }
+            for (int i = 0; i < this->bus->count(); i++) {
+                this->samples[i] = this->bus->samples()[i];
+            }
+            if (this->has_sample) {
+                this->last_period_us = this->convert_start_us - this->sample_us;
+            }
+            this->sample_us = this->convert_start_us;
+            this->has_sample = true;
+            this->current_state = state_idle;
+            return true;
+        }
+        return false;
+    }
+
+    // true while waiting on a bus transaction to finish
+    bool in_flight() {
+        return this->current_state == state_configure ||
+               this->current_state == state_convert_command ||
+               this->current_state == state_reading;
+    }
+
+    // microseconds until poll() next has something to do, so that the
+    // caller can sleep until then. while a bus transaction is in flight
+    // completion isn't timed, the caller should poll() from the bus's done
+    // callback, this is then only a fallback (done_timeout_us)
+    int next_poll_us() {
+        int wait_us = 0;
+        switch (this->current_state) {
+        case state_idle:
+            if (this->has_sample) {
+                wait_us = this->period_us - this->since(this->convert_start_us);
+            }
+            break;
+
+        case state_converting:
+            wait_us = -this->since(this->read_due_us);
+            break;
+
+        case state_configure:
+        case state_convert_command:
+        case state_reading:
+            wait_us = done_timeout_us;
+            break;
+        }
+        return wait_us > 0 ? wait_us : 0;
+    }
+
+    // run the pipeline until samples are published, blocking
+    void sample_blocking() {
+        while (!this->poll()) {
+            wait_us(this->in_flight() ? poll_interval_us : this->next_poll_us());
+        }
+    }
+
+    // convert at bits (9 - 12) from the next conversion on
+    void set_resolution(int bits) {
+        this->requested_bits = bits;
+    }
+
+    // the resolution the probes convert at, the coarsest if they differ
+    int resolution() {
+        return this->bus->resolution();
+    }
+
+    // microseconds between the last two published samples, -1 until
+    // there have been two
+    int sample_period_us() {
+        return this->last_period_us;
+    }
+
+    // the number of probes sampled
+    int count() {
+        return this->bus->count();
+    }
+
+    // the last published reading in degrees C for the probe at index, or
+    // DS1820::invalid_conversion if there is none / it failed
+    FixedDegrees temperature_fixed(int index = 0) {
+        if (index < 0 || index >= this->bus->count()) {
+            return FixedDegrees::from_int(DS1820::invalid_conversion);
+        }
+        return this->samples[index];
+    }
+
+    // temperature_fixed as a float
+    float temperature(int index = 0) {
+        return this->temperature_fixed(index).to_float();
+    }
+
+    // microseconds since the last published readings' conversion started,
+    // this is the true age of the readings, including the conversion time
+    int sample_age_us() {
+        if (!this->has_sample) {
+            return -1;
+        }
+        return this->since(this->sample_us);
+    }
+};
+
+#endif
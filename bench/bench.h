@@ -0,0 +1,148 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+    A tiny benchmark harness for the host side benchmarks, these are built
+    and run on a Linux host with ./build.py bench, never on the mbed.
+
+    Results are printed, and if $BENCH_JSON is set bench_report() also
+    writes them there as JSON, in the same shape as Google Benchmark's
+    --benchmark_format=json so the usual tools can compare runs:
+
+    {
+      "context": {"executable": "..."},
+      "benchmarks": [
+        {"name": "...", "iterations": 1000, "real_time": 12.5,
+         "time_unit": "ns", <counters>},
+        ...
+      ]
+    }
+*/
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+
+// keep the compiler from optimizing away a benchmarked result
+template<class T>
+inline void do_not_optimize(const T &value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// check fails the benchmark binary if cond is false
+#define BENCH_CHECK(cond) do { \
+    if (!(cond)) { \
+        std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        std::exit(1); \
+    } \
+} while (0)
+
+struct bench_result {
+    std::string name;
+    long iterations;
+    double ns;
+    // extra per benchmark numbers, eg: simulated time per iteration
+    std::vector<std::pair<std::string, double> > counters;
+};
+
+inline std::vector<bench_result> &bench_results() {
+    static std::vector<bench_result> results;
+    return results;
+}
+
+// bench_counter adds a named number to the last benchmark run
+inline void bench_counter(const char *name, double value) {
+    BENCH_CHECK(!bench_results().empty());
+    bench_results().back().counters.push_back(std::make_pair(std::string(name), value));
+    std::printf("%-40s %12s %10.2f %s\n", "", "", value, name);
+}
+
+// benchmark names are ASCII, but may contain quotes
+inline void bench_json_string(FILE *out, const std::string &s) {
+    std::fputc('"', out);
+    for (size_t i = 0; i < s.size(); i++) {
+        if (s[i] == '"' || s[i] == '\\') {
+            std::fputc('\\', out);
+        }
+        std::fputc(s[i], out);
+    }
+    std::fputc('"', out);
+}
+
+// bench_report writes the results to $BENCH_JSON if it is set, call it at
+// the end of main(), it returns main()'s exit status
+inline int bench_report(const char *executable) {
+    const char *path = std::getenv("BENCH_JSON");
+    if (!path) {
+        return 0;
+    }
+    FILE *out = std::fopen(path, "w");
+    BENCH_CHECK(out != NULL);
+    std::fprintf(out, "{\n  \"context\": {\"executable\": ");
+    bench_json_string(out, executable);
+    std::fprintf(out, "},\n  \"benchmarks\": [");
+    const std::vector<bench_result> &results = bench_results();
+    for (size_t i = 0; i < results.size(); i++) {
+        const bench_result &r = results[i];
+        std::fprintf(out, "%s\n    {\"name\": ", i ? "," : "");
+        bench_json_string(out, r.name);
+        std::fprintf(out, ", \"iterations\": %ld, \"real_time\": %.4f, \"time_unit\": \"ns\"",
+                     r.iterations, r.ns);
+        for (size_t c = 0; c < r.counters.size(); c++) {
+            std::fprintf(out, ", ");
+            bench_json_string(out, r.counters[c].first);
+            std::fprintf(out, ": %.4f", r.counters[c].second);
+        }
+        std::fprintf(out, "}");
+    }
+    std::fprintf(out, "\n  ]\n}\n");
+    BENCH_CHECK(std::fclose(out) == 0);
+    return 0;
+}
+
+// run_benchmark calls fn(iterations) with increasing iteration counts until
+// it runs for at least 200ms, then prints, records and returns the ns per
+// iteration
+template<class F>
+double run_benchmark(const char *name, F fn) {
+    typedef std::chrono::steady_clock clock;
+    long iterations = 1;
+    double elapsed_ns = 0;
+    while (true) {
+        clock::time_point start = clock::now();
+        fn(iterations);
+        elapsed_ns = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+        if (elapsed_ns >= 200e6 || iterations >= (1L << 40)) {
+            break;
+        }
+        iterations *= elapsed_ns < 20e6 ? 10 : 2;
+    }
+    double ns = elapsed_ns / iterations;
+    std::printf("%-40s %12ld iterations %10.2f ns/op\n", name, iterations, ns);
+    bench_result result;
+    result.name = name;
+    result.iterations = iterations;
+    result.ns = ns;
+    bench_results().push_back(result);
+    return ns;
+}
+
+#endif
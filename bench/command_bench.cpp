@@ -0,0 +1,138 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+    Compares parse + dispatch of text commands through the table in
+    Commands.h against the if / else chain of starts_with() calls
+    process_line used to use.
+*/
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+#include "../Commands.h"
+
+// the handlers just record what ran
+static int last_handler = -1;
+static int last_value = -1;
+void command_status(int value) { last_handler = 0; last_value = value; }
+void command_temperature(int value) { last_handler = 1; last_value = value; }
+void command_water_level(int value) { last_handler = 2; last_value = value; }
+void command_serial_errors(int value) { last_handler = 3; last_value = value; }
+void command_brew(int value) { last_handler = 4; last_value = value; }
+void command_reset(int value) { last_handler = 5; last_value = value; }
+void command_idle(int value) { last_handler = 6; last_value = value; }
+void command_tasks(int value) { last_handler = 7; last_value = value; }
+void command_control(int value) { last_handler = 8; last_value = value; }
+void command_subscribe(int value) { last_handler = 9; last_value = value; }
+void command_history(int value) { last_handler = 10; last_value = value; }
+void command_profile(int value) { last_handler = 11; last_value = value; }
+
+// the original chain, with the length aware starts_with
+static bool starts_with(const char *pre, const char *str, int lenstr) {
+    int lenpre = strlen(pre);
+    return lenstr < lenpre ? false : strncmp(pre, str, lenpre) == 0;
+}
+
+static bool process_line_chain(const char *line, int length) {
+    if (starts_with("S+?", line, length)) {
+        command_status(0);
+    } else if (starts_with("T+?", line, length)) {
+        command_temperature(0);
+    } else if (starts_with("W+?", line, length)) {
+        command_water_level(0);
+    } else if (starts_with("E+?", line, length)) {
+        command_serial_errors(0);
+    } else if (starts_with("B+1", line, length)) {
+        command_brew(1);
+    } else if (starts_with("B+0", line, length)) {
+        command_brew(0);
+    } else if (starts_with("RESET", line, length)) {
+        command_reset(0);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool process_line_table(const char *line, int length) {
+    return dispatch_command(line, length) >= 0;
+}
+
+int main() {
+    // a realistic mix: mostly status polls and heater keepalives,
+    // plus the other commands and some garbage
+    std::vector<std::string> lines = {
+        "S+?", "B+1", "S+?", "B+1", "T+?", "W+?", "B+0", "E+?",
+        "RESET", "S+", "B+2", "X+?", "", "RES",
+    };
+
+    // both must agree on which handler runs with which value
+    for (size_t i = 0; i < lines.size(); i++) {
+        const char *line = lines[i].c_str();
+        int length = lines[i].size();
+        last_handler = last_value = -1;
+        bool chain = process_line_chain(line, length);
+        int chain_handler = last_handler, chain_value = last_value;
+        last_handler = last_value = -1;
+        bool table = process_line_table(line, length);
+        BENCH_CHECK(chain == table);
+        BENCH_CHECK(chain_handler == last_handler);
+        BENCH_CHECK(chain_value == last_value);
+    }
+    std::printf("table dispatch matches the if / else chain for %d commands\n", command_count);
+
+    // the chain gets slower the further down it a command is,
+    // the table should cost the same for every command
+    const char *cases[][2] = {
+        {"first", "S+?"},
+        {"last", "RESET"},
+        {"miss", "X+?"},
+    };
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        const std::string line = cases[c][1];
+        std::string name = std::string("process_line/if_else_chain/") + cases[c][0];
+        double chain_ns = run_benchmark(name.c_str(), [&](long iterations) {
+            for (long i = 0; i < iterations; i++) {
+                do_not_optimize(process_line_chain(line.data(), line.size()));
+            }
+        });
+        name = std::string("process_line/table/") + cases[c][0];
+        double table_ns = run_benchmark(name.c_str(), [&](long iterations) {
+            for (long i = 0; i < iterations; i++) {
+                do_not_optimize(process_line_table(line.data(), line.size()));
+            }
+        });
+        std::printf("%s speedup: %.2fx\n", cases[c][0], chain_ns / table_ns);
+    }
+
+    double chain_ns = run_benchmark("process_line/if_else_chain/mix", [&](long iterations) {
+        for (long i = 0; i < iterations; i++) {
+            const std::string &line = lines[i % lines.size()];
+            do_not_optimize(process_line_chain(line.data(), line.size()));
+        }
+    });
+    double table_ns = run_benchmark("process_line/table/mix", [&](long iterations) {
+        for (long i = 0; i < iterations; i++) {
+            const std::string &line = lines[i % lines.size()];
+            do_not_optimize(process_line_table(line.data(), line.size()));
+        }
+    });
+    std::printf("mix speedup: %.2fx\n", chain_ns / table_ns);
+    return bench_report("command_bench");
+}
@@ -0,0 +1,131 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+    Compares the table driven CRC-8 in CRC8.h against the bitwise version
+    DS1820::CRC_byte used to use, both for equivalence and for speed.
+*/
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "bench.h"
+#include "../CRC8.h"
+
+// the original bitwise DS1820::CRC_byte, kept as the reference
+static char crc_byte_bitwise(char _CRC, char byte) {
+    int j;
+    for(j=0;j<8;j++) {
+        if ((byte & 0x01 ) ^ (_CRC & 0x01)) {
+            // DATA ^ LSB CRC = 1
+            _CRC = _CRC>>1;
+            // Set the MSB to 1
+            _CRC = _CRC | 0x80;
+            // Check bit 3
+            if (_CRC & 0x04) {
+                _CRC = _CRC & 0xFB; // Bit 3 is set, so clear it
+            } else {
+                _CRC = _CRC | 0x04; // Bit 3 is clear, so set it
+            }
+            // Check bit 4
+            if (_CRC & 0x08) {
+                _CRC = _CRC & 0xF7; // Bit 4 is set, so clear it
+            } else {
+                _CRC = _CRC | 0x08; // Bit 4 is clear, so set it
+            }
+        } else {
+            // DATA ^ LSB CRC = 0
+            _CRC = _CRC>>1;
+            // clear MSB
+            _CRC = _CRC & 0x7F;
+            // No need to check bits, with DATA ^ LSB CRC = 0, they will remain unchanged
+        }
+        byte = byte>>1;
+    }
+    return _CRC;
+}
+
+static char crc_bitwise(const char *data, int length) {
+    char crc = 0x00;
+    for (int i = 0; i < length; i++) {
+        crc = crc_byte_bitwise(crc, data[i]);
+    }
+    return crc;
+}
+
+// known good ROM codes, the last byte is the CRC of the first 7
+static const unsigned char known_roms[][8] = {
+    // the example from Maxim application note 27
+    {0x02, 0x1C, 0xB8, 0x01, 0x00, 0x00, 0x00, 0xA2},
+    // DS18B20 probes
+    {0x28, 0xFF, 0x4B, 0x6A, 0x64, 0x16, 0x04, 0x46},
+    {0x28, 0x6E, 0x2B, 0x5A, 0x05, 0x00, 0x00, 0xB0},
+    {0x28, 0x3F, 0xC1, 0x0A, 0x06, 0x00, 0x00, 0xF2},
+    {0x28, 0x9C, 0x74, 0x41, 0x07, 0x00, 0x00, 0xB5},
+};
+static const int num_known_roms = sizeof(known_roms) / sizeof(known_roms[0]);
+
+static void check_equivalence() {
+    // every (crc, byte) pair
+    for (int crc = 0; crc < 256; crc++) {
+        for (int byte = 0; byte < 256; byte++) {
+            BENCH_CHECK(crc8_byte((char)crc, (char)byte) == crc_byte_bitwise((char)crc, (char)byte));
+        }
+    }
+    for (int i = 0; i < num_known_roms; i++) {
+        const char *rom = (const char *)known_roms[i];
+        BENCH_CHECK(crc8(rom, 7) == rom[7]);
+        BENCH_CHECK(crc_bitwise(rom, 7) == rom[7]);
+    }
+    std::printf("table CRC matches bitwise CRC for all inputs and known ROMs\n");
+}
+
+int main() {
+    check_equivalence();
+
+    // 9 byte buffers, the size of a scratchpad
+    std::mt19937 rng(1820);
+    std::vector<char> buffers(9 * 4096);
+    for (size_t i = 0; i < buffers.size(); i++) {
+        buffers[i] = (char)rng();
+    }
+    const int num_buffers = buffers.size() / 9;
+
+    double bitwise_ns = run_benchmark("scratchpad_crc/bitwise", [&](long iterations) {
+        for (long i = 0; i < iterations; i++) {
+            do_not_optimize(crc_bitwise(&buffers[(i % num_buffers) * 9], 8));
+        }
+    });
+    double table_ns = run_benchmark("scratchpad_crc/table", [&](long iterations) {
+        for (long i = 0; i < iterations; i++) {
+            do_not_optimize(crc8(&buffers[(i % num_buffers) * 9], 8));
+        }
+    });
+    std::printf("scratchpad speedup: %.2fx\n", bitwise_ns / table_ns);
+
+    bitwise_ns = run_benchmark("rom_crc/bitwise", [&](long iterations) {
+        for (long i = 0; i < iterations; i++) {
+            do_not_optimize(crc_bitwise((const char *)known_roms[i % num_known_roms], 7));
+        }
+    });
+    table_ns = run_benchmark("rom_crc/table", [&](long iterations) {
+        for (long i = 0; i < iterations; i++) {
+            do_not_optimize(crc8((const char *)known_roms[i % num_known_roms], 7));
+        }
+    });
+    std::printf("ROM speedup: %.2fx\n", bitwise_ns / table_ns);
+    return bench_report("crc8_bench");
+}
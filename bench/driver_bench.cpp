@@ -0,0 +1,277 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+    Times the drivers that need mbed, built against the simulated hardware
+    in sim/: the DS1820 CRC and checksum routines, searching a bus of many
+    probes, LinkedList (the DS1820 probe list) and HCSR04's conversion.
+
+    The 1-Wire bus is the bit level model in sim/OneWireBus.h, so the
+    search times are host CPU time for the driver plus the model, the
+    bus_ms counter is the time the search holds the real bus.
+*/
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "bench.h"
+#include "../CRC8.h"
+#include "../DS1820.h"
+#include "../HCSR04.h"
+#include "../LinkedList.h"
+#include "../OneWire.h"
+#include "OneWireBus.h"
+#include "World.h"
+
+// no probes, sensors or traffic of its own, the benchmark sets up the bus
+static const char script[] =
+    "transcript off\n"
+    "end never\n";
+
+// the bus of many probes, on a pin main.cpp doesn't use
+#define BENCH_BUS_PIN p9
+
+static const int max_devices = 32;
+
+// access to DS1820's private routines
+class DS1820Bench {
+public:
+    static char CRC_byte(char crc, char byte) {
+        return DS1820::CRC_byte(crc, byte);
+    }
+
+    static bool ROM_checksum_error(char *rom) {
+        return DS1820::ROM_checksum_error(rom);
+    }
+
+    static bool RAM_checksum_error(DS1820 *probe) {
+        return probe->RAM_checksum_error();
+    }
+
+    static void set_RAM(DS1820 *probe, const char *ram) {
+        for (int i = 0; i < 9; i++) {
+            probe->RAM[i] = ram[i];
+        }
+    }
+
+    static bool search_ROM(OneWireTransport *bus, char *rom) {
+        return DS1820::search_ROM_routine(bus, 0xF0, rom);
+    }
+
+    static bool is_assigned(const char *rom) {
+        for (int i = 0; i < DS1820::probes.length(); i++) {
+            if (std::memcmp(DS1820::probes.peek(i)->_ROM, rom, 8) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+static void bench_checksums() {
+    for (int crc = 0; crc < 256; crc++) {
+        for (int byte = 0; byte < 256; byte++) {
+            BENCH_CHECK(DS1820Bench::CRC_byte((char)crc, (char)byte) == crc8_byte((char)crc, (char)byte));
+        }
+    }
+
+    // ROM codes and scratchpads with their CRCs, and every 16th corrupted
+    std::mt19937 rng(1820);
+    std::vector<char> roms(8 * 1024);
+    std::vector<char> scratchpads(9 * 1024);
+    for (int i = 0; i < 1024; i++) {
+        char *rom = &roms[i * 8];
+        char *ram = &scratchpads[i * 9];
+        for (int b = 0; b < 8; b++) {
+            rom[b] = (char)rng();
+            ram[b] = (char)rng();
+        }
+        rom[0] = 0x28;
+        rom[7] = crc8(rom, 7) ^ (i % 16 == 0 ? 0x01 : 0x00);
+        ram[8] = crc8(ram, 8) ^ (i % 16 == 0 ? 0x01 : 0x00);
+        BENCH_CHECK(DS1820Bench::ROM_checksum_error(rom) == (i % 16 == 0));
+    }
+
+    run_benchmark("DS1820::CRC_byte/scratchpad", [&](long iterations) {
+        for (long i = 0; i < iterations; i++) {
+            const char *ram = &scratchpads[(i % 1024) * 9];
+            char crc = 0;
+            for (int b = 0; b < 8; b++) {
+                crc = DS1820Bench::CRC_byte(crc, ram[b]);
+            }
+            do_not_optimize(crc);
+        }
+    });
+    run_benchmark("DS1820::ROM_checksum_error", [&](long iterations) {
+        for (long i = 0; i < iterations; i++) {
+            do_not_optimize(DS1820Bench::ROM_checksum_error(&roms[(i % 1024) * 8]));
+        }
+    });
+}
+
+// the time DS1820 spends finding the last unassigned probe on a bus of
+// devices, walking the search tree past every assigned one
+static void bench_search(int devices) {
+    std::mt19937 rng(devices);
+    OneWireBus bus;
+    std::vector<DS18B20 *> models;
+    for (int i = 0; i < devices; i++) {
+        unsigned char rom[8] = {0x28};
+        for (int b = 1; b < 7; b++) {
+            rom[b] = (unsigned char)rng();
+        }
+        rom[7] = (unsigned char)crc8((const char *)rom, 7);
+        models.push_back(new DS18B20(rom));
+        bus.add(models.back());
+    }
+    World::get().pin(BENCH_BUS_PIN).attach(&bus);
+
+    std::vector<DS1820 *> probes;
+    for (int i = 0; i < devices - 1; i++) {
+        probes.push_back(new DS1820(BENCH_BUS_PIN));
+    }
+
+    OneWire master(BENCH_BUS_PIN);
+    char rom[8];
+    BENCH_CHECK(DS1820Bench::search_ROM(&master, rom));
+    BENCH_CHECK(!DS1820Bench::is_assigned(rom));
+
+    // the RAM checksum of a probe with a valid scratchpad
+    if (devices == 1) {
+        DS1820 probe(BENCH_BUS_PIN);
+        char ram[9] = {0x50, 0x05, 0x4B, 0x46, 0x7F, (char)0xFF, 0x0C, 0x10};
+        ram[8] = crc8(ram, 8);
+        DS1820Bench::set_RAM(&probe, ram);
+        BENCH_CHECK(!DS1820Bench::RAM_checksum_error(&probe));
+        run_benchmark("DS1820::RAM_checksum_error", [&](long iterations) {
+            for (long i = 0; i < iterations; i++) {
+                do_not_optimize(DS1820Bench::RAM_checksum_error(&probe));
+            }
+        });
+    }
+
+    VirtualClock &clock = sim_clock();
+    double bus_ns = 0;
+    char name[64];
+    std::snprintf(name, sizeof(name), "DS1820::search_ROM_routine/%d", devices);
+    run_benchmark(name, [&](long iterations) {
+        sim_time_t start = clock.now();
+        for (long i = 0; i < iterations; i++) {
+            do_not_optimize(DS1820Bench::search_ROM(&master, rom));
+        }
+        bus_ns = (double)(clock.now() - start) / iterations;
+    });
+    bench_counter("bus_ms", bus_ns / 1e6);
+
+    for (size_t i = 0; i < probes.size(); i++) {
+        delete probes[i];
+    }
+    World::get().pin(BENCH_BUS_PIN).attach(NULL);
+    for (size_t i = 0; i < models.size(); i++) {
+        delete models[i];
+    }
+}
+
+// the operations DS1820 does on its probe list: append on construction,
+// scanning it during search, and removal on destruction
+static void bench_linked_list() {
+    const int length = 8;
+    int values[length];
+    LinkedList<int> list;
+    for (int i = 0; i < length; i++) {
+        values[i] = i;
+        list.append(&values[i]);
+    }
+    BENCH_CHECK(list.length() == length);
+    BENCH_CHECK(*list.peek(length - 1) == length - 1);
+    BENCH_CHECK(list.peek(length) == NULL);
+
+    run_benchmark("LinkedList/peek_all/8", [&](long iterations) {
+        for (long i = 0; i < iterations; i++) {
+            for (int j = 0; j < list.length(); j++) {
+                do_not_optimize(list.peek(j));
+            }
+        }
+    });
+    run_benchmark("LinkedList/append_remove/8", [&](long iterations) {
+        LinkedList<int> scratch;
+        for (long i = 0; i < iterations; i++) {
+            for (int j = 0; j < length; j++) {
+                scratch.append(&values[j]);
+            }
+            for (int j = length - 1; j >= 0; j--) {
+                do_not_optimize(scratch.remove(j));
+            }
+        }
+    });
+    run_benchmark("LinkedList/push_remove_head", [&](long iterations) {
+        LinkedList<int> scratch;
+        for (long i = 0; i < iterations; i++) {
+            scratch.push(&values[i % length]);
+            do_not_optimize(scratch.remove(0));
+        }
+    });
+}
+
+// the original floating point conversion, kept as the reference
+static double inches_from_raw_double(int raw_us) {
+    return (raw_us / 2.) / 74.;
+}
+
+static void bench_hcsr04() {
+    // every echo time up to the sensor's 38ms timeout, to within rounding
+    for (int raw = 0; raw <= 38000; raw++) {
+        BENCH_CHECK(std::fabs(HCSR04::inches_from_raw(raw) - inches_from_raw_double(raw)) <= 0.5e-6);
+    }
+
+    std::vector<int> raws(4096);
+    std::mt19937 rng(4);
+    std::uniform_int_distribution<int> echo(150, 10700);
+    for (size_t i = 0; i < raws.size(); i++) {
+        raws[i] = echo(rng);
+    }
+    run_benchmark("HCSR04::inches_from_raw/double_reference", [&](long iterations) {
+        for (long i = 0; i < iterations; i++) {
+            do_not_optimize(inches_from_raw_double(raws[i % raws.size()]));
+        }
+    });
+    run_benchmark("HCSR04::inches_from_raw", [&](long iterations) {
+        for (long i = 0; i < iterations; i++) {
+            do_not_optimize(HCSR04::inches_from_raw(raws[i % raws.size()]));
+        }
+    });
+    run_benchmark("HCSR04::fixed_inches_from_raw", [&](long iterations) {
+        for (long i = 0; i < iterations; i++) {
+            do_not_optimize(HCSR04::fixed_inches_from_raw(raws[i % raws.size()]).raw);
+        }
+    });
+}
+
+int main() {
+    World::configure("driver_bench", script);
+
+    bench_checksums();
+    const int sizes[] = {1, 8, max_devices};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        bench_search(sizes[i]);
+    }
+    std::printf("search found the unassigned probe among 1 - %d devices\n", max_devices);
+    bench_linked_list();
+    bench_hcsr04();
+    return bench_report("driver_bench");
+}
@@ -0,0 +1,106 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+    Times process_line and send_status in main.cpp, end to end through the
+    firmware built against the simulated hardware in sim/ (see
+    sim/firmware.cpp), so the times include the model of the UART the
+    replies are written to. The uart_ms counter is how long the reply
+    holds the real 115200 baud link, back to back replies wait on it once
+    the TX queue fills. caller_ms is how long a reply holds up the caller
+    when the link is idle, as for a command now and then.
+*/
+#include <cstdio>
+#include <cstring>
+
+#include "bench.h"
+#include "World.h"
+#include "../SerialTx.h"
+
+extern RawSerial pc;
+extern SerialTx serial_tx;
+bool process_line(const char *line, int length);
+void send_status();
+
+// a probe and the water level sensor for main.cpp's globals to find
+static const char script[] =
+    "transcript off\n"
+    "end never\n"
+    "ds18b20 28FF4B6A641604 temperature=92.5\n"
+    "hcsr04 distance=6\n";
+
+// the firmware's globals search the bus when they are constructed, during
+// static initialization, so the World must be configured before them
+struct configure_world {
+    configure_world() {
+        World::configure("firmware_bench", script);
+    }
+};
+static configure_world configure __attribute__((init_priority(101)));
+
+template<class F>
+static void run_firmware_benchmark(const char *name, F fn) {
+    VirtualClock &clock = sim_clock();
+    double uart_ns = 0;
+    run_benchmark(name, [&](long iterations) {
+        sim_time_t start = clock.now();
+        fn(iterations);
+        uart_ns = (double)(clock.now() - start) / iterations;
+    });
+    bench_counter("uart_ms", uart_ns / 1e6);
+}
+
+static void bench_line(const char *name, const char *line, bool valid) {
+    const int length = std::strlen(line);
+    BENCH_CHECK(process_line(line, length) == valid);
+    run_firmware_benchmark(name, [&](long iterations) {
+        for (long i = 0; i < iterations; i++) {
+            do_not_optimize(process_line(line, length));
+        }
+    });
+}
+
+int main() {
+    // as main.cpp's main() does, which doesn't run
+    pc.baud(115200);
+
+    run_firmware_benchmark("send_status", [](long iterations) {
+        for (long i = 0; i < iterations; i++) {
+            send_status();
+        }
+    });
+    VirtualClock &clock = sim_clock();
+    double caller_ns = 0;
+    run_benchmark("send_status/idle_link", [&](long iterations) {
+        sim_time_t held = 0;
+        for (long i = 0; i < iterations; i++) {
+            while (serial_tx.queued() > 0) {
+                wait_us(100);
+            }
+            sim_time_t start = clock.now();
+            send_status();
+            held += clock.now() - start;
+        }
+        caller_ns = (double)held / iterations;
+    });
+    bench_counter("caller_ms", caller_ns / 1e6);
+    bench_line("process_line/status", "S+?", true);
+    bench_line("process_line/temperature", "T+?", true);
+    bench_line("process_line/water_level", "W+?", true);
+    bench_line("process_line/serial_errors", "E+?", true);
+    bench_line("process_line/miss", "X+?", false);
+    return bench_report("firmware_bench");
+}
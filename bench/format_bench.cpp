@@ -0,0 +1,205 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+    Compares format_status in Format.h against the printf format send_status
+    used to use, both for byte identical output and for speed.
+*/
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "bench.h"
+#include "../Fixed.h"
+#include "../Format.h"
+
+// a * b exactly, as hi + lo (Dekker's product), so that rounding
+// ties can be told apart from values just either side of them
+static void two_product(double a, double b, double *hi, double *lo) {
+    const double split = 134217729.0; // 2^27 + 1
+    double p = a * b;
+    double a_split = split * a;
+    double a_hi = a_split - (a_split - a);
+    double a_lo = a - a_hi;
+    double b_split = split * b;
+    double b_hi = b_split - (b_split - b);
+    double b_lo = b - b_hi;
+    *hi = p;
+    *lo = ((a_hi * b_hi - p) + a_hi * b_lo + a_lo * b_hi) + a_lo * b_lo;
+}
+
+// round value * 10^decimals to the nearest integer, ties to even, exactly
+// the way printf("%.<decimals>f") rounds. decimals must be 0 - 9.
+// NOTE: negative values that round to zero lose their sign, where printf
+// would write eg: "-0.0"
+static long round_fixed(double value, int decimals) {
+    static const double scales[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9
+    };
+    double hi, lo;
+    two_product(value, scales[decimals], &hi, &lo);
+    double whole = std::floor(hi);
+    long result = (long)whole;
+    // (hi - whole) - 0.5 is exact, and adding lo keeps the exact sign
+    double above_half = ((hi - whole) - 0.5) + lo;
+    if (above_half > 0 || (above_half == 0 && (result & 1))) {
+        result++;
+    }
+    return result;
+}
+
+struct status {
+    double water;
+    double temperature;
+    bool heater;
+};
+
+static int format_status_printf(char *out, const status &s) {
+    return std::snprintf(out, STATUS_LINE_MAX, "W+%.2f,T+%.1f,B+%d\n",
+                         s.water, s.temperature, s.heater ? 1 : 0);
+}
+
+static int format_status_fixed(char *out, const status &s) {
+    return format_status(out, round_fixed(s.water, 2), round_fixed(s.temperature, 1), s.heater);
+}
+
+static void check_same(const status &s) {
+    char expected[STATUS_LINE_MAX];
+    char actual[STATUS_LINE_MAX];
+    int expected_length = format_status_printf(expected, s);
+    int actual_length = format_status_fixed(actual, s);
+    if (expected_length != actual_length || std::memcmp(expected, actual, actual_length) != 0) {
+        std::fprintf(stderr, "mismatch: %.*s vs %.*s",
+                     expected_length, expected, actual_length, actual);
+        std::exit(1);
+    }
+}
+
+// sensor readings: DS18B20 temperatures are multiples of 1/16 C from -55 to
+// 125 C (or DS1820::invalid_conversion), water levels come from whole
+// microsecond echo times, then through the EMA, so may be any double
+static std::vector<status> sensor_statuses() {
+    std::vector<status> statuses;
+    std::mt19937 rng(1820);
+    std::uniform_real_distribution<double> ema(0.0, 72.0);
+    for (int sixteenths = -55 * 16; sixteenths <= 125 * 16; sixteenths++) {
+        for (int usec = 0; usec <= 10000; usec += 37) {
+            status s = {usec / 148.0, sixteenths / 16.0, (usec & 1) != 0};
+            statuses.push_back(s);
+        }
+        status invalid = {ema(rng), -1000.0, false};
+        statuses.push_back(invalid);
+        status filtered = {ema(rng), sixteenths / 16.0, true};
+        statuses.push_back(filtered);
+    }
+    return statuses;
+}
+
+static void check_equivalence(const std::vector<status> &statuses) {
+    for (size_t i = 0; i < statuses.size(); i++) {
+        check_same(statuses[i]);
+    }
+    // exact ties and values either side of them, skipping the negative
+    // values that printf rounds to "-0.0", which no probe can read
+    for (long hundredths = 0; hundredths < 100000; hundredths++) {
+        double tie = (hundredths + 0.5) / 100.0;
+        double tenths = (hundredths - 50000) / 100.0 + 0.05;
+        double waters[] = {tie, std::nextafter(tie, 0.0), std::nextafter(tie, 1e9)};
+        double temperatures[] = {tenths, -tenths};
+        for (int w = 0; w < 3; w++) {
+            for (int t = 0; t < 2; t++) {
+                status s = {waters[w], temperatures[t], false};
+                if (std::signbit(s.temperature) && round_fixed(s.temperature, 1) == 0) {
+                    continue;
+                }
+                check_same(s);
+            }
+        }
+    }
+    std::printf("format_status matches printf for %zu sensor readings and rounding ties\n",
+                statuses.size());
+}
+
+// the firmware rounds its Fixed readings rather than doubles, check those
+// round the same as printf of the reading as a double
+static void check_fixed_rounding() {
+    char expected[16];
+    char actual[16];
+    for (int sixteenths = -55 * 16; sixteenths <= 125 * 16; sixteenths++) {
+        FixedDegrees degrees(sixteenths * 625);
+        int expected_length = std::snprintf(expected, sizeof(expected), "%.1f", sixteenths / 16.0);
+        if (degrees.raw < 0 && degrees.round(1) == 0) {
+            continue;
+        }
+        int actual_length = format_fixed(actual, degrees.round(1), 1) - actual;
+        BENCH_CHECK(expected_length == actual_length);
+        BENCH_CHECK(std::memcmp(expected, actual, actual_length) == 0);
+    }
+    // millionths aren't exact as doubles, so printf rounds exact ties
+    // either way, the rest must match
+    for (long micro_inches = 0; micro_inches <= 72000000; micro_inches += 7) {
+        if (micro_inches % 5000 == 0) {
+            continue;
+        }
+        FixedInches inches(micro_inches);
+        int expected_length = std::snprintf(expected, sizeof(expected), "%.2f", micro_inches / 1e6);
+        int actual_length = format_fixed(actual, inches.round(2), 2) - actual;
+        BENCH_CHECK(expected_length == actual_length);
+        BENCH_CHECK(std::memcmp(expected, actual, actual_length) == 0);
+    }
+    std::printf("Fixed rounding matches printf for probe readings and water levels\n");
+}
+
+int main() {
+    std::vector<status> statuses = sensor_statuses();
+    check_equivalence(statuses);
+    check_fixed_rounding();
+    const size_t count = statuses.size();
+
+    char line[STATUS_LINE_MAX];
+    double printf_ns = run_benchmark("send_status/printf", [&](long iterations) {
+        for (long i = 0; i < iterations; i++) {
+            do_not_optimize(format_status_printf(line, statuses[i % count]));
+            do_not_optimize(line);
+        }
+    });
+    double fixed_ns = run_benchmark("send_status/format_status", [&](long iterations) {
+        for (long i = 0; i < iterations; i++) {
+            do_not_optimize(format_status_fixed(line, statuses[i % count]));
+            do_not_optimize(line);
+        }
+    });
+    std::printf("send_status speedup: %.2fx\n", printf_ns / fixed_ns);
+
+    // as the firmware does it, from Fixed readings
+    std::vector<FixedInches> waters(count);
+    std::vector<FixedDegrees> temperatures(count);
+    for (size_t i = 0; i < count; i++) {
+        waters[i] = FixedInches(round_fixed(statuses[i].water, 6));
+        temperatures[i] = FixedDegrees(round_fixed(statuses[i].temperature, 4));
+    }
+    run_benchmark("send_status/format_status_from_fixed", [&](long iterations) {
+        for (long i = 0; i < iterations; i++) {
+            size_t j = i % count;
+            do_not_optimize(format_status(line, waters[j].round(2), temperatures[j].round(1),
+                                          statuses[j].heater));
+            do_not_optimize(line);
+        }
+    });
+    return bench_report("format_bench");
+}
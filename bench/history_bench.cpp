@@ -0,0 +1,136 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+    Checks that every block SampleHistory.h encodes decodes back to the
+    samples added, including after the oldest blocks have been evicted,
+    and times adding and decoding samples.
+*/
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "bench.h"
+#include "../SampleHistory.h"
+
+// a sample every 2 seconds of a brew: small temperature and water level
+// steps of either sign, the heater switching now and then, and every so
+// often a large jump (eg: a failed reading) for the longer varints
+static std::vector<history_sample> make_samples(int count, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::vector<history_sample> samples;
+    history_sample s;
+    s.time_ds = 0;
+    s.temperature_deci_c = 200;
+    s.water_centi_inches = 350;
+    s.heater = false;
+    for (int i = 0; i < count; i++) {
+        s.time_ds += 20 + rng() % 3;
+        s.temperature_deci_c += (long)(rng() % 7) - 3;
+        s.water_centi_inches += (long)(rng() % 5) - 2;
+        if (rng() % 50 == 0) {
+            s.heater = !s.heater;
+        }
+        if (rng() % 200 == 0) {
+            s.temperature_deci_c = -(long)(rng() % 100000000);
+            s.time_ds += rng() % 100000000;
+        }
+        samples.push_back(s);
+    }
+    return samples;
+}
+
+static bool same(const history_sample &a, const history_sample &b) {
+    return a.time_ds == b.time_ds && a.temperature_deci_c == b.temperature_deci_c &&
+           a.water_centi_inches == b.water_centi_inches && a.heater == b.heater;
+}
+
+// decode every block in order, returns the samples held
+static std::vector<history_sample> decode_all(const SampleHistory &history) {
+    std::vector<history_sample> decoded;
+    history_sample block[SampleHistory::block_size];
+    for (int i = 0; i < history.blocks(); i++) {
+        int length;
+        const char *data = history.block(i, &length);
+        int count = SampleHistory::decode_block(data, length, block, SampleHistory::block_size);
+        BENCH_CHECK(count > 0);
+        // a block cut short ends mid varint
+        BENCH_CHECK(SampleHistory::decode_block(data, length - 1, block, SampleHistory::block_size) == -1);
+        decoded.insert(decoded.end(), block, block + count);
+    }
+    return decoded;
+}
+
+static void check_round_trip() {
+    // a partial block at the end of the buffer is left unused
+    static char buffer[16 * SampleHistory::block_size + 100];
+    SampleHistory history(buffer, sizeof(buffer));
+    std::vector<history_sample> samples = make_samples(20000, 1820);
+    bool evicted = false;
+    for (size_t i = 0; i < samples.size(); i++) {
+        history.add(samples[i]);
+        if (i % 997 == 0 || i + 1 == samples.size()) {
+            std::vector<history_sample> decoded = decode_all(history);
+            BENCH_CHECK(decoded.size() == history.count());
+            BENCH_CHECK(decoded.size() <= i + 1);
+            // the newest samples, oldest first
+            size_t first = i + 1 - decoded.size();
+            for (size_t j = 0; j < decoded.size(); j++) {
+                BENCH_CHECK(same(decoded[j], samples[first + j]));
+            }
+            history_sample oldest, newest;
+            BENCH_CHECK(history.oldest(&oldest) && same(oldest, samples[first]));
+            BENCH_CHECK(history.newest(&newest) && same(newest, samples[i]));
+            BENCH_CHECK(history.size() <= 16 * SampleHistory::block_size);
+            evicted = evicted || first > 0;
+        }
+    }
+    BENCH_CHECK(evicted);
+    BENCH_CHECK(history.blocks() == 16);
+
+    history.clear();
+    history_sample none;
+    BENCH_CHECK(history.count() == 0 && !history.oldest(&none) && !history.newest(&none));
+    std::printf("history round trips %u samples, %d blocks, %d bytes after eviction\n",
+                (unsigned)samples.size(), 16, (int)sizeof(buffer));
+}
+
+int main() {
+    check_round_trip();
+
+    static char buffer[64 * SampleHistory::block_size];
+    SampleHistory history(buffer, sizeof(buffer));
+    std::vector<history_sample> samples = make_samples(4096, 1);
+    run_benchmark("history/add", [&](long iterations) {
+        for (long i = 0; i < iterations; i++) {
+            history.add(samples[i % samples.size()]);
+        }
+        do_not_optimize(history.count());
+    });
+
+    std::vector<history_sample> decoded(SampleHistory::block_size);
+    double block_ns = run_benchmark("history/decode_block", [&](long iterations) {
+        for (long i = 0; i < iterations; i++) {
+            int length;
+            const char *data = history.block(i % history.blocks(), &length);
+            do_not_optimize(SampleHistory::decode_block(data, length, &decoded[0], decoded.size()));
+        }
+    });
+    std::printf("%.2f samples per block, %.2f ns per sample\n",
+                (double)history.count() / history.blocks(),
+                block_ns * history.blocks() / history.count());
+    return bench_report("history_bench");
+}
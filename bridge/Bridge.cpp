@@ -0,0 +1,691 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "Bridge.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "../Commands.h"
+#include "../Protocol.h"
+
+static long long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// The command handlers, for the client line being dispatched: the bridge
+// parses client lines with the firmware's own command table, so only
+// valid commands reach the controller, and each decides what to do here.
+
+enum client_action {
+    // answer from the cached status
+    action_status,
+    // forward, the controller replies with one line
+    action_forward,
+    // forward, the controller doesn't reply
+    action_forward_no_reply,
+    action_subscribe,
+    // the reply is more than one line, which can't be routed
+    action_unsupported
+};
+
+static client_action dispatched_action;
+static int dispatched_value;
+
+void command_status(int) { dispatched_action = action_status; }
+void command_temperature(int) { dispatched_action = action_forward; }
+void command_water_level(int) { dispatched_action = action_forward; }
+void command_serial_errors(int) { dispatched_action = action_forward; }
+void command_idle(int) { dispatched_action = action_forward; }
+void command_tasks(int) { dispatched_action = action_forward; }
+void command_history(int) { dispatched_action = action_forward; }
+void command_profile(int) { dispatched_action = action_unsupported; }
+void command_brew(int) { dispatched_action = action_forward; }
+void command_control(int) { dispatched_action = action_forward; }
+void command_reset(int) { dispatched_action = action_forward_no_reply; }
+void command_subscribe(int value) {
+    dispatched_action = action_subscribe;
+    dispatched_value = value;
+}
+
+// parse a status line, "W+%.2f,T+%.1f,B+%d"
+static bool parse_status(const std::string &line, long *water, long *temperature, int *heater) {
+    double w, t;
+    int end = -1;
+    if (sscanf(line.c_str(), "W+%lf,T+%lf,B+%d%n", &w, &t, heater, &end) != 3
+        || end != (int)line.size()) {
+        return false;
+    }
+    *water = (long)(w * 100 + (w < 0 ? -0.5 : 0.5));
+    *temperature = (long)(t * 10 + (t < 0 ? -0.5 : 0.5));
+    return true;
+}
+
+Bridge::Bridge(const char *device_path, const char *socket_path, int poll_ms)
+    : device_path(device_path), socket_path(socket_path) {
+    this->poll_ms = poll_ms;
+    this->stopping = 0;
+    this->epoll_fd = -1;
+    this->listen_fd = -1;
+    this->device_fd = -1;
+    this->device_discarding = false;
+    this->reopen_at_ms = 0;
+    this->reported_open_failure = false;
+    this->next_client_id = 1;
+    this->in_flight = false;
+    this->reply_due_ms = 0;
+    this->next_poll_ms = 0;
+    this->resyncing = false;
+    this->resync_sequence = 0;
+    this->status_ms = 0;
+    this->start_ms = now_ms();
+    this->polls = 0;
+    this->failed_polls = 0;
+    this->boots = 0;
+}
+
+Bridge::~Bridge() {
+    while (!this->clients.empty()) {
+        this->close_client(this->clients.begin()->second);
+    }
+    if (this->device_fd >= 0) {
+        close(this->device_fd);
+    }
+    if (this->listen_fd >= 0) {
+        close(this->listen_fd);
+        unlink(this->socket_path.c_str());
+    }
+    if (this->epoll_fd >= 0) {
+        close(this->epoll_fd);
+    }
+}
+
+bool Bridge::start() {
+    this->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (this->epoll_fd < 0) {
+        perror("bridge: epoll_create1");
+        return false;
+    }
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (this->socket_path.size() >= sizeof(address.sun_path)) {
+        fprintf(stderr, "bridge: socket path too long: %s\n", this->socket_path.c_str());
+        return false;
+    }
+    strcpy(address.sun_path, this->socket_path.c_str());
+    this->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (this->listen_fd < 0) {
+        perror("bridge: socket");
+        return false;
+    }
+    // a stale socket from a previous run
+    unlink(this->socket_path.c_str());
+    if (bind(this->listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0
+        || listen(this->listen_fd, 64) != 0) {
+        fprintf(stderr, "bridge: can't listen on %s: %s\n", this->socket_path.c_str(), strerror(errno));
+        close(this->listen_fd);
+        this->listen_fd = -1;
+        return false;
+    }
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = this->listen_fd;
+    epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, this->listen_fd, &event);
+    fprintf(stderr, "bridge: serving %s on %s\n", this->device_path.c_str(), this->socket_path.c_str());
+    return true;
+}
+
+void Bridge::run() {
+    struct epoll_event events[32];
+    while (!this->stopping) {
+        this->tick();
+        int count = epoll_wait(this->epoll_fd, events, 32, this->timeout_ms());
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("bridge: epoll_wait");
+            return;
+        }
+        for (int i = 0; i < count; i++) {
+            int fd = events[i].data.fd;
+            if (fd == this->listen_fd) {
+                this->accept_clients();
+            } else if (fd == this->device_fd) {
+                this->read_device();
+            } else {
+                std::map<int, Client *>::iterator found = this->clients.find(fd);
+                // closed by an earlier event in this batch
+                if (found == this->clients.end()) {
+                    continue;
+                }
+                Client *client = found->second;
+                if (events[i].events & EPOLLOUT) {
+                    this->flush(client);
+                }
+                if (this->clients.count(fd) && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                    this->read_client(client);
+                }
+            }
+        }
+    }
+    fprintf(stderr, "bridge: stopped\n");
+}
+
+// the status poll, reply timeouts and reopening the device
+void Bridge::tick() {
+    long long now = now_ms();
+    if (this->device_fd < 0 && now >= this->reopen_at_ms) {
+        this->open_device();
+    }
+    if (this->in_flight && now >= this->reply_due_ms) {
+        if (this->current.client == 0) {
+            this->failed_polls++;
+        }
+        fprintf(stderr, "bridge: no reply to %s\n", this->current.line.c_str());
+        this->reply(this->current, "ERR+TIMEOUT");
+        this->in_flight = false;
+        this->resync();
+    } else if (this->resyncing && now >= this->reply_due_ms) {
+        fprintf(stderr, "bridge: no response to resync %d, retrying\n", this->resync_sequence);
+        this->resync();
+    }
+    if (this->device_fd >= 0 && now >= this->next_poll_ms) {
+        this->next_poll_ms = now + this->poll_ms;
+        // don't pile up polls behind a slow controller
+        bool queued = this->in_flight && this->current.client == 0;
+        for (size_t i = 0; i < this->queue.size() && !queued; i++) {
+            queued = this->queue[i].client == 0;
+        }
+        if (!queued) {
+            Request poll = {Request::forward, 0, -1, "S+?"};
+            this->queue.push_back(poll);
+            this->polls++;
+            this->send_next();
+        }
+    }
+}
+
+// ms until tick() next has something to do
+int Bridge::timeout_ms() {
+    long long now = now_ms();
+    long long next = now + this->poll_ms;
+    if (this->device_fd < 0) {
+        next = this->reopen_at_ms;
+    } else if (this->next_poll_ms < next) {
+        next = this->next_poll_ms;
+    }
+    if ((this->in_flight || this->resyncing) && this->reply_due_ms < next) {
+        next = this->reply_due_ms;
+    }
+    return next > now ? (int)(next - now) : 0;
+}
+
+void Bridge::open_device() {
+    int fd = open(this->device_path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    struct termios settings;
+    if (fd >= 0 && tcgetattr(fd, &settings) == 0) {
+        // 115200 8N1, raw
+        cfmakeraw(&settings);
+        cfsetispeed(&settings, B115200);
+        cfsetospeed(&settings, B115200);
+        settings.c_cflag |= CLOCAL | CREAD;
+        settings.c_cc[VMIN] = 0;
+        settings.c_cc[VTIME] = 0;
+        if (tcsetattr(fd, TCSANOW, &settings) == 0) {
+            // whatever was sent before we were listening
+            tcflush(fd, TCIFLUSH);
+        } else {
+            close(fd);
+            fd = -1;
+        }
+    } else if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+    if (fd < 0) {
+        if (!this->reported_open_failure) {
+            fprintf(stderr, "bridge: can't open %s: %s, retrying\n", this->device_path.c_str(), strerror(errno));
+            this->reported_open_failure = true;
+        }
+        this->reopen_at_ms = now_ms() + reopen_ms;
+        return;
+    }
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    this->device_fd = fd;
+    this->device_input.clear();
+    this->device_discarding = false;
+    this->device_frame.clear();
+    this->reported_open_failure = false;
+    this->next_poll_ms = now_ms();
+    fprintf(stderr, "bridge: opened %s\n", this->device_path.c_str());
+}
+
+void Bridge::close_device(const char *why) {
+    fprintf(stderr, "bridge: lost %s: %s\n", this->device_path.c_str(), why);
+    epoll_ctl(this->epoll_fd, EPOLL_CTL_DEL, this->device_fd, NULL);
+    close(this->device_fd);
+    this->device_fd = -1;
+    this->reopen_at_ms = now_ms() + reopen_ms;
+    // the port is flushed when it is reopened
+    this->resyncing = false;
+    if (this->in_flight) {
+        this->reply(this->current, "ERR+DEVICE");
+        this->in_flight = false;
+    }
+    while (!this->queue.empty()) {
+        Request request = this->queue.front();
+        this->queue.pop_front();
+        if (request.type == Request::forward) {
+            this->reply(request, "ERR+DEVICE");
+        } else if (request.type != Request::forward_no_reply) {
+            this->local_reply(request);
+        }
+    }
+}
+
+void Bridge::read_device() {
+    char buffer[512];
+    ssize_t length = read(this->device_fd, buffer, sizeof(buffer));
+    if (length < 0 && (errno == EAGAIN || errno == EINTR)) {
+        return;
+    }
+    if (length <= 0) {
+        this->close_device(length == 0 ? "end of file" : strerror(errno));
+        return;
+    }
+    for (ssize_t i = 0; i < length; i++) {
+        char c = buffer[i];
+        // binary frames end with a zero, the bridge only asks for them to
+        // resync, see device_frame_end(), the lines their bytes make are
+        // dropped while resyncing
+        if (c == '\n' || c == '\0') {
+            if (!this->device_discarding && !this->device_input.empty()) {
+                this->device_line(this->device_input);
+            }
+            this->device_input.clear();
+            this->device_discarding = false;
+        } else if (c != '\r' && !this->device_discarding) {
+            this->device_input += c;
+            if (this->device_input.size() > max_device_line) {
+                this->device_discarding = true;
+            }
+        }
+        if (c == '\0') {
+            this->device_frame_end();
+        } else {
+            this->device_frame += c;
+            if (this->device_frame.size() > FRAME_MAX_ENCODED) {
+                this->device_frame.erase(0, 1);
+            }
+        }
+    }
+}
+
+void Bridge::device_line(const std::string &line) {
+    status parsed;
+    bool is_status = parse_status(line, &parsed.water_hundredths, &parsed.temperature_tenths,
+                                  &parsed.heater);
+    if (is_status) {
+        this->update_status(line, parsed);
+    }
+    if (line.compare(0, 11, "MrCoffeeBot") == 0) {
+        this->boots++;
+        fprintf(stderr, "bridge: controller booted: %s\n", line.c_str());
+        // nothing sent before the reset will be answered now
+        if (this->resyncing) {
+            this->resyncing = false;
+            this->send_next();
+        }
+        return;
+    }
+    if (this->resyncing) {
+        // a late reply, or the resync response's bytes
+        return;
+    }
+    if (!this->in_flight) {
+        if (!is_status) {
+            fprintf(stderr, "bridge: unexpected line from the controller: %s\n", line.c_str());
+        }
+        return;
+    }
+    // one request at a time, so this is its reply
+    this->reply(this->current, line);
+    this->in_flight = false;
+    this->send_next();
+}
+
+// write the next queued request to the controller, if none is in flight
+void Bridge::send_next() {
+    while (!this->in_flight && !this->resyncing && !this->queue.empty() && this->device_fd >= 0) {
+        Request request = this->queue.front();
+        this->queue.pop_front();
+        if (request.type == Request::local_reply || request.type == Request::local_status) {
+            this->local_reply(request);
+            continue;
+        }
+        std::string line = request.line + "\n";
+        // a line always fits in the tty's buffer with one in flight
+        if (write(this->device_fd, line.data(), line.size()) != (ssize_t)line.size()) {
+            if (request.type == Request::forward) {
+                this->reply(request, "ERR+DEVICE");
+            }
+            this->close_device(strerror(errno));
+            return;
+        }
+        if (request.type == Request::forward) {
+            this->current = request;
+            this->in_flight = true;
+            this->reply_due_ms = now_ms() + reply_timeout_ms;
+        }
+    }
+}
+
+// ask for the status with a binary frame, its response echoes the sequence
+// number, so unlike a text reply it can't be mistaken for a late one
+void Bridge::resync() {
+    if (this->device_fd < 0) {
+        return;
+    }
+    this->resync_sequence++;
+    // requests start with a zero byte
+    char frame[1 + FRAME_MAX_ENCODED];
+    frame[0] = '\0';
+    int length = 1 + frame_encode(FRAME_STATUS_REQUEST, (char)this->resync_sequence, NULL, 0, frame + 1);
+    if (write(this->device_fd, frame, length) != length) {
+        this->close_device(strerror(errno));
+        return;
+    }
+    this->resyncing = true;
+    this->reply_due_ms = now_ms() + reply_timeout_ms;
+}
+
+// a zero byte from the controller, ending a frame in device_frame's last bytes.
+// frames may contain newlines, so every start is tried, the CRC and the
+// sequence number rule out text
+void Bridge::device_frame_end() {
+    if (this->resyncing) {
+        char payload[FRAME_MAX_PAYLOAD];
+        for (size_t start = 0; start < this->device_frame.size(); start++) {
+            char type, sequence;
+            int length = frame_decode(this->device_frame.data() + start,
+                                      this->device_frame.size() - start, &type, &sequence, payload);
+            if (length == FRAME_STATUS_PAYLOAD_SIZE && type == (char)FRAME_STATUS
+                && sequence == (char)this->resync_sequence) {
+                fprintf(stderr, "bridge: resynced\n");
+                this->resyncing = false;
+                this->send_next();
+                break;
+            }
+        }
+    }
+    this->device_frame.clear();
+}
+
+// send the reply to a request to its client, if it is still connected
+void Bridge::reply(const Request &request, const std::string &line) {
+    std::map<int, Client *>::iterator found = this->clients.find(request.fd);
+    if (found != this->clients.end() && found->second->id == request.client) {
+        found->second->outstanding--;
+        this->send_to(found->second, line);
+    }
+}
+
+void Bridge::local_reply(const Request &request) {
+    this->reply(request, request.type == Request::local_status ? this->status_reply() : request.line);
+}
+
+// the cached status, as long as it is fresh enough to trust, a few polls
+// may fail before it isn't
+std::string Bridge::status_reply() {
+    if (this->status_line.empty()
+        || now_ms() - this->status_ms > 3 * (long long)this->poll_ms + reply_timeout_ms) {
+        return "ERR+STALE";
+    }
+    return this->status_line;
+}
+
+// cache a status line from the controller, and push it to subscribers
+void Bridge::update_status(const std::string &line, const status &parsed) {
+    long long now = now_ms();
+    this->status_line = line;
+    this->cached = parsed;
+    this->status_ms = now;
+    // sending may drop slow clients
+    std::vector<int> fds;
+    for (std::map<int, Client *>::iterator i = this->clients.begin(); i != this->clients.end(); ++i) {
+        fds.push_back(i->first);
+    }
+    for (size_t i = 0; i < fds.size(); i++) {
+        std::map<int, Client *>::iterator found = this->clients.find(fds[i]);
+        if (found == this->clients.end()) {
+            continue;
+        }
+        Client *client = found->second;
+        if (client->interval_ms == 0 && client->threshold == 0) {
+            continue;
+        }
+        bool due = client->interval_ms > 0 && now - client->last_push_ms >= client->interval_ms;
+        bool changed = client->threshold > 0
+            && (labs(parsed.water_hundredths - client->last_pushed.water_hundredths) >= client->threshold
+                || labs(parsed.temperature_tenths - client->last_pushed.temperature_tenths) >= client->threshold
+                || parsed.heater != client->last_pushed.heater);
+        if (!due && !changed) {
+            continue;
+        }
+        char suffix[48];
+        snprintf(suffix, sizeof(suffix), ",N+%u,M+%lld", client->sequence++, now - this->start_ms);
+        client->last_push_ms = now;
+        client->last_pushed = parsed;
+        this->send_to(client, line + suffix);
+    }
+}
+
+void Bridge::accept_clients() {
+    while (true) {
+        int fd = accept4(this->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EINTR) {
+                perror("bridge: accept");
+            }
+            return;
+        }
+        Client *client = new Client();
+        client->fd = fd;
+        client->id = this->next_client_id++;
+        client->outstanding = 0;
+        client->discarding = false;
+        client->writing = false;
+        client->interval_ms = 0;
+        client->threshold = 0;
+        client->last_push_ms = 0;
+        client->last_pushed = this->cached;
+        client->sequence = 0;
+        this->clients[fd] = client;
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    }
+}
+
+void Bridge::read_client(Client *client) {
+    char buffer[512];
+    ssize_t length = recv(client->fd, buffer, sizeof(buffer), 0);
+    if (length < 0 && (errno == EAGAIN || errno == EINTR)) {
+        return;
+    }
+    if (length <= 0) {
+        this->close_client(client);
+        return;
+    }
+    int fd = client->fd;
+    for (ssize_t i = 0; i < length; i++) {
+        char c = buffer[i];
+        if (c == '\n') {
+            std::string line;
+            line.swap(client->input);
+            bool overlong = client->discarding;
+            client->discarding = false;
+            if (overlong) {
+                this->answer(client, Request::local_reply, "ERR+OVERLONG");
+            } else if (!line.empty()) {
+                this->client_line(client, line);
+            }
+            // replying may have dropped a slow client
+            if (!this->clients.count(fd)) {
+                return;
+            }
+        } else if (c != '\r' && !client->discarding) {
+            client->input += c;
+            if (client->input.size() > max_client_line) {
+                client->input.clear();
+                client->discarding = true;
+            }
+        }
+    }
+}
+
+void Bridge::client_line(Client *client, const std::string &line) {
+    // the bridge's own stats: status age ms, device open, clients, polls,
+    // failed polls, controller boots seen
+    if (line == "A+?") {
+        char stats[128];
+        snprintf(stats, sizeof(stats), "A+%lld,D+%d,C+%d,P+%lu,F+%lu,R+%lu",
+                 this->status_line.empty() ? -1 : now_ms() - this->status_ms,
+                 this->device_fd >= 0 ? 1 : 0, (int)this->clients.size(),
+                 this->polls, this->failed_polls, this->boots);
+        this->answer(client, Request::local_reply, stats);
+        return;
+    }
+    if (dispatch_command(line.data(), line.size()) < 0) {
+        this->answer(client, Request::local_reply, "ERR+INVALID");
+        return;
+    }
+    switch (dispatched_action) {
+    case action_subscribe:
+        client->interval_ms = SUBSCRIPTION_INTERVAL(dispatched_value);
+        client->threshold = SUBSCRIPTION_THRESHOLD(dispatched_value);
+        client->last_push_ms = now_ms();
+        client->last_pushed = this->cached;
+        client->sequence = 0;
+        // replies with the status, as the controller does
+        // fall through
+    case action_status:
+        this->answer(client, Request::local_status, "");
+        break;
+    case action_forward:
+        this->answer(client, Request::forward, line);
+        break;
+    case action_forward_no_reply:
+        this->answer(client, Request::forward_no_reply, line);
+        break;
+    case action_unsupported:
+        this->answer(client, Request::local_reply, "ERR+UNSUPPORTED");
+        break;
+    }
+}
+
+// reply to or forward a client's line, in order with its earlier lines
+void Bridge::answer(Client *client, Request::kind type, const std::string &line) {
+    Request request = {type, client->id, client->fd, line};
+    bool forward = type == Request::forward || type == Request::forward_no_reply;
+    if (forward && (this->device_fd < 0 || this->queue.size() >= max_queued)) {
+        request.type = Request::local_reply;
+        request.line = this->device_fd < 0 ? "ERR+DEVICE" : "ERR+BUSY";
+        forward = false;
+    }
+    if (request.type != Request::forward_no_reply) {
+        client->outstanding++;
+    }
+    // nothing ahead of it to wait for
+    if (!forward && client->outstanding == 1) {
+        this->local_reply(request);
+        return;
+    }
+    if (client->outstanding > max_queued) {
+        fprintf(stderr, "bridge: dropping a client that isn't waiting for replies\n");
+        this->close_client(client);
+        return;
+    }
+    this->queue.push_back(request);
+    this->send_next();
+}
+
+void Bridge::send_to(Client *client, const std::string &line) {
+    client->output += line;
+    client->output += '\n';
+    this->flush(client);
+}
+
+// write as much of a client's output as it will take, and wait for it to
+// take the rest
+void Bridge::flush(Client *client) {
+    while (!client->output.empty()) {
+        ssize_t sent = send(client->fd, client->output.data(), client->output.size(), MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN) {
+                this->close_client(client);
+                return;
+            }
+            break;
+        }
+        client->output.erase(0, sent);
+    }
+    if (client->output.size() > max_client_output) {
+        fprintf(stderr, "bridge: dropping a client that isn't reading\n");
+        this->close_client(client);
+        return;
+    }
+    bool writing = !client->output.empty();
+    if (writing != client->writing) {
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN | (writing ? EPOLLOUT : 0);
+        event.data.fd = client->fd;
+        epoll_ctl(this->epoll_fd, EPOLL_CTL_MOD, client->fd, &event);
+        client->writing = writing;
+    }
+}
+
+void Bridge::close_client(Client *client) {
+    epoll_ctl(this->epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+    this->clients.erase(client->fd);
+    delete client;
+}
@@ -0,0 +1,177 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef BRIDGE_H
+#define BRIDGE_H
+
+#include <signal.h>
+
+#include <deque>
+#include <map>
+#include <string>
+
+// Bridge owns the serial link to the controller and shares it between any
+// number of local clients connected to a Unix socket, speaking the same
+// text protocol as the controller (see README.md).
+//
+// The bridge polls the status itself, which keeps the controller's
+// watchdog fed, and answers S+? from the latest status rather than asking
+// the controller again. Other commands are forwarded one at a time and the
+// reply is routed back to the client that sent it. Everything runs on one
+// thread from an epoll loop.
+//
+// After a reply times out it may still arrive, and would be taken for the
+// next request's. So the bridge resynchronises first: it sends a binary
+// status request (Protocol.h), drops every line until the response echoing
+// its sequence number, and only then sends the next request.
+class Bridge {
+public:
+    // poll_ms is how often to ask for the status, which must be well under
+    // the controller's 5 second watchdog timeout
+    Bridge(const char *device_path, const char *socket_path, int poll_ms);
+    ~Bridge();
+
+    // listen on the socket, returns false if that fails
+    bool start();
+
+    // serve clients until stop(), the device is (re)opened as needed
+    void run();
+
+    // safe to call from a signal handler
+    void stop() {
+        this->stopping = 1;
+    }
+
+private:
+    // the status line's values, in the line's last digit
+    struct status {
+        long water_hundredths;
+        long temperature_tenths;
+        int heater;
+    };
+
+    struct Client {
+        int fd;
+        // fds are reused, replies are routed by id
+        unsigned long id;
+        // requests queued / in flight, replies to later lines wait for them
+        int outstanding;
+        std::string input;
+        bool discarding;
+        std::string output;
+        // waiting for the socket to take more output
+        bool writing;
+        // U+ subscription, both 0 when not subscribed
+        int interval_ms;
+        int threshold;
+        long long last_push_ms;
+        status last_pushed;
+        unsigned sequence;
+    };
+
+    // a line for the controller, or a reply from the bridge itself that
+    // must wait for the client's requests ahead of it.
+    // client 0 is the bridge's own status poll
+    struct Request {
+        enum kind {
+            // the controller replies with one line
+            forward,
+            // the controller doesn't reply
+            forward_no_reply,
+            // line is the reply
+            local_reply,
+            // the cached status is the reply
+            local_status
+        };
+        kind type;
+        unsigned long client;
+        int fd;
+        std::string line;
+    };
+
+    enum {
+        // replies normally take a few ms, but the controller may be busy
+        // reading the probes
+        reply_timeout_ms = 1000,
+        reopen_ms = 1000,
+        max_queued = 64,
+        max_client_line = 64,
+        max_device_line = 256,
+        // more unsent output than this and a client is too slow, dropped
+        max_client_output = 64 * 1024
+    };
+
+    std::string device_path;
+    std::string socket_path;
+    int poll_ms;
+    volatile sig_atomic_t stopping;
+
+    int epoll_fd;
+    int listen_fd;
+    int device_fd;
+    std::string device_input;
+    bool device_discarding;
+    // the last bytes since a frame's terminating zero, to find resync responses in
+    std::string device_frame;
+    long long reopen_at_ms;
+    bool reported_open_failure;
+
+    std::map<int, Client *> clients;
+    unsigned long next_client_id;
+
+    std::deque<Request> queue;
+    bool in_flight;
+    Request current;
+    long long reply_due_ms;
+    long long next_poll_ms;
+    // waiting for the response to the status request with resync_sequence,
+    // until reply_due_ms
+    bool resyncing;
+    unsigned char resync_sequence;
+
+    std::string status_line;
+    status cached;
+    long long status_ms;
+
+    long long start_ms;
+    unsigned long polls;
+    unsigned long failed_polls;
+    unsigned long boots;
+
+    void open_device();
+    void close_device(const char *why);
+    void read_device();
+    void device_line(const std::string &line);
+    void send_next();
+    void resync();
+    void device_frame_end();
+    void reply(const Request &request, const std::string &line);
+    void local_reply(const Request &request);
+
+    void accept_clients();
+    void read_client(Client *client);
+    void client_line(Client *client, const std::string &line);
+    void answer(Client *client, Request::kind type, const std::string &line);
+    void send_to(Client *client, const std::string &line);
+    void flush(Client *client);
+    void close_client(Client *client);
+
+    std::string status_reply();
+    void update_status(const std::string &line, const status &parsed);
+    void tick();
+    int timeout_ms();
+};
+
+#endif
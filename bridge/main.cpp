@@ -0,0 +1,78 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+    The bridge daemon, see Bridge.h, built and run on a Linux host with
+    ./build.py bridge <serial device> <socket path>, never on the mbed.
+*/
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "Bridge.h"
+
+static Bridge *bridge = NULL;
+
+static void on_signal(int) {
+    if (bridge) {
+        bridge->stop();
+    }
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-p <poll ms>] <serial device> <socket path>\n", name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    int poll_ms = 1000;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:")) != -1) {
+        switch (opt) {
+        case 'p':
+            poll_ms = atoi(optarg);
+            // the controller resets itself after 5s without a valid command
+            if (poll_ms <= 0 || poll_ms > 2500) {
+                fprintf(stderr, "%s: the poll interval must be 1 - 2500 ms\n", argv[0]);
+                exit(2);
+            }
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (argc - optind != 2) {
+        usage(argv[0]);
+    }
+
+    Bridge instance(argv[optind], argv[optind + 1], poll_ms);
+    bridge = &instance;
+    // interrupt epoll_wait rather than restarting it
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    if (!instance.start()) {
+        return 1;
+    }
+    instance.run();
+    return 0;
+}
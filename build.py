@@ -15,16 +15,202 @@ See the License for the specific language governing permissions and
 limitations under the License.
 """
 from __future__ import print_function
-from subprocess import call
+from subprocess import call, check_output, CalledProcessError
+import datetime
+import glob
+import json
+import platform
 import sys
 import os
 
-def call_and_echo(*args):
+# host side benchmarks, built with the host compiler into BUILD/host
+# these live outside the firmware and are excluded by .mbedignore
+BENCHMARKS = {
+    "command_bench": ["bench/command_bench.cpp", "Commands.cpp"],
+    "crc8_bench": ["bench/crc8_bench.cpp", "CRC8.cpp"],
+    "format_bench": ["bench/format_bench.cpp", "Format.cpp"],
+    "history_bench": ["bench/history_bench.cpp"],
+}
+HOST_BUILD_DIR = os.path.join("BUILD", "host")
+HOST_CXXFLAGS = ["-std=c++11", "-O2", "-Wall"]
+
+# the firmware built for the host against the simulated hardware in sim/,
+# (sim/firmware.cpp includes main.cpp) see sim/World.h for the scripts it runs
+SIM_CXXFLAGS = ["-Isim"]
+
+def firmware_sources():
+    return sorted(f for f in glob.glob("*.cpp") if f != "main.cpp")
+
+def sim_sources():
+    return sorted(glob.glob(os.path.join("sim", "*.cpp")) + firmware_sources())
+
+# sim/ without the firmware and its main(), plus the firmware sources
+# sim/ uses itself (to decode frames)
+def sim_hardware_sources():
+    skip = [os.path.join("sim", "main.cpp"), os.path.join("sim", "firmware.cpp")]
+    sim = [f for f in glob.glob(os.path.join("sim", "*.cpp")) if f not in skip]
+    return sorted(sim + ["CRC8.cpp", "Protocol.cpp"])
+
+# benchmarks of code that needs mbed, built against sim/ like the simulator
+SIM_BENCHMARKS = {
+    "driver_bench": ["bench/driver_bench.cpp", "DS1820.cpp", "OneWire.cpp", "OneWireTransport.cpp"],
+    "firmware_bench": ["bench/firmware_bench.cpp", "sim/firmware.cpp"] + firmware_sources(),
+}
+
+# the host daemon sharing the serial link between clients, see bridge/Bridge.h
+BRIDGE_SOURCES = ["CRC8.cpp", "Commands.cpp", "Protocol.cpp"] + sorted(glob.glob(os.path.join("bridge", "*.cpp")))
+
+# recording serial sessions and replaying them against the firmware built
+# against sim/, see replay/replay.cpp
+RECORD_SOURCES = ["replay/record.cpp", "replay/Capture.cpp"]
+REPLAY_SOURCES = ["replay/replay.cpp", "replay/Capture.cpp", "replay/Session.cpp", "sim/firmware.cpp"] + firmware_sources()
+
+# bench-compare flags benchmarks this much slower than the baseline
+REGRESSION_THRESHOLD = 0.10
+
+def call_and_echo(*args, **kwargs):
     print("Calling: ", *args)
-    call(*args)
+    return call(*args, **kwargs)
+
+def build_host(name, sources, flags=[]):
+    if not os.path.isdir(HOST_BUILD_DIR):
+        os.makedirs(HOST_BUILD_DIR)
+    binary = os.path.join(HOST_BUILD_DIR, name)
+    cxx = os.environ.get("CXX", "c++")
+    if call_and_echo([cxx] + HOST_CXXFLAGS + flags + sources + ["-o", binary]) != 0:
+        sys.exit("failed to build " + name)
+    return binary
+
+def bench_context():
+    cxx = os.environ.get("CXX", "c++")
+    compiler = check_output([cxx, "--version"]).decode().splitlines()[0]
+    try:
+        revision = check_output(["git", "describe", "--always", "--dirty"]).decode().strip()
+    except (OSError, CalledProcessError):
+        revision = "unknown"
+    return {
+        "date": datetime.datetime.now().isoformat(),
+        "host_name": platform.node(),
+        "revision": revision,
+        "compiler": compiler,
+        "flags": " ".join(HOST_CXXFLAGS),
+    }
+
+# build and run every benchmark, then with a json path merge their results
+# there, named <benchmark binary>/<benchmark>
+def bench(json_path):
+    binaries = {}
+    for name in sorted(BENCHMARKS):
+        binaries[name] = build_host(name, BENCHMARKS[name])
+    for name in sorted(SIM_BENCHMARKS):
+        sources = sorted(set(SIM_BENCHMARKS[name] + sim_hardware_sources()))
+        binaries[name] = build_host(name, sources, SIM_CXXFLAGS)
+    results = []
+    for name in sorted(binaries):
+        env = dict(os.environ)
+        output = binaries[name] + ".json"
+        env["BENCH_JSON"] = output
+        if call_and_echo([binaries[name]], env=env) != 0:
+            sys.exit(name + " failed")
+        with open(output) as f:
+            for result in json.load(f)["benchmarks"]:
+                result["name"] = name + "/" + result["name"]
+                results.append(result)
+    if json_path:
+        with open(json_path, "w") as f:
+            json.dump({"context": bench_context(), "benchmarks": results}, f, indent=2)
+            f.write("\n")
+        print("wrote", len(results), "results to", json_path)
+
+# compare two bench --json runs, eg: the last release against this one
+def bench_compare(baseline_path, current_path):
+    with open(baseline_path) as f:
+        baseline = json.load(f)
+    with open(current_path) as f:
+        current = json.load(f)
+    before = dict((r["name"], r["real_time"]) for r in baseline["benchmarks"])
+    regressions = 0
+    print("%-60s %12s %12s %8s" % ("benchmark", "before ns", "after ns", "change"))
+    for result in current["benchmarks"]:
+        name = result["name"]
+        if name not in before:
+            print("%-60s %12s %12.2f %8s" % (name, "-", result["real_time"], "new"))
+            continue
+        change = result["real_time"] / before[name] - 1 if before[name] else 0
+        flag = ""
+        if change > REGRESSION_THRESHOLD:
+            flag = " REGRESSION"
+            regressions += 1
+        print("%-60s %12.2f %12.2f %+7.1f%%%s" % (name, before[name], result["real_time"],
+                                                change * 100, flag))
+    if regressions:
+        sys.exit("%d benchmarks regressed by more than %d%%" % (regressions, REGRESSION_THRESHOLD * 100))
+
+def sim(script, flags=[]):
+    binary = build_host("sim", sim_sources(), SIM_CXXFLAGS + flags)
+    env = dict(os.environ)
+    if script:
+        env["SIM_SCRIPT"] = script
+    print("Calling: ", binary, "with SIM_SCRIPT =", script or "<default>")
+    sys.exit(call([binary], env=env))
+
+def bridge(args):
+    binary = build_host("bridge", BRIDGE_SOURCES)
+    sys.exit(call_and_echo([binary] + args))
+
+def record(args):
+    binary = build_host("record", RECORD_SOURCES)
+    sys.exit(call_and_echo([binary] + args))
+
+def replay(args):
+    script = None
+    if args[:1] == ["--script"] and len(args) >= 2:
+        script = args[1]
+        args = args[2:]
+    sources = sorted(set(REPLAY_SOURCES + sim_hardware_sources()))
+    binary = build_host("replay", sources, SIM_CXXFLAGS)
+    env = dict(os.environ)
+    if script:
+        env["SIM_SCRIPT"] = script
+    sys.exit(call_and_echo([binary] + args, env=env))
 
 def main():
-    call_and_echo(["mbed", "compile", "-t", "GCC_ARM", "-m", "LPC1768"])
+    if sys.argv[1:] == ["bench"]:
+        bench(None)
+        return
+    if sys.argv[1:3] == ["bench", "--json"] and len(sys.argv) == 4:
+        bench(sys.argv[3])
+        return
+    if sys.argv[1:2] == ["bench-compare"] and len(sys.argv) == 4:
+        bench_compare(sys.argv[2], sys.argv[3])
+        return
+    if sys.argv[1:2] == ["sim"]:
+        args = sys.argv[2:]
+        flags = []
+        # the firmware built with --onewire-uart, see main()
+        if args[:1] == ["--onewire-uart"]:
+            flags = ["-DONEWIRE_UART"]
+            args = args[1:]
+        if len(args) <= 1:
+            sim(args[0] if args else None, flags)
+            return
+    if sys.argv[1:2] == ["bridge"]:
+        bridge(sys.argv[2:])
+        return
+    if sys.argv[1:2] == ["record"]:
+        record(sys.argv[2:])
+        return
+    if sys.argv[1:2] == ["replay"]:
+        replay(sys.argv[2:])
+        return
+    args = ["mbed", "compile", "-t", "GCC_ARM", "-m", "LPC1768"]
+    # compile out the Profiler.h instrumentation
+    if "--no-profiling" in sys.argv[1:]:
+        args += ["-D", "NO_PROFILING"]
+    # run the temperature probes' bus from UART1 rather than bit banging it
+    if "--onewire-uart" in sys.argv[1:]:
+        args += ["-D", "ONEWIRE_UART"]
+    call_and_echo(args)
 
 if __name__ == "__main__":
     main()
\ No newline at end of file
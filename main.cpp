@@ -18,14 +18,33 @@ limitations under the License.
 
 #include "mbed.h"
 
-#include "DS1820.h"
+#include "Commands.h"
+#include "DS1820Bus.h"
+#include "Format.h"
 #include "HCSR04.h"
-#include "RateLimiter.h"
+#include "LineQueue.h"
+#include "OneWire.h"
+#include "OneWireUart.h"
+#include "Profiler.h"
+#include "Protocol.h"
+#include "ResolutionPolicy.h"
+#include "RomStore.h"
+#include "SampleFilter.h"
+#include "SampleHistory.h"
+#include "Scheduler.h"
+#include "SerialTx.h"
+#include "Telemetry.h"
+#include "TemperatureController.h"
+#include "TemperatureSampler.h"
 
 
 // Hardware pinout constants
 // ds1820 temperature probe
 #define TEMPERATURE_PROBE_PIN p8
+// or with -D ONEWIRE_UART, UART1 runs the bus: TX through an open drain
+// buffer to the data line, RX straight to it
+#define TEMPERATURE_PROBE_UART_TX p13
+#define TEMPERATURE_PROBE_UART_RX p14
 // SSR in-line with coffee pot power switch
 #define HEATER_PIN p21
 // hc-sr04 ultrasonic ranger for water level
@@ -35,6 +54,26 @@ limitations under the License.
 #define RESET_PIN p6
 
 
+// Temperature control constants
+// hard limit, the heater is switched off at or above this in any mode
+#define HEATER_CUTOFF_C 105
+// time proportional output window, the heater is on for duty of each
+#define CONTROL_PERIOD_US 1000000
+// readings older than this switch the heater off under control
+#define CONTROL_MAX_SAMPLE_AGE_US 3000000
+// PID gains, heater permille per degree C of error / per degree C-second
+// of error / per degree C per second of change. starting points, tune to the pot
+#define CONTROL_KP 200
+#define CONTROL_KI 2
+#define CONTROL_KD 500
+// probe resolution, see ResolutionPolicy.h: 9 bits while the temperature
+// moves faster than 0.5 C/s over 2s or the heater is at full power,
+// 12 bits after 5s of neither
+#define RESOLUTION_FAST_RATE_DECI_C 5
+#define RESOLUTION_HOLD_MS 5000
+#define RESOLUTION_WINDOW_MS 2000
+
+
 // Watchdog class based on
 // https://developer.mbed.org/cookbook/WatchDog-Timer
 // https://developer.mbed.org/forum/mbed/topic/508/
@@ -43,12 +82,12 @@ limitations under the License.
 class Watchdog {
 public:
     // Load timeout value in watchdog timer and enable
-    void setTimeout(float s) {
+    void setTimeout(int s) {
         // Set CLK src to PCLK
         LPC_WDT->WDCLKSEL = 0x1;
         // WD has a fixed /4 prescaler, PCLK default is /4
         uint32_t clk = SystemCoreClock / 16;
-        LPC_WDT->WDTC = s * (float)clk;
+        LPC_WDT->WDTC = s * clk;
         // Enabled and Reset
         LPC_WDT->WDMOD = 0x3;
         feed();
@@ -64,11 +103,12 @@ public:
 
 // TODO(bentheelder): move this to it's own file(s)
 // manages the heater's state, automatic shutoff, etc
-// requries regularly calling .poll()
+// the shutoff is a Timeout, so it happens on time from interrupt context
+// no matter what the main loop is doing
 class Heater {
 private:
     DigitalOut pin;
-    Timer      sinceLastUserWrite;
+    Timeout    autoDisable;
     int        enableTimeout;
     void (*enableCallback)(void);
     void (*disableCallback)(void);
@@ -90,7 +130,8 @@ private:
 public:
     Heater(PinName heaterPin) : pin(heaterPin) {
         this->pin.write(0);
-        this->sinceLastUserWrite.start();
+        this->enableCallback = NULL;
+        this->disableCallback = NULL;
     }
 
     void setTimeout(int enable_timeout_us) {
@@ -105,44 +146,85 @@ public:
         this->disableCallback = f;
     }
 
-    // call regularly
-    void poll() {
-        if (this->sinceLastUserWrite.read_us() >= this->enableTimeout) {
-            this->disable_internal();
-        }
-    }
-
     // return the heater's state (reads the pin)
     bool read() {
         return this->pin.read();
     }
 
     void disable() {
-        this->sinceLastUserWrite.reset();
+        this->autoDisable.detach();
         this->disable_internal();
     }
 
+    // enable, or keep enabled, for the next timeout
     void enable() {
-        this->sinceLastUserWrite.reset();
+        this->enableFor(this->enableTimeout);
+    }
+
+    // enable, or keep enabled, for the next us
+    void enableFor(int us) {
+        this->autoDisable.attach_us(callback(this, &Heater::disable_internal), us);
         this->enable_internal();
     }
 };
 
 
 // Globals
+// everything runs as events dispatched from this queue on the main thread,
+// posted by interrupts (serial RX, sensor completion) and timers
+EventQueue queue(32 * EVENTS_EVENT_SIZE);
+
+// profiled sections, see send_profile, scheduled tasks have their own
+int profile_rx = PROFILE_SECTION("rx");
+int profile_scheduler = PROFILE_SECTION("scheduler");
+int profile_line = PROFILE_SECTION("line");
+int profile_frame = PROFILE_SECTION("frame");
+int profile_status = PROFILE_SECTION("status");
+
+// periodic / timed work is scheduled here, and run from queue when due
+Scheduler scheduler;
+void run_scheduler() {
+    PROFILE_SCOPE(profile_scheduler);
+    scheduler.run();
+}
+void on_scheduler_wake() {
+    queue.call(run_scheduler);
+}
+
 // device watchdog timer
 Watchdog wdt;
 
 // the coffeepot heater
 Heater heater(HEATER_PIN);
 
-// temperature probe in the base
-DS1820 temp_probe(TEMPERATURE_PROBE_PIN);
-double temperature;
+// the probes' ROM codes, kept in flash so that boot needn't search the bus
+RomStore rom_store;
+// the temperature probes' 1-Wire bus
+#ifdef ONEWIRE_UART
+OneWireUart temp_probe_bus(TEMPERATURE_PROBE_UART_TX, TEMPERATURE_PROBE_UART_RX);
+#else
+OneWire temp_probe_bus(TEMPERATURE_PROBE_PIN);
+#endif
+// temperature probes, the first is in the base
+DS1820Bus temp_probes(&temp_probe_bus, &rom_store);
+// convert + read all probes in the background, back to back
+TemperatureSampler temperature_sampler(&temp_probes, 0);
+ResolutionPolicy resolution_policy(RESOLUTION_FAST_RATE_DECI_C, RESOLUTION_HOLD_MS,
+                                   RESOLUTION_WINDOW_MS);
+FixedDegrees temperature;
+
+// holds a target temperature by driving the heater, when enabled
+TemperatureController temperature_controller(CONTROL_KP, CONTROL_KI, CONTROL_KD,
+                                             FixedDegrees::from_int(HEATER_CUTOFF_C));
 
 // ultrasonic sensor in top of water resevoir
 HCSR04 water_level_sensor(WATER_HCSR04_TRIG_PIN, WATER_HCSR04_ECHO_PIN);
-double water_distance_inches;
+// median of 7 / EMA of 1/4 / Hampel k = 3, ignoring jitter under 0.25",
+// filtering FixedInches raw values
+SampleFilter<long, long long, 7> water_level_filter(2, 3000, FixedInches::from_int(1).raw / 4);
+FixedInches water_distance_inches;
+// readings without an echo, kept out of the filter
+unsigned water_level_timeouts = 0;
 
 // helper to reset the device (uses a pin wired to reset)
 DigitalInOut reset_pin(RESET_PIN);
@@ -151,10 +233,58 @@ void reset() {
 }
 
 // Serial communcation over USB
-Serial pc(USBTX, USBRX);
-// serial receive buffer
-#define RECEIVE_BUFF_SIZE 7*3
-char recv_buff[RECEIVE_BUFF_SIZE];
+// RawSerial, as getc is called from the RX interrupt
+RawSerial pc(USBTX, USBRX);
+// everything sent goes through here, replies are queued and sent by the TX
+// interrupt rather than waited on
+SerialTx serial_tx(&pc);
+// received lines / frames, filled by the RX interrupt
+LineQueue<8, 32> rx_lines;
+void handle_input();
+void on_serial_rx() {
+    PROFILE_SCOPE(profile_rx);
+    bool completed = false;
+    while (pc.readable()) {
+        completed |= rx_lines.push(pc.getc());
+    }
+    if (completed) {
+        queue.call(handle_input);
+    }
+}
+
+// pushes status to a subscribed host, see send_telemetry
+Telemetry telemetry;
+// ms since boot, for telemetry timestamps
+Timer uptime;
+// how often to check if telemetry is due while subscribed,
+// this is also the fastest it can be sent
+#define TELEMETRY_CHECK_US 10000
+
+// sample history, recorded every HISTORY_PERIOD_US into AHB SRAM bank 0,
+// which the firmware doesn't otherwise use (NOLOAD, SampleHistory clears it)
+#define HISTORY_PERIOD_US 2000000
+char history_buffer[16 * 1024] __attribute__((section("AHBSRAM0"), aligned));
+SampleHistory history(history_buffer, sizeof(history_buffer));
+
+// CPU idle time / wakeups, accounted by idle_hook in the RTOS idle thread
+Timer idle_clock;
+volatile unsigned long long idle_us;
+volatile unsigned wakes;
+// idle_us and wakes as of the last I+? reply, and when that was
+unsigned long long reported_idle_us;
+unsigned reported_wakes;
+unsigned long long reported_at_us;
+
+// replaces the RTOS default idle hook, which just sleeps
+void idle_hook() {
+    core_util_critical_section_enter();
+    int start = idle_clock.read_us();
+    sleep();
+    // interrupts run after the critical section, so their time isn't idle
+    idle_us = idle_us + (unsigned)((unsigned)idle_clock.read_us() - (unsigned)start);
+    wakes = wakes + 1;
+    core_util_critical_section_exit();
+}
 
 // For debug only, these are LEDs on the mbed device.
 DigitalOut led1(LED1);
@@ -184,65 +314,624 @@ void heater_enable_callback() {
 
 
 
-// helpers rate limited in main loop to poll sensors
+// advances the temperature sampler, rescheduling itself for when there
+// is next something to do
+int temperature_task;
 void update_temperature() {
-    temp_probe.convertTemperature(false, DS1820::this_device);
-    temperature = temp_probe.temperature();
+    if (temperature_sampler.poll()) {
+        temperature = temperature_sampler.temperature_fixed();
+        if (!(temperature < FixedDegrees::from_int(HEATER_CUTOFF_C))) {
+            heater.disable();
+        }
+        if (temperature != FixedDegrees::from_int(DS1820::invalid_conversion)) {
+            unsigned now_ms = (unsigned)(uptime.read_high_resolution_us() / 1000);
+            // switched on by hand, or the controller asking for all of it
+            bool full_power = heater.read() &&
+                (!temperature_controller.active() || temperature_controller.duty() >= 1000);
+            temperature_sampler.set_resolution(
+                resolution_policy.update(now_ms, temperature.round(1), full_power));
+        }
+    }
+    scheduler.schedule(temperature_task, temperature_sampler.next_poll_us());
 }
 
+// runs update_temperature as soon as a probe bus transaction finishes,
+// rather than waiting out next_poll_us()'s fallback
+void wake_temperature() {
+    scheduler.schedule(temperature_task, 0);
+}
+
+void on_temperature_bus_done() {
+    queue.call(wake_temperature);
+}
+
+// runs the temperature controller once per CONTROL_PERIOD_US while it is
+// active, switching the heater on for the computed duty of the period
+int control_task;
+void update_control() {
+    if (temperature == FixedDegrees::from_int(DS1820::invalid_conversion)
+        || temperature_sampler.sample_age_us() > CONTROL_MAX_SAMPLE_AGE_US) {
+        // no trustworthy reading, fail safe
+        temperature_controller.reset();
+        heater.disable();
+    } else {
+        int duty = temperature_controller.update(temperature, CONTROL_PERIOD_US / 1000);
+        if (duty >= 1000) {
+            // stay on into the next period, which will renew it
+            heater.enableFor(CONTROL_PERIOD_US + CONTROL_PERIOD_US / 10);
+        } else if (duty > 0) {
+            heater.enableFor((long long)CONTROL_PERIOD_US * duty / 1000);
+        } else {
+            heater.disable();
+        }
+    }
+    // the firmware is in control, so it keeps itself alive, if this task
+    // stops running the watchdog still resets it
+    wdt.feed();
+}
+
+// runs every WATER_LEVEL_PERIOD_US
 void update_water_level() {
-    water_distance_inches = water_level_sensor.read_inches();
+    // fire the trigger, the echo is timed in the background, see poll_water_level
+    water_level_sensor.start();
 }
 
-// serial command strings
-#define COMMAND_RESET        "RESET"
-#define COMMAND_STATUS       "S+?"
-#define COMMAND_BREW_ENABLE  "B+1"
-#define COMMAND_BREW_DISABLE "B+0"
+// filters the last finished reading, unless there was no echo in time (eg:
+// the sensor is unplugged), which reports the maximum rather than a level
+void add_water_level_reading() {
+    if (water_level_sensor.last_timed_out()) {
+        water_level_timeouts++;
+        return;
+    }
+    water_level_filter.add(water_level_sensor.last_fixed_inches().raw);
+    water_distance_inches = FixedInches(water_level_filter.value());
+}
 
-// NOTE: if we poll the HCSR04 too fast the readings are useless
-RateLimiter water_level_sensor_rate_limiter(5000, update_water_level);
-RateLimiter temperature_sensor_rate_limiter(5000, update_temperature);
+// picks up water level readings started by update_water_level,
+// posted by the sensor when the echo finishes
+void poll_water_level() {
+    if (water_level_sensor.poll()) {
+        add_water_level_reading();
+    }
+}
 
-// helper method for handling serial commands
-bool starts_with(const char *pre, const char *str) {
-    size_t lenpre = strlen(pre),
-           lenstr = strlen(str);
-    return lenstr < lenpre ? false : strncmp(pre, str, lenpre) == 0;
+void on_water_level_done() {
+    queue.call(poll_water_level);
 }
 
+// NOTE: if we poll the HCSR04 too fast the readings are useless
+#define WATER_LEVEL_PERIOD_US 5000
+// offset from the water level trigger, so they don't run together
+#define TEMPERATURE_PHASE_US 2500
+
+// queue bytes to send, policy is what to do if the TX queue is full,
+// returns false if they were dropped
+bool send_bytes(const char *data, int length,
+                SerialTx::policy policy = SerialTx::policy_block) {
+    return serial_tx.write(data, length, policy);
+}
+
+// replies are formatted with Format.h rather than printf, so that no
+// floating point formatting is linked in
+
 // status of all sensors + heater enable (W = Water, T = Temp, B = BREW)
+// send_status is called for nearly every command,
+// the output is "W+%.2f,T+%.1f,B+%d\n"
 void send_status() {
-    pc.printf("W+%.2f,T+%.1f,B+%d\n", 
-              water_distance_inches, temperature, heater.read() ? 1 : 0);
+    PROFILE_SCOPE(profile_status);
+    char line[STATUS_LINE_MAX];
+    int length = format_status(line,
+                               water_distance_inches.round(2),
+                               temperature.round(1),
+                               heater.read());
+    send_bytes(line, length);
 }
 
-// process_line handles one line of input and returns true if the line
-// was valid / handled and WDT should be reset
-bool process_line() {
-    if (starts_with(COMMAND_STATUS, recv_buff)) {
-        send_status();
+// temperature + age of the reading in ms, the probes' precision in C and
+// samples per second (T = Temp, A = Age, P = Precision, F = Frequency),
+// followed by any other probes on the bus (T1, T2, ...)
+void send_temperature() {
+    char line[128];
+    char *end = format_text(line, "T+");
+    end = format_fixed(end, temperature.round(1), 1);
+    end = format_text(end, ",A+");
+    end = format_int(end, temperature_sampler.sample_age_us() / 1000);
+    // 1/16 C at 12 bits, doubling with each bit less
+    end = format_text(end, ",P+");
+    end = format_fixed(end, 625L << (12 - temperature_sampler.resolution()), 4);
+    end = format_text(end, ",F+");
+    int period_us = temperature_sampler.sample_period_us();
+    end = format_fixed(end, period_us > 0 ? (long)round_divide(10000000LL, period_us) : 0, 1);
+    for (int i = 1; i < temperature_sampler.count(); i++) {
+        end = format_text(end, ",T");
+        end = format_int(end, i);
+        *end++ = '+';
+        end = format_fixed(end, temperature_sampler.temperature_fixed(i).round(1), 1);
+    }
+    *end++ = '\n';
+    send_bytes(line, end - line);
+}
 
-    } else if (starts_with(COMMAND_BREW_ENABLE, recv_buff)) {
-        heater.enable();
-        send_status();
+// filtered water level + variance of the raw readings in the filter window,
+// readings seen, readings rejected as outliers and readings without an echo
+// (W = Water, V = Variance, N = Number, R = Rejected, M = Missed)
+void send_water_level() {
+    // the variance is in raw FixedInches squared, reply in inches squared
+    const long long raw_per_inch = FixedInches::from_int(1).raw;
+    char line[64];
+    char *end = format_text(line, "W+");
+    end = format_fixed(end, water_distance_inches.round(2), 2);
+    end = format_text(end, ",V+");
+    end = format_fixed(end, round_divide(water_level_filter.variance(),
+                                         raw_per_inch * raw_per_inch / 10000), 4);
+    end = format_text(end, ",N+");
+    end = format_int(end, water_level_filter.count());
+    end = format_text(end, ",R+");
+    end = format_int(end, water_level_filter.outliers());
+    end = format_text(end, ",M+");
+    end = format_int(end, water_level_timeouts);
+    *end++ = '\n';
+    send_bytes(line, end - line);
+}
+
+// clamp value to an int16, for binary frames
+int to_fixed16(long value) {
+    if (value > 32767) {
+        return 32767;
+    }
+    if (value < -32768) {
+        return -32768;
+    }
+    return (int)value;
+}
+
+// encode and send a binary frame
+bool send_frame(char type, char sequence, const char *payload, int length,
+                SerialTx::policy policy = SerialTx::policy_block) {
+    char out[FRAME_MAX_ENCODED];
+    int encoded = frame_encode(type, sequence, payload, length, out);
+    return send_bytes(out, encoded, policy);
+}
 
-    } else if (starts_with(COMMAND_BREW_DISABLE, recv_buff)) {
+// manual heater control (B+0/1 and the brew frames),
+// this stops the temperature controller
+void brew(bool enable) {
+    if (temperature_controller.active()) {
+        temperature_controller.disable();
+        scheduler.cancel(control_task);
+    }
+    if (enable && temperature < FixedDegrees::from_int(HEATER_CUTOFF_C)) {
+        heater.enable();
+    } else {
         heater.disable();
-        send_status();
+    }
+}
 
-    } else if (starts_with(COMMAND_RESET, recv_buff)) {
-        reset();
+// binary version of send_status
+void send_status_frame(char sequence) {
+    char payload[FRAME_STATUS_PAYLOAD_SIZE];
+    int length = status_payload(payload,
+                                to_fixed16(water_distance_inches.round(2)),
+                                to_fixed16(temperature.round(1)),
+                                heater.read());
+    send_frame(FRAME_STATUS, sequence, payload, length);
+}
 
+// push a status sample to the subscriber if one is due, runs every
+// TELEMETRY_CHECK_US while subscribed. samples are dropped rather than
+// waiting when the TX queue is full (TX backpressure), they still use up
+// a sequence number.
+int telemetry_task;
+void send_telemetry() {
+    unsigned long now_ms = (unsigned long)(uptime.read_high_resolution_us() / 1000);
+    long water = water_distance_inches.round(2);
+    long temp = temperature.round(1);
+    bool heating = heater.read();
+    if (!telemetry.due(now_ms, water, temp, heating)) {
+        return;
+    }
+    unsigned sequence = telemetry.take(now_ms, water, temp, heating);
+    bool sent;
+    if (telemetry.is_binary()) {
+        char payload[FRAME_TELEMETRY_PAYLOAD_SIZE];
+        int length = telemetry_payload(payload, to_fixed16(water), to_fixed16(temp), heating, now_ms);
+        sent = send_frame(FRAME_TELEMETRY, sequence & 0xFF, payload, length,
+                          SerialTx::policy_drop_newest);
     } else {
+        // the status line, with the sequence number and timestamp
+        // (N = Number, M = Ms since boot)
+        char line[STATUS_LINE_MAX + 24];
+        int length = format_status(line, water, temp, heating) - 1;
+        char *end = format_text(line + length, ",N+");
+        end = format_int(end, sequence);
+        end = format_text(end, ",M+");
+        end = format_int(end, now_ms);
+        *end++ = '\n';
+        sent = send_bytes(line, end - line, SerialTx::policy_drop_newest);
+    }
+    if (!sent) {
+        telemetry.dropped();
+    }
+}
+
+// start / stop pushing status, from U+ or FRAME_SUBSCRIBE
+void subscribe(int interval_ms, long threshold, bool binary) {
+    telemetry.subscribe(interval_ms, threshold, binary);
+    if (telemetry.active()) {
+        scheduler.schedule(telemetry_task, 0);
+    } else {
+        scheduler.cancel(telemetry_task);
+    }
+}
+
+// history dump state, see start_history_dump
+int history_dump_task;
+bool history_dumping;
+int history_dump_block;
+int history_dump_offset;
+unsigned history_dump_frames;
+char history_dump_sequence;
+
+// records the current readings, runs every HISTORY_PERIOD_US
+void record_history() {
+    // the dump reads the blocks in place
+    if (history_dumping) {
+        return;
+    }
+    history_sample sample;
+    sample.time_ds = (unsigned long)(uptime.read_high_resolution_us() / 100000);
+    sample.temperature_deci_c = temperature.round(1);
+    sample.water_centi_inches = water_distance_inches.round(2);
+    sample.heater = heater.read();
+    history.add(sample);
+}
+
+// sends the next frame of a history dump, rescheduling itself straight
+// away until done, so the dump goes out at line rate in between other events.
+// while the TX queue is too full for a frame it checks back every
+// HISTORY_DUMP_RETRY_US instead of waiting on it
+#define HISTORY_DUMP_RETRY_US 2000
+void send_history_chunk() {
+    if (serial_tx.space() < FRAME_MAX_ENCODED) {
+        scheduler.schedule(history_dump_task, HISTORY_DUMP_RETRY_US);
+        return;
+    }
+    if (history_dump_block < history.blocks()) {
+        int length;
+        const char *data = history.block(history_dump_block, &length);
+        char payload[FRAME_MAX_PAYLOAD];
+        payload[0] = history_dump_offset == 0 ? FRAME_HISTORY_FLAG_BLOCK : 0;
+        int n = length - history_dump_offset;
+        if (n > FRAME_HISTORY_MAX_DATA) {
+            n = FRAME_HISTORY_MAX_DATA;
+        }
+        memcpy(payload + 1, data + history_dump_offset, n);
+        send_frame(FRAME_HISTORY, history_dump_frames & 0xFF, payload, n + 1);
+        history_dump_frames++;
+        history_dump_offset += n;
+        if (history_dump_offset >= length) {
+            history_dump_block++;
+            history_dump_offset = 0;
+        }
+        scheduler.schedule(history_dump_task, 0);
+        return;
+    }
+    char payload[FRAME_HISTORY_END_PAYLOAD_SIZE];
+    unsigned samples = history.count();
+    payload[0] = history_dump_frames & 0xFF;
+    payload[1] = (history_dump_frames >> 8) & 0xFF;
+    for (int i = 0; i < 4; i++) {
+        payload[2 + i] = (samples >> (8 * i)) & 0xFF;
+    }
+    send_frame(FRAME_HISTORY_END, history_dump_sequence, payload, sizeof(payload));
+    history_dumping = false;
+}
+
+// start streaming the history as FRAME_HISTORY frames, recording is
+// paused until it is done. returns false if a dump is already running
+bool start_history_dump(char sequence) {
+    if (history_dumping) {
         return false;
     }
-    // if we don't hit the else above, we processed a line
+    history_dumping = true;
+    history_dump_block = 0;
+    history_dump_offset = 0;
+    history_dump_frames = 0;
+    history_dump_sequence = sequence;
+    scheduler.schedule(history_dump_task, 0);
     return true;
 }
 
+// process_frame handles one binary frame (without the zero bytes around it)
+// and returns true if the frame was valid / handled and WDT should be reset
+bool process_frame(const char *frame, int length) {
+    PROFILE_SCOPE(profile_frame);
+    char type, sequence, payload[FRAME_MAX_PAYLOAD];
+    int payload_length = frame_decode(frame, length, &type, &sequence, payload);
+    if (payload_length < 0) {
+        return false;
+    }
+    switch ((unsigned char)type) {
+    case FRAME_STATUS_REQUEST:
+        send_status_frame(sequence);
+        break;
+
+    case FRAME_BREW_ENABLE:
+        brew(true);
+        send_status_frame(sequence);
+        break;
+
+    case FRAME_BREW_DISABLE:
+        brew(false);
+        send_status_frame(sequence);
+        break;
+
+    case FRAME_RESET:
+        reset();
+        break;
+
+    case FRAME_HISTORY_REQUEST:
+        if (!start_history_dump(sequence)) {
+            send_frame(FRAME_ERROR, sequence, &type, 1);
+            return false;
+        }
+        break;
+
+    case FRAME_SUBSCRIBE:
+        if (payload_length < FRAME_SUBSCRIBE_PAYLOAD_SIZE) {
+            send_frame(FRAME_ERROR, sequence, &type, 1);
+            return false;
+        }
+        subscribe((unsigned char)payload[0] | ((unsigned char)payload[1] << 8),
+                  (unsigned char)payload[2] | ((unsigned char)payload[3] << 8), true);
+        send_status_frame(sequence);
+        break;
+
+    default:
+        // unknown type, reply with it so the host knows it was received
+        send_frame(FRAME_ERROR, sequence, &type, 1);
+        return false;
+    }
+    return true;
+}
+
+// serial errors: messages dropped because the receive queue was full and
+// because they were too long, messages dropped because the TX queue was
+// full, writes that waited on it and the most bytes it has held, and of
+// those dropped the subscribed status pushes
+// (O = Overruns, L = overLong, D = Dropped, S = Stalls, F = peak Fill, P = Pushes)
+void send_serial_errors() {
+    char line[80];
+    char *end = format_text(line, "O+");
+    end = format_int(end, rx_lines.overrun_count());
+    end = format_text(end, ",L+");
+    end = format_int(end, rx_lines.overlong_count());
+    end = format_text(end, ",D+");
+    end = format_int(end, serial_tx.dropped());
+    end = format_text(end, ",S+");
+    end = format_int(end, serial_tx.stalls());
+    end = format_text(end, ",F+");
+    end = format_int(end, serial_tx.peak());
+    end = format_text(end, ",P+");
+    end = format_int(end, telemetry.drop_count());
+    *end++ = '\n';
+    send_bytes(line, end - line);
+}
+
+// CPU idle time and wakeups from sleep since the last I+? (or boot),
+// (I = Idle percent, K = waKeups, D = Duration ms)
+void send_idle() {
+    core_util_critical_section_enter();
+    unsigned long long idle = idle_us;
+    unsigned woke = wakes;
+    core_util_critical_section_exit();
+    unsigned long long now = idle_clock.read_high_resolution_us();
+    unsigned long long elapsed = now - reported_at_us;
+    char line[48];
+    char *end = format_text(line, "I+");
+    end = format_fixed(end, elapsed ? (long)round_divide((idle - reported_idle_us) * 1000, elapsed) : 0, 1);
+    end = format_text(end, ",K+");
+    end = format_int(end, woke - reported_wakes);
+    end = format_text(end, ",D+");
+    end = format_int(end, (long)(elapsed / 1000));
+    *end++ = '\n';
+    send_bytes(line, end - line);
+    reported_idle_us = idle;
+    reported_wakes = woke;
+    reported_at_us = now;
+}
+
+// temperature controller target and heater duty, both 0 if it is off
+// (C = Control target, P = Power percent)
+void send_control() {
+    bool active = temperature_controller.active();
+    char line[32];
+    char *end = format_text(line, "C+");
+    end = format_fixed(end, active ? temperature_controller.target().round(1) : 0, 1);
+    end = format_text(end, ",P+");
+    end = format_fixed(end, active ? temperature_controller.duty() : 0, 1);
+    *end++ = '\n';
+    send_bytes(line, end - line);
+}
+
+// sample history summary: samples held, the time they span in seconds
+// and bytes used (H = History, S = Span, F = Filled)
+void send_history() {
+    history_sample oldest, newest;
+    long span_ds = 0;
+    if (history.oldest(&oldest) && history.newest(&newest)) {
+        span_ds = newest.time_ds - oldest.time_ds;
+    }
+    char line[48];
+    char *end = format_text(line, "H+");
+    end = format_int(end, history.count());
+    end = format_text(end, ",S+");
+    end = format_fixed(end, span_ds, 1);
+    end = format_text(end, ",F+");
+    end = format_int(end, history.size());
+    *end++ = '\n';
+    send_bytes(line, end - line);
+}
+
+// profiled section timings, a line with the number of sections and the
+// tick rate (P = Profile, F = Frequency Hz, cycles or us), then a line per
+// section: <name>+<count>/<min>/<avg>/<max> in ticks, followed by
+// ,<bucket>:<count> for each non empty log2 histogram bucket, where bucket
+// b counts times of 2^b to 2^(b+1) - 1 ticks
+void send_profile() {
+#ifdef NO_PROFILING
+    send_bytes("P+0,F+0\n", 8);
+#else
+    char line[24 + Profiler::buckets * 16];
+    char *end = format_text(line, "P+");
+    end = format_int(end, profiler.count());
+    end = format_text(end, ",F+");
+    end = format_int(end, Profiler::frequency());
+    *end++ = '\n';
+    send_bytes(line, end - line);
+    for (int i = 0; i < profiler.count(); i++) {
+        const Profiler::section &s = profiler.get(i);
+        end = format_text(line, s.name);
+        *end++ = '+';
+        end = format_int(end, s.count);
+        *end++ = '/';
+        end = format_int(end, s.min);
+        *end++ = '/';
+        end = format_int(end, s.count ? (long)(s.total / s.count) : 0);
+        *end++ = '/';
+        end = format_int(end, s.max);
+        for (int b = 0; b < Profiler::buckets; b++) {
+            if (s.histogram[b]) {
+                *end++ = ',';
+                end = format_int(end, b);
+                *end++ = ':';
+                end = format_int(end, s.histogram[b]);
+            }
+        }
+        *end++ = '\n';
+        send_bytes(line, end - line);
+    }
+#endif
+}
+
+// scheduler task stats: the number of tasks, then for each task its runs,
+// worst latency in us and overruns (Q = Queue, <name>+<runs>/<latency>/<overruns>)
+void send_tasks() {
+    // a name, 3 numbers and separators per task
+    char line[8 + Scheduler::max_tasks * 40];
+    char *end = format_text(line, "Q+");
+    end = format_int(end, scheduler.count());
+    for (int i = 0; i < scheduler.count(); i++) {
+        const Scheduler::task_stats &stats = scheduler.stats(i);
+        *end++ = ',';
+        end = format_text(end, scheduler.name(i));
+        *end++ = '+';
+        end = format_int(end, stats.runs);
+        *end++ = '/';
+        end = format_int(end, stats.worst_latency_us);
+        *end++ = '/';
+        end = format_int(end, stats.overruns);
+    }
+    *end++ = '\n';
+    send_bytes(line, end - line);
+}
+
+// command handlers, see Commands.h
+void command_status(int) {
+    send_status();
+}
+
+void command_temperature(int) {
+    send_temperature();
+}
+
+void command_water_level(int) {
+    send_water_level();
+}
+
+void command_serial_errors(int) {
+    send_serial_errors();
+}
+
+void command_brew(int enable) {
+    brew(enable);
+    send_status();
+}
+
+// target temperature in tenths of a degree C, 0 to stop, -1 to query
+void command_control(int target_tenths) {
+    if (target_tenths == 0) {
+        if (temperature_controller.active()) {
+            temperature_controller.disable();
+            scheduler.cancel(control_task);
+            heater.disable();
+        }
+    } else if (target_tenths > 0) {
+        bool was_active = temperature_controller.active();
+        if (temperature_controller.set_target(FixedDegrees(target_tenths * 1000L)) && !was_active) {
+            scheduler.schedule(control_task, 0);
+        }
+    }
+    send_control();
+}
+
+void command_reset(int) {
+    reset();
+}
+
+void command_idle(int) {
+    send_idle();
+}
+
+void command_tasks(int) {
+    send_tasks();
+}
+
+void command_history(int) {
+    send_history();
+}
+
+void command_profile(int) {
+    send_profile();
+}
+
+// replies with the current status, then pushes samples as subscribed
+void command_subscribe(int value) {
+    subscribe(SUBSCRIPTION_INTERVAL(value), SUBSCRIPTION_THRESHOLD(value), false);
+    send_status();
+}
+
+// process_line handles one line of input and returns true if the line
+// was valid / handled and WDT should be reset
+bool process_line(const char *line, int length) {
+    PROFILE_SCOPE(profile_line);
+    int flags = dispatch_command(line, length);
+    return flags >= 0 && (flags & COMMAND_FEEDS_WATCHDOG);
+}
+
+// handle input, lines and frames are split up by the RX interrupt,
+// posted by it when it completes one
+void handle_input() {
+    const char *line;
+    int length;
+    bool frame;
+    while (rx_lines.front(&line, &length, &frame)) {
+        bool valid = frame ? process_frame(line, length)
+                           : process_line(line, length);
+        // and feed the watchdog if we process a legitimate line / frame
+        if (valid) {
+            wdt.feed();
+            // debug feeding watchdog
+            led1_toggle();
+        }
+        rx_lines.pop();
+    }
+}
+
 // main() runs in its own thread in mbed-OS
 int main() {
+    uptime.start();
+
     // init heater
     heater.setDisableCallback(heater_disble_callback);
     heater.setEnableCallback(heater_enable_callback);
@@ -251,54 +940,39 @@ int main() {
     heater.disable();
 
     // init various vars
-    memset(recv_buff, 0, RECEIVE_BUFF_SIZE);
-    water_distance_inches = std::numeric_limits<double>::max();
-    temperature = std::numeric_limits<double>::max();
+    water_distance_inches = FixedInches(std::numeric_limits<long>::max());
+    temperature = FixedDegrees(std::numeric_limits<long>::max());
 
     // Initialization, set up watchdog, serial, etc.
     pc.baud(115200);
-    pc.printf("MrCoffeeBot v2.0 Booted.\n");
+    pc.attach(&on_serial_rx, RawSerial::RxIrq);
+    const char banner[] = "MrCoffeeBot v2.0 Booted.\n";
+    send_bytes(banner, sizeof(banner) - 1);
     // 5 second timeout before rebooting
     // WDT is fed when handling a valid command
     wdt.setTimeout(5);
 
     // update sensors once before main loop
-    water_level_sensor_rate_limiter.ignore_limit_and_call();
-    temperature_sensor_rate_limiter.ignore_limit_and_call();
-    // current location in the receive buffer
-    char *curr_buff = recv_buff;
-    while (true) {
-        // update the heater every loop, potentially disabling it on timeout
-        heater.poll();
-
-        // poll sensors
-        water_level_sensor_rate_limiter.call();
-        temperature_sensor_rate_limiter.call();
-
-        // handle input
-        bool received_newline = false;
-        while (pc.readable() && !received_newline) {
-            // don't overflow read buffer, at this point something is wrong
-            if (curr_buff == recv_buff + RECEIVE_BUFF_SIZE) {
-                curr_buff = recv_buff;
-                memset(recv_buff, 0, RECEIVE_BUFF_SIZE);
-            }
-            *curr_buff = pc.getc();
-            received_newline = (*curr_buff == '\n');
-            curr_buff++;
-        }
-
-        // process a line if we have one
-        if (received_newline) {
-            // and feed the watchdog if we process a legitimate line
-            if (process_line()) {
-                wdt.feed();
-                // debug feeding watchdog
-                led1_toggle();
-            }
-            // reset buffer after processing a line
-            curr_buff = recv_buff;
-            memset(recv_buff, 0, RECEIVE_BUFF_SIZE);
-        }
-    }
+    water_level_sensor.read_raw();
+    add_water_level_reading();
+    temperature_sampler.sample_blocking();
+    temperature = temperature_sampler.temperature_fixed();
+
+    // from here on the CPU sleeps between events
+    idle_clock.start();
+    Thread::attach_idle_hook(idle_hook);
+    water_level_sensor.set_done_callback(on_water_level_done);
+    temp_probe_bus.set_done_callback(on_temperature_bus_done);
+    scheduler.add("W", update_water_level, WATER_LEVEL_PERIOD_US);
+    temperature_task = scheduler.add("T", update_temperature, 0, TEMPERATURE_PHASE_US);
+    control_task = scheduler.add("C", update_control, CONTROL_PERIOD_US);
+    scheduler.cancel(control_task);
+    telemetry_task = scheduler.add("U", send_telemetry, TELEMETRY_CHECK_US);
+    scheduler.cancel(telemetry_task);
+    scheduler.add("H", record_history, HISTORY_PERIOD_US);
+    history_dump_task = scheduler.add("D", send_history_chunk, 0);
+    scheduler.cancel(history_dump_task);
+    scheduler.set_wake_callback(on_scheduler_wake);
+    queue.dispatch_forever();
+    return 0;
 }
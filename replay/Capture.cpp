@@ -0,0 +1,120 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "Capture.h"
+
+#include <stdlib.h>
+
+#include <fstream>
+
+void write_capture_record(FILE *out, long long us, char direction, const char *data, int length) {
+    fprintf(out, "%lld.%06lld %c \"", us / 1000000, us % 1000000, direction);
+    for (int i = 0; i < length; i++) {
+        unsigned char c = data[i];
+        switch (c) {
+        case '\n': fputs("\\n", out); break;
+        case '\r': fputs("\\r", out); break;
+        case '\t': fputs("\\t", out); break;
+        case '\\': fputs("\\\\", out); break;
+        case '"': fputs("\\\"", out); break;
+        default:
+            if (c < 0x20 || c > 0x7E) {
+                fprintf(out, "\\x%02X", c);
+            } else {
+                fputc(c, out);
+            }
+        }
+    }
+    fputs("\"\n", out);
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// parse the quoted bytes starting at line[i]
+static bool parse_bytes(const std::string &line, size_t i, std::string *bytes) {
+    if (i >= line.size() || line[i] != '"') {
+        return false;
+    }
+    for (i++; i < line.size() && line[i] != '"'; i++) {
+        if (line[i] != '\\') {
+            *bytes += line[i];
+            continue;
+        }
+        if (++i == line.size()) {
+            return false;
+        }
+        switch (line[i]) {
+        case 'n': *bytes += '\n'; break;
+        case 'r': *bytes += '\r'; break;
+        case 't': *bytes += '\t'; break;
+        case '\\': *bytes += '\\'; break;
+        case '"': *bytes += '"'; break;
+        case 'x': {
+            int high = i + 1 < line.size() ? hex_digit(line[i + 1]) : -1;
+            int low = i + 2 < line.size() ? hex_digit(line[i + 2]) : -1;
+            if (high < 0 || low < 0) {
+                return false;
+            }
+            *bytes += (char)(high * 16 + low);
+            i += 2;
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+    // nothing may follow the closing quote
+    return i + 1 == line.size();
+}
+
+bool read_capture(const char *path, std::vector<capture_record> *records, std::string *error) {
+    std::ifstream file(path);
+    if (!file) {
+        *error = std::string("can't read ") + path;
+        return false;
+    }
+    std::string line;
+    for (int number = 1; std::getline(file, line); number++) {
+        size_t start = line.find_first_not_of(" \t");
+        if (start == std::string::npos || line[start] == '#') {
+            continue;
+        }
+        char *end;
+        double seconds = strtod(line.c_str() + start, &end);
+        size_t i = end - line.c_str();
+        capture_record record;
+        record.us = (long long)(seconds * 1e6 + 0.5);
+        if (end == line.c_str() + start || seconds < 0 || i + 3 >= line.size()
+            || line[i] != ' ' || (line[i + 1] != '>' && line[i + 1] != '<') || line[i + 2] != ' '
+            || !parse_bytes(line, i + 3, &record.bytes)) {
+            *error = std::string(path) + ":" + std::to_string(number) + ": bad record";
+            return false;
+        }
+        record.direction = line[i + 1];
+        records->push_back(record);
+    }
+    return true;
+}
@@ -0,0 +1,47 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+// A capture is a serial session between a host and the controller as a
+// text file, a record per read / write so that how the bytes were split
+// up and bunched together is kept:
+//
+//   # comments and blank lines are ignored
+//   <seconds> <direction> "<bytes>"
+//
+// seconds is the time since the capture started, to the microsecond,
+// direction is > for bytes the host sent and < for bytes the controller
+// sent, and the bytes are quoted with C style escapes: \n \r \t \\ \" and
+// \xHH for anything else that isn't printable ASCII.
+struct capture_record {
+    long long us;
+    char direction;
+    std::string bytes;
+};
+
+void write_capture_record(FILE *out, long long us, char direction, const char *data, int length);
+
+// read path into records, returns false with a message in error if it
+// can't be read or a record is malformed
+bool read_capture(const char *path, std::vector<capture_record> *records, std::string *error);
+
+#endif
@@ -0,0 +1,201 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "Session.h"
+
+#include <stdlib.h>
+
+#include <algorithm>
+
+#include "../Commands.h"
+
+// the controller's receive queue slots, see rx_lines in main.cpp,
+// longer lines are dropped
+#define CONTROLLER_LINE_MAX 32
+
+// the reply a command gets, by its first key: the reply starts with prefix
+// and its second field with second (if set), NULL if there is no reply
+struct reply_kind {
+    char key;
+    const char *prefix;
+    const char *second;
+};
+
+static const reply_kind reply_kinds[] = {
+    // the status line, W+...,T+...,B+...
+    {'S', "W+", ",T+"},
+    {'B', "W+", ",T+"},
+    {'U', "W+", ",T+"},
+    {'W', "W+", ",V+"},
+    {'T', "T+", NULL},
+    {'E', "O+", NULL},
+    {'I', "I+", NULL},
+    {'Q', "Q+", NULL},
+    {'H', "H+", NULL},
+    {'P', "P+", NULL},
+    {'C', "C+", NULL},
+};
+
+static const reply_kind *expected_reply(const std::string &line) {
+    if (line.size() > CONTROLLER_LINE_MAX || line.size() < 2) {
+        return NULL;
+    }
+    // only valid commands get a reply, checked with the firmware's parsers
+    int value;
+    bool valid = false;
+#define SESSION_COMMAND(name, key0, key1, parser, handler, flags) \
+    if (line[0] == key0 && line[1] == key1) { \
+        valid = parser(line.data() + 2, line.size() - 2, &value); \
+    }
+    COMMAND_TABLE(SESSION_COMMAND)
+#undef SESSION_COMMAND
+    for (size_t i = 0; valid && i < sizeof(reply_kinds) / sizeof(reply_kinds[0]); i++) {
+        if (reply_kinds[i].key == line[0]) {
+            return &reply_kinds[i];
+        }
+    }
+    return NULL;
+}
+
+static bool is_reply(const std::string &reply, const reply_kind *kind) {
+    if (reply.compare(0, 2, kind->prefix) != 0) {
+        return false;
+    }
+    size_t comma = reply.find(',');
+    return !kind->second || (comma != std::string::npos && reply.compare(comma, 3, kind->second) == 0);
+}
+
+Session::Session() {
+    this->unsolicited = 0;
+    this->frames_sent = 0;
+    this->frames_received = 0;
+    this->continuation = 0;
+    this->continued = 0;
+    this->host_in_frame = false;
+}
+
+// split the host's bytes as the controller's LineQueue does: lines end in
+// a newline, a zero byte starts a binary frame and the next ends it
+void Session::sent(long long us, const std::string &bytes) {
+    for (size_t i = 0; i < bytes.size(); i++) {
+        char c = bytes[i];
+        if (this->host_in_frame) {
+            if (c == 0 && !this->host_line.empty()) {
+                this->frames_sent++;
+                this->host_in_frame = false;
+                this->host_line.clear();
+            } else if (c != 0) {
+                this->host_line += c;
+            }
+        } else if (c == 0) {
+            this->host_in_frame = true;
+            this->host_line.clear();
+        } else if (c == '\n') {
+            this->command_line(us, this->host_line);
+            this->host_line.clear();
+        } else {
+            this->host_line += c;
+        }
+    }
+}
+
+// the controller's lines end in a newline, its frames in a zero byte
+void Session::received(long long us, const std::string &bytes) {
+    for (size_t i = 0; i < bytes.size(); i++) {
+        char c = bytes[i];
+        if (c == 0) {
+            this->frames_received++;
+            this->controller_line.clear();
+        } else if (c == '\n') {
+            this->reply_line(us, this->controller_line);
+            this->controller_line.clear();
+        } else {
+            this->controller_line += c;
+        }
+    }
+}
+
+void Session::command_line(long long us, const std::string &line) {
+    command sent;
+    sent.sent_us = us;
+    sent.line = line;
+    sent.replied_us = -1;
+    this->all.push_back(sent);
+    if (expected_reply(line)) {
+        this->waiting.push_back(this->all.size() - 1);
+    }
+}
+
+void Session::reply_line(long long us, const std::string &line) {
+    if (this->continuation > 0) {
+        this->all[this->continued].replies.push_back(line);
+        this->continuation--;
+        return;
+    }
+    // status the bridge pushes to subscribers ends in its clock, M+
+    if (line.compare(0, 11, "MrCoffeeBot") == 0 || line.find(",M+") != std::string::npos) {
+        this->unsolicited++;
+        return;
+    }
+    // the oldest command waiting for this kind of reply, any older ones
+    // were dropped by the controller
+    for (size_t i = 0; i < this->waiting.size(); i++) {
+        command &waiting = this->all[this->waiting[i]];
+        if (!is_reply(line, expected_reply(waiting.line))) {
+            continue;
+        }
+        waiting.replies.push_back(line);
+        waiting.replied_us = us;
+        // P+<sections>,... is followed by a line per section
+        if (line[0] == 'P') {
+            this->continuation = atoi(line.c_str() + 2);
+            this->continued = this->waiting[i];
+        }
+        this->waiting.erase(this->waiting.begin(), this->waiting.begin() + i + 1);
+        return;
+    }
+    this->unsolicited++;
+}
+
+void Session::abandon() {
+    this->waiting.clear();
+    this->continuation = 0;
+}
+
+std::vector<double> Session::latencies_ms() const {
+    std::vector<double> latencies;
+    for (size_t i = 0; i < this->all.size(); i++) {
+        if (this->all[i].replied_us >= 0) {
+            latencies.push_back((this->all[i].replied_us - this->all[i].sent_us) / 1000.0);
+        }
+    }
+    std::sort(latencies.begin(), latencies.end());
+    return latencies;
+}
+
+std::string mask_numbers(const std::string &line) {
+    std::string masked;
+    for (size_t i = 0; i < line.size(); i++) {
+        char c = line[i];
+        bool number = (c >= '0' && c <= '9')
+            || ((c == '-' || c == '.') && i + 1 < line.size() && line[i + 1] >= '0' && line[i + 1] <= '9');
+        if (!number) {
+            masked += c;
+        } else if (masked.empty() || masked[masked.size() - 1] != '#') {
+            masked += '#';
+        }
+    }
+    return masked;
+}
@@ -0,0 +1,88 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <deque>
+#include <string>
+#include <vector>
+
+// Session follows a serial session from the host's side: the lines it sent
+// (commands) and the lines the controller sent back, pairing each reply
+// with its command.
+//
+// Commands the controller will ignore (invalid, RESET, too long for its
+// line queue) expect no reply, and replies are paired by the kind of reply
+// each command gets (eg: T+? gets T+...), so that commands it dropped
+// anyway (eg: its queue was full) don't shift the pairing of the rest.
+// Status pushed to subscribers and boot banners are counted, not paired.
+// Binary frames are counted in both directions.
+class Session {
+public:
+    struct command {
+        // when the line's newline was sent
+        long long sent_us;
+        // without the newline
+        std::string line;
+        std::vector<std::string> replies;
+        // when the first reply completed, -1 if there isn't one
+        long long replied_us;
+    };
+
+    Session();
+
+    // bytes sent by the host / the controller at us
+    void sent(long long us, const std::string &bytes);
+    void received(long long us, const std::string &bytes);
+
+    // commands still waiting for a reply
+    int outstanding() const {
+        return (int)this->waiting.size();
+    }
+
+    // stop waiting for replies that aren't coming
+    void abandon();
+
+    const std::vector<command> &commands() const {
+        return this->all;
+    }
+
+    // ms from each command to its reply, sorted
+    std::vector<double> latencies_ms() const;
+
+    unsigned unsolicited;
+    unsigned frames_sent;
+    unsigned frames_received;
+
+private:
+    std::vector<command> all;
+    std::deque<size_t> waiting;
+    // lines of a multi line reply still to come, for all[continued]
+    int continuation;
+    size_t continued;
+    std::string host_line;
+    bool host_in_frame;
+    std::string controller_line;
+
+    void command_line(long long us, const std::string &line);
+    void reply_line(long long us, const std::string &line);
+};
+
+// line with every number replaced by #, to compare replies whatever the
+// sensors read
+std::string mask_numbers(const std::string &line);
+
+#endif
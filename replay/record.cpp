@@ -0,0 +1,201 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+    Records a serial session with the controller for replay (see replay.cpp)
+    by sitting between it and a host program:
+
+    ./build.py record [-l <link>] <serial device> <capture>
+
+    opens the controller's serial device (115200 8N1) and a pseudo terminal,
+    symlinked at link, for the host program (eg: the bridge in bridge/) to
+    open instead, and passes bytes between the two, writing each read from
+    either side to the capture as a record (see Capture.h) until interrupted.
+*/
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "Capture.h"
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void on_signal(int) {
+    interrupted = 1;
+}
+
+static void fail(const char *what) {
+    fprintf(stderr, "record: %s: %s\n", what, strerror(errno));
+    exit(1);
+}
+
+static long long now_us() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void make_raw(int fd, const char *what) {
+    struct termios settings;
+    if (tcgetattr(fd, &settings) != 0) {
+        fail(what);
+    }
+    // 115200 8N1, no echo or line editing
+    cfmakeraw(&settings);
+    cfsetispeed(&settings, B115200);
+    cfsetospeed(&settings, B115200);
+    settings.c_cflag |= CLOCAL | CREAD;
+    if (tcsetattr(fd, TCSANOW, &settings) != 0) {
+        fail(what);
+    }
+}
+
+// write all of data to fd, which may be non-blocking
+static void write_all(int fd, const char *data, int length, const char *what) {
+    while (length > 0) {
+        ssize_t n = write(fd, data, length);
+        if (n < 0 && errno != EAGAIN && errno != EINTR) {
+            fail(what);
+        }
+        if (n < 0) {
+            struct pollfd out = {fd, POLLOUT, 0};
+            poll(&out, 1, 10);
+            continue;
+        }
+        data += n;
+        length -= n;
+    }
+}
+
+static void usage() {
+    fprintf(stderr, "usage: record [-l <pty link>] <serial device> <capture>\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const char *link = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "l:")) != -1) {
+        if (opt == 'l') {
+            link = optarg;
+        } else {
+            usage();
+        }
+    }
+    if (argc - optind != 2) {
+        usage();
+    }
+    const char *device_path = argv[optind];
+    const char *capture_path = argv[optind + 1];
+
+    int device = open(device_path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (device < 0) {
+        fail(device_path);
+    }
+    make_raw(device, device_path);
+    // whatever was sent before we were listening
+    tcflush(device, TCIFLUSH);
+
+    int master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        fail("can't open a pty");
+    }
+    std::string terminal = ptsname(master);
+    // held open, so that the master doesn't see a hangup whenever the
+    // host program closes it
+    int slave = open(terminal.c_str(), O_RDWR | O_NOCTTY);
+    if (slave < 0) {
+        fail(terminal.c_str());
+    }
+    make_raw(slave, terminal.c_str());
+    if (link) {
+        unlink(link);
+        if (symlink(terminal.c_str(), link) != 0) {
+            fail(link);
+        }
+    }
+
+    FILE *capture = fopen(capture_path, "w");
+    if (!capture) {
+        fail(capture_path);
+    }
+    fprintf(capture, "# recorded from %s\n", device_path);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    fprintf(stderr, "record: %s <-> %s%s%s, ^C to stop\n", device_path, terminal.c_str(),
+            link ? " at " : "", link ? link : "");
+
+    long long start_us = now_us();
+    unsigned long long host_bytes = 0, controller_bytes = 0;
+    char buffer[512];
+    while (!interrupted) {
+        struct pollfd fds[2] = {{device, POLLIN, 0}, {master, POLLIN, 0}};
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fail("poll");
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t n = read(device, buffer, sizeof(buffer));
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+                fprintf(stderr, "record: lost %s\n", device_path);
+                break;
+            }
+            if (n > 0) {
+                write_capture_record(capture, now_us() - start_us, '<', buffer, (int)n);
+                // dropped if the host program isn't reading, as a USB
+                // serial bridge would
+                if (write(master, buffer, n) < 0 && errno != EAGAIN) {
+                    fail("pty write");
+                }
+                controller_bytes += n;
+            }
+        }
+        if (fds[1].revents & POLLIN) {
+            ssize_t n = read(master, buffer, sizeof(buffer));
+            if (n > 0) {
+                write_capture_record(capture, now_us() - start_us, '>', buffer, (int)n);
+                write_all(device, buffer, (int)n, device_path);
+                host_bytes += n;
+            }
+        }
+    }
+
+    fclose(capture);
+    if (link) {
+        unlink(link);
+    }
+    close(slave);
+    close(master);
+    close(device);
+    fprintf(stderr, "record: %llu bytes from the host, %llu from the controller in %.1f s\n",
+            host_bytes, controller_bytes, (now_us() - start_us) / 1e6);
+    return 0;
+}
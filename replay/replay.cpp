@@ -0,0 +1,293 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+    Replays the host's side of a capture (see Capture.h) into the firmware
+    built against the simulated hardware in sim/, and compares what it
+    sends back with what the controller sent in the capture.
+
+    ./build.py replay [--fast] [--exact] [--script <sim script>] <capture>
+
+    The host's bytes are sent as they were split up in the capture, either
+    at their original times or, with --fast, each as soon as the replies to
+    the last have arrived. Replies are compared with numbers masked, as the
+    sensors won't read the same, unless --exact.
+    The simulated hardware is set up by the script, see sim/World.h,
+    by default a probe and the water level sensor.
+
+    Reports commands / second (in simulated time, which is what the
+    controller would manage, and in wall time, which is how fast the
+    command path runs on the host), reply latency percentiles for the
+    capture and the replay, and the replies that differ. Exits 0 if none
+    do, 1 if any do and 2 on bad arguments.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "Capture.h"
+#include "Session.h"
+#include "World.h"
+
+int firmware_main();
+
+static const char default_script[] =
+    "transcript off\n"
+    "end never\n"
+    "ds18b20 28FF4B6A641604 temperature=21\n"
+    "hcsr04 distance=4\n";
+
+// the firmware's globals use the hardware during static initialization,
+// so the World must be configured before them, SIM_SCRIPT still wins
+struct configure_world {
+    configure_world() {
+        if (!getenv("SIM_SCRIPT")) {
+            World::configure("replay", default_script);
+        }
+    }
+};
+static configure_world configure __attribute__((init_priority(101)));
+
+// how long after the boot banner to start, the firmware samples the
+// sensors once before serving commands
+#define SETTLE_MS 1500
+// with --fast, how long to wait for replies that may not be coming
+#define REPLY_TIMEOUT_MS 1000
+// how long to wait for the last replies
+#define DRAIN_MS 2000
+// how many differing replies to print
+#define MAX_REPORTED 20
+
+class Replay : public WorldObserver {
+public:
+    Replay(const std::vector<capture_record> &records, bool fast, bool exact)
+        : records(records), fast(fast), exact(exact), next_event(this), drained_event(this) {
+        this->next = 0;
+        this->started = false;
+        this->start_ns = 0;
+        this->last_activity_ns = 0;
+        this->first_us = records.empty() ? 0 : records[0].us;
+        for (size_t i = 0; i < records.size(); i++) {
+            if (records[i].direction == '>') {
+                this->recorded.sent(records[i].us, records[i].bytes);
+            } else {
+                this->recorded.received(records[i].us, records[i].bytes);
+            }
+        }
+    }
+
+    void received(unsigned char c) {
+        this->last_activity_ns = sim_clock().now();
+        if (!this->started) {
+            // wait for the boot banner
+            this->banner += (char)c;
+            if (c == '\n' && this->banner.compare(0, 11, "MrCoffeeBot") == 0) {
+                this->started = true;
+                this->start_ns = sim_clock().now() + SIM_MS(SETTLE_MS);
+                this->wall_start = std::chrono::steady_clock::now();
+                this->next_event.schedule_at(this->start_ns);
+            } else if (c == '\n') {
+                this->banner.clear();
+            }
+            return;
+        }
+        this->replayed.received(this->now_us(), std::string(1, (char)c));
+        if (this->fast && this->replayed.outstanding() == 0 && this->next < this->records.size()
+            && this->next_event.when() > sim_clock().now()) {
+            // the replies are in, don't wait out the timeout
+            this->next_event.schedule_in(0);
+        }
+    }
+
+    void finishing(const char *why, int) {
+        if (this->next < this->records.size()) {
+            printf("replay: the simulation ended early: %s\n", why);
+        }
+        this->report();
+    }
+
+private:
+    const std::vector<capture_record> &records;
+    bool fast;
+    bool exact;
+    size_t next;
+    long long first_us;
+    bool started;
+    std::string banner;
+    sim_time_t start_ns;
+    sim_time_t last_activity_ns;
+    std::chrono::steady_clock::time_point wall_start;
+    std::chrono::steady_clock::time_point wall_end;
+    sim_time_t end_ns;
+    Session recorded;
+    Session replayed;
+
+    // simulated us since the replay started
+    long long now_us() {
+        return (long long)(sim_clock().now() - this->start_ns) / 1000;
+    }
+
+    // send the next of the host's records, and schedule the one after
+    void send_next() {
+        while (this->next < this->records.size() && this->records[this->next].direction != '>') {
+            this->next++;
+        }
+        if (this->next == this->records.size()) {
+            this->end_ns = sim_clock().now();
+            this->wall_end = std::chrono::steady_clock::now();
+            this->drained_event.schedule_in(SIM_MS(DRAIN_MS));
+            return;
+        }
+        if (this->fast && this->replayed.outstanding() > 0) {
+            // the replies aren't coming
+            this->replayed.abandon();
+        }
+        const capture_record &record = this->records[this->next++];
+        this->replayed.sent(this->now_us(), record.bytes);
+        World::get().send(record.bytes);
+        this->last_activity_ns = sim_clock().now();
+        if (!this->fast) {
+            size_t following = this->next;
+            while (following < this->records.size() && this->records[following].direction != '>') {
+                following++;
+            }
+            long long due_us = following < this->records.size()
+                ? this->records[following].us - this->first_us : this->now_us();
+            this->next_event.schedule_at(this->start_ns + SIM_US(due_us));
+        } else if (this->replayed.outstanding() == 0) {
+            // nothing to wait for, but let the bytes go out first
+            this->next_event.schedule_in(SIM_US(record.bytes.size() * 87));
+        } else {
+            this->next_event.schedule_in(SIM_MS(REPLY_TIMEOUT_MS));
+        }
+    }
+
+    void drained() {
+        World::get().finish("end of capture", this->differences() > 0 ? 1 : 0);
+    }
+
+    MemberEvent<Replay, &Replay::send_next> next_event;
+    MemberEvent<Replay, &Replay::drained> drained_event;
+
+    std::string comparable(const std::vector<std::string> &replies) {
+        std::string joined;
+        for (size_t i = 0; i < replies.size(); i++) {
+            joined += (i ? " | " : "") + (this->exact ? replies[i] : mask_numbers(replies[i]));
+        }
+        return joined;
+    }
+
+    int differences() {
+        const std::vector<Session::command> &before = this->recorded.commands();
+        const std::vector<Session::command> &after = this->replayed.commands();
+        int count = before.size() != after.size() ? 1 : 0;
+        for (size_t i = 0; i < before.size() && i < after.size(); i++) {
+            count += this->comparable(before[i].replies) != this->comparable(after[i].replies);
+        }
+        return count;
+    }
+
+    static void print_latencies(const char *name, const std::vector<double> &ms) {
+        if (ms.empty()) {
+            printf("%-9s no replies\n", name);
+            return;
+        }
+        printf("%-9s %6d replies, ms min %7.2f p50 %7.2f p90 %7.2f p99 %7.2f max %7.2f\n", name,
+               (int)ms.size(), ms[0], ms[ms.size() / 2], ms[ms.size() * 9 / 10],
+               ms[ms.size() * 99 / 100], ms[ms.size() - 1]);
+    }
+
+    void report() {
+        const std::vector<Session::command> &before = this->recorded.commands();
+        const std::vector<Session::command> &after = this->replayed.commands();
+        if (!this->started) {
+            printf("replay: the firmware never booted\n");
+            return;
+        }
+        if (this->next < this->records.size()) {
+            this->end_ns = sim_clock().now();
+            this->wall_end = std::chrono::steady_clock::now();
+        }
+        double simulated = (this->end_ns - this->start_ns) / 1e9;
+        double wall = std::chrono::duration<double>(this->wall_end - this->wall_start).count();
+        printf("replay: %d commands, %u / %u frames sent / received, in %.3f s simulated (%.3f s wall)\n",
+               (int)after.size(), this->replayed.frames_sent, this->replayed.frames_received,
+               simulated, wall);
+        printf("commands / s: %.1f simulated, %.1f wall\n",
+               simulated > 0 ? after.size() / simulated : 0, wall > 0 ? after.size() / wall : 0);
+        print_latencies("captured", this->recorded.latencies_ms());
+        print_latencies("replayed", this->replayed.latencies_ms());
+        printf("unpaired lines: %u captured, %u replayed\n", this->recorded.unsolicited,
+               this->replayed.unsolicited);
+
+        int reported = 0;
+        if (before.size() != after.size()) {
+            printf("the capture has %d commands, the replay sent %d\n", (int)before.size(), (int)after.size());
+        }
+        for (size_t i = 0; i < before.size() && i < after.size(); i++) {
+            std::string was = this->comparable(before[i].replies);
+            std::string now = this->comparable(after[i].replies);
+            if (was == now || reported++ >= MAX_REPORTED) {
+                continue;
+            }
+            printf("command %d at %.3f s: \"%s\"\n", (int)i, before[i].sent_us / 1e6,
+                   before[i].line.c_str());
+            printf("  captured: %s\n", was.empty() ? "(no reply)" : was.c_str());
+            printf("  replayed: %s\n", now.empty() ? "(no reply)" : now.c_str());
+        }
+        printf("%d replies differ%s\n", this->differences(), this->exact ? "" : " (numbers masked)");
+        fflush(stdout);
+    }
+};
+
+static void usage() {
+    fprintf(stderr, "usage: replay [--fast] [--exact] <capture>, the sim script is $SIM_SCRIPT\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    bool fast = false, exact = false;
+    const char *path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--fast") == 0) {
+            fast = true;
+        } else if (strcmp(argv[i], "--exact") == 0) {
+            exact = true;
+        } else if (argv[i][0] == '-' || path) {
+            usage();
+        } else {
+            path = argv[i];
+        }
+    }
+    if (!path) {
+        usage();
+    }
+    std::vector<capture_record> records;
+    std::string error;
+    if (!read_capture(path, &records, &error)) {
+        fprintf(stderr, "replay: %s\n", error.c_str());
+        return 2;
+    }
+    Replay replay(records, fast, exact);
+    World::get().observe(&replay);
+    firmware_main();
+    World::get().finish("main() returned", 1);
+    return 1;
+}
@@ -0,0 +1,404 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "Devices.h"
+
+#include <math.h>
+
+#include "World.h"
+
+Plant::Plant() {
+    this->configure(20, 20, 0.25, 0.002, 100);
+    this->heating = false;
+}
+
+void Plant::configure(double ambient, double initial, double heat_rate, double loss_rate, double boiling) {
+    this->ambient = ambient;
+    this->current = initial;
+    this->heat_rate = heat_rate;
+    this->loss_rate = loss_rate;
+    this->boiling = boiling;
+    this->updated = sim_clock().now();
+}
+
+void Plant::update() {
+    sim_time_t now = sim_clock().now();
+    double seconds = (now - this->updated) / 1e9;
+    this->updated = now;
+    double heat = this->heating ? this->heat_rate : 0;
+    if (this->loss_rate > 0) {
+        // relaxes exponentially towards where heating and loss balance
+        double balance = this->ambient + heat / this->loss_rate;
+        this->current = balance + (this->current - balance) * exp(-this->loss_rate * seconds);
+    } else {
+        this->current += heat * seconds;
+    }
+    if (this->current > this->boiling) {
+        this->current = this->boiling;
+    }
+}
+
+double Plant::temperature() {
+    this->update();
+    return this->current;
+}
+
+void Plant::set_heating(bool on) {
+    this->update();
+    this->heating = on;
+}
+
+SSR::SSR(Plant *plant) : plant(plant) {
+    this->switches = 0;
+    this->is_on = false;
+    this->on_since = 0;
+    this->total_on = 0;
+}
+
+void SSR::mcu_changed(SimPin &pin) {
+    bool on = pin.is_output() && pin.value();
+    if (on == this->is_on) {
+        return;
+    }
+    sim_time_t now = sim_clock().now();
+    if (on) {
+        this->on_since = now;
+        this->switches++;
+    } else {
+        this->total_on += now - this->on_since;
+    }
+    this->is_on = on;
+    this->plant->set_heating(on);
+}
+
+sim_time_t SSR::on_ns() const {
+    if (this->is_on) {
+        return this->total_on + sim_clock().now() - this->on_since;
+    }
+    return this->total_on;
+}
+
+// from the trigger falling to the echo rising
+#define ECHO_DELAY_NS  SIM_US(450)
+// round trip time per inch, 2 * 74us
+#define ECHO_NS_PER_INCH 148000.0
+// the echo of nothing in range
+#define ECHO_TIMEOUT_NS SIM_MS(38)
+
+HCSR04Model::HCSR04Model(SimPin *trigger, SimPin *echo)
+    : trigger(trigger), echo(echo), random(2604), start_event(this), end_event(this) {
+    this->pings = 0;
+    this->distance = 0;
+    this->noise = 0;
+    this->outlier_rate = 0;
+    this->connected = true;
+    this->triggered = false;
+    this->trigger_rise = 0;
+    this->busy = false;
+    this->echo_high = false;
+    this->echo_ns = 0;
+}
+
+void HCSR04Model::mcu_changed(SimPin &pin) {
+    if (&pin != this->trigger) {
+        return;
+    }
+    bool high = pin.is_output() && pin.value();
+    sim_time_t now = sim_clock().now();
+    if (high && !this->triggered) {
+        this->trigger_rise = now;
+    } else if (!high && this->triggered && this->connected && !this->busy
+               && now - this->trigger_rise >= SIM_US(10)) {
+        // pick the echo now, when the burst goes out
+        this->pings++;
+        this->busy = true;
+        double inches = this->distance;
+        if (this->outlier_rate > 0
+            && std::uniform_real_distribution<double>(0, 1)(this->random) < this->outlier_rate) {
+            // something closer got in the way
+            inches = std::uniform_real_distribution<double>(0.5, inches > 0.5 ? inches : 0.5)(this->random);
+        } else if (this->noise > 0) {
+            inches += std::normal_distribution<double>(0, this->noise)(this->random);
+        }
+        this->echo_ns = inches > 0 ? (sim_time_t)(inches * ECHO_NS_PER_INCH) : ECHO_TIMEOUT_NS;
+        this->start_event.schedule_in(ECHO_DELAY_NS);
+    }
+    this->triggered = high;
+}
+
+pin_drive HCSR04Model::drive(const SimPin &pin) const {
+    if (&pin != this->echo) {
+        return pin_float;
+    }
+    return this->echo_high ? pin_high : pin_low;
+}
+
+void HCSR04Model::echo_start() {
+    this->echo_high = true;
+    this->echo->changed();
+    this->end_event.schedule_in(this->echo_ns);
+}
+
+void HCSR04Model::echo_end() {
+    this->echo_high = false;
+    this->busy = false;
+    this->echo->changed();
+}
+
+SerialPort::SerialPort() : rx_event(this), tx_event(this), wire_event(this) {
+    this->host = NULL;
+    this->wire = NULL;
+    this->wire_half_bit = 0;
+    this->wire_echo = 0;
+    this->set_baud(9600);
+    this->rx_bytes = 0;
+    this->tx_bytes = 0;
+    this->overruns = 0;
+    this->tx_blocked_ns = 0;
+}
+
+void SerialPort::set_baud(int baud) {
+    // start + 8 data + stop bits
+    this->char_ns = 10 * 1000000000ULL / baud;
+}
+
+int SerialPort::getc() {
+    VirtualClock &clock = sim_clock();
+    while (this->rx_fifo.empty()) {
+        if (!clock.sleep()) {
+            error("sim: getc() would block forever\n");
+        }
+    }
+    unsigned char c = this->rx_fifo.front();
+    this->rx_fifo.pop_front();
+    return c;
+}
+
+void SerialPort::putc(int c) {
+    VirtualClock &clock = sim_clock();
+    sim_time_t start = clock.now();
+    ClockEvent &next = this->wire ? (ClockEvent &)this->wire_event : (ClockEvent &)this->tx_event;
+    while (!this->writeable()) {
+        // the next byte out makes room
+        clock.advance_to(next.when());
+    }
+    this->tx_blocked_ns += clock.now() - start;
+    this->tx_fifo.push_back(c);
+    this->tx_handler.clear();
+    if (!next.scheduled()) {
+        if (this->wire) {
+            this->wire_step();
+        } else {
+            this->tx_event.schedule_in(this->char_ns);
+        }
+    }
+}
+
+void SerialPort::attach(Callback<void()> handler, bool tx) {
+    Handler &target = tx ? this->tx_handler : this->rx_handler;
+    target.callback = handler;
+    // both are level triggered on the UART, THRE is already set if there
+    // is nothing to send, and RDA if bytes arrived before this
+    if (handler && (tx ? this->tx_fifo.empty() : this->readable())) {
+        target.raise();
+    }
+}
+
+void SerialPort::send(const char *data, int length) {
+    this->rx_line.insert(this->rx_line.end(), data, data + length);
+    if (!this->rx_event.scheduled() && !this->rx_line.empty()) {
+        this->rx_event.schedule_in(this->char_ns);
+    }
+}
+
+void SerialPort::rx_done() {
+    unsigned char c = this->rx_line.front();
+    this->rx_line.pop_front();
+    this->receive(c);
+    if (!this->rx_line.empty()) {
+        this->rx_event.schedule_in(this->char_ns);
+    }
+}
+
+void SerialPort::receive(unsigned char c) {
+    this->rx_bytes++;
+    if (this->rx_fifo.size() < fifo_size) {
+        this->rx_fifo.push_back(c);
+    } else {
+        this->overruns++;
+    }
+    if (this->rx_handler.callback) {
+        this->rx_handler.raise();
+    }
+}
+
+void SerialPort::tx_done() {
+    unsigned char c = this->tx_fifo.front();
+    this->tx_fifo.pop_front();
+    this->tx_bytes++;
+    if (this->host) {
+        this->host->received(c);
+    }
+    if (!this->tx_fifo.empty()) {
+        this->tx_event.schedule_in(this->char_ns);
+    } else if (this->tx_handler.callback) {
+        this->tx_handler.raise();
+    }
+}
+
+// the byte at the front of the TX FIFO on the wire, at each half bit:
+// drive the start bit, the data bits least sig first and the stop bit at
+// the start of each, and sample the wire in the middle of each
+void SerialPort::wire_step() {
+    int bit = this->wire_half_bit / 2;
+    if (this->wire_half_bit % 2 == 0) {
+        bool high = bit == 9 || (bit > 0 && (this->tx_fifo.front() >> (bit - 1)) & 0x01);
+        // open drain, high is letting the pullup have it
+        this->wire->set_value(0);
+        this->wire->set_output(!high);
+    } else if (bit > 0 && bit < 9) {
+        this->wire_echo |= (this->wire->level() ? 1 : 0) << (bit - 1);
+    }
+    this->wire_half_bit++;
+    if (this->wire_half_bit < 20) {
+        this->wire_event.schedule_in(this->char_ns / 20);
+        return;
+    }
+    // the stop bit is done
+    this->tx_fifo.pop_front();
+    this->tx_bytes++;
+    this->receive(this->wire_echo);
+    this->wire_echo = 0;
+    this->wire_half_bit = 0;
+    if (!this->tx_fifo.empty()) {
+        this->wire_step();
+    } else if (this->tx_handler.callback) {
+        this->tx_handler.raise();
+    }
+}
+
+WatchdogModel::WatchdogModel() : timeout(this) {
+    memset(&this->registers, 0, sizeof(this->registers));
+    // the reset value
+    this->registers.WDTC = 0xFF;
+    this->feeds = 0;
+    this->last_write = 0;
+}
+
+void WatchdogModel::feed_write(uint32_t value) {
+    if (this->last_write == 0xAA && value == 0x55 && (this->registers.WDMOD & 0x01)) {
+        this->feeds++;
+        // WDTC counts a 4x prescaled PCLK, which is CCLK / 4
+        sim_time_t ns = (sim_time_t)this->registers.WDTC * 16 * 1000000000ULL / SystemCoreClock;
+        this->timeout.schedule_in(ns);
+    }
+    this->last_write = value;
+}
+
+void WatchdogModel::expired() {
+    if (this->registers.WDMOD & 0x02) {
+        World::get().finish("watchdog reset", 2);
+    }
+}
+
+FlashModel::FlashModel() : bytes(size, 0xFF) {
+    this->sector_erases = 0;
+    this->pages_programmed = 0;
+}
+
+void FlashModel::keep(const std::string &path) {
+    this->path = path;
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file) {
+        return;
+    }
+    if (fread(&this->bytes[0], 1, size, file) != size) {
+        fprintf(stderr, "sim: %s isn't a %d byte flash image\n", path.c_str(), (int)size);
+        exit(1);
+    }
+    fclose(file);
+}
+
+uint32_t FlashModel::sector_size(uint32_t address) {
+    return address < 0x10000 ? 4 * 1024 : 32 * 1024;
+}
+
+bool FlashModel::erase(uint32_t address, uint32_t length) {
+    if (address % sector_size(address) != 0 || address + length > size) {
+        return false;
+    }
+    uint32_t end = address + length;
+    while (address < end) {
+        uint32_t sector = sector_size(address);
+        if (address + sector > end) {
+            return false;
+        }
+        memset(&this->bytes[address], 0xFF, sector);
+        address += sector;
+        this->sector_erases++;
+        // 100ms a sector, from the datasheet
+        this->stall(SIM_MS(100));
+    }
+    this->save();
+    return true;
+}
+
+bool FlashModel::program(uint32_t address, const void *data, uint32_t length) {
+    if (address % page_size != 0 || length % page_size != 0 || address + length > size) {
+        return false;
+    }
+    const unsigned char *from = (const unsigned char *)data;
+    for (uint32_t i = 0; i < length; i++) {
+        this->bytes[address + i] &= from[i];
+    }
+    this->pages_programmed += length / page_size;
+    // 1ms a page
+    this->stall(SIM_MS(length / page_size));
+    this->save();
+    return true;
+}
+
+bool FlashModel::read(uint32_t address, void *data, uint32_t length) const {
+    if (address + length > size) {
+        return false;
+    }
+    memcpy(data, &this->bytes[address], length);
+    return true;
+}
+
+void FlashModel::stall(sim_time_t ns) {
+    // nests, in case the caller already masked interrupts
+    VirtualClock &clock = sim_clock();
+    clock.critical_enter();
+    clock.advance(ns);
+    clock.critical_exit();
+}
+
+void FlashModel::save() {
+    if (this->path.empty()) {
+        return;
+    }
+    FILE *file = fopen(this->path.c_str(), "wb");
+    if (!file || fwrite(&this->bytes[0], 1, size, file) != size || fclose(file) != 0) {
+        fprintf(stderr, "sim: can't write %s\n", this->path.c_str());
+        exit(1);
+    }
+}
+
+void ResetLine::mcu_changed(SimPin &pin) {
+    if (pin.mode() == SimPin::mode_open_drain) {
+        World::get().finish("reset pin pulled", 3);
+    }
+}
@@ -0,0 +1,276 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef SIM_DEVICES_H
+#define SIM_DEVICES_H
+
+#include <deque>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "mbed.h"
+
+// Plant is the pot: heated at heat_rate C/s while the SSR is on, losing
+// heat to ambient at loss_rate per second (Newton's law of cooling), and
+// held at boiling. It is solved exactly between switches, not stepped.
+class Plant {
+public:
+    Plant();
+
+    void configure(double ambient, double initial, double heat_rate, double loss_rate, double boiling);
+
+    double temperature();
+    void set_heating(bool on);
+
+private:
+    double ambient;
+    double heat_rate;
+    double loss_rate;
+    double boiling;
+    double current;
+    bool heating;
+    sim_time_t updated;
+
+    void update();
+};
+
+// SSR switches the heater with the pin, and keeps the time it was on for
+class SSR : public PinDevice {
+public:
+    SSR(Plant *plant);
+
+    void mcu_changed(SimPin &pin);
+
+    bool on() const {
+        return this->is_on;
+    }
+    // total time on
+    sim_time_t on_ns() const;
+
+    unsigned switches;
+
+private:
+    Plant *plant;
+    bool is_on;
+    sim_time_t on_since;
+    sim_time_t total_on;
+};
+
+// HCSR04Model answers a 10us trigger pulse with an echo pulse 148us long
+// per inch to the target, after the sensor's ~450us of sending its burst.
+// Readings can be given gaussian noise and a rate of spurious short echos,
+// with no target in range the echo lasts 38ms as on the real sensor.
+class HCSR04Model : public PinDevice {
+public:
+    HCSR04Model(SimPin *trigger, SimPin *echo);
+
+    // inches, 0 for nothing in range
+    void set_distance(double inches) {
+        this->distance = inches;
+    }
+    void set_noise(double inches) {
+        this->noise = inches;
+    }
+    void set_outlier_rate(double rate) {
+        this->outlier_rate = rate;
+    }
+    // a disconnected sensor never echos
+    void set_connected(bool connected) {
+        this->connected = connected;
+    }
+
+    void mcu_changed(SimPin &pin);
+    pin_drive drive(const SimPin &pin) const;
+
+    unsigned pings;
+
+private:
+    SimPin *trigger;
+    SimPin *echo;
+    double distance;
+    double noise;
+    double outlier_rate;
+    bool connected;
+    std::mt19937 random;
+
+    bool triggered;
+    sim_time_t trigger_rise;
+    bool busy;
+    bool echo_high;
+    sim_time_t echo_ns;
+
+    void echo_start();
+    void echo_end();
+
+    MemberEvent<HCSR04Model, &HCSR04Model::echo_start> start_event;
+    MemberEvent<HCSR04Model, &HCSR04Model::echo_end> end_event;
+};
+
+// SerialHost is the other end of a SerialPort
+class SerialHost {
+public:
+    virtual ~SerialHost() {}
+    virtual void received(unsigned char c) = 0;
+};
+
+// SerialPort is the LPC1768 UART under RawSerial: 16 byte RX and TX FIFOs,
+// bytes on the wire for 10 bit times each, an RX interrupt per byte and the
+// TX interrupt when the TX FIFO empties (THRE). Received bytes that find
+// the RX FIFO full are lost and counted as overruns.
+// On a wire (set_wire) TX drives a pin open drain a bit at a time and RX
+// samples it at the middle of each bit, so that every byte sent is echoed
+// as the devices on the pin left it, eg: the 1-Wire bus under OneWireUart.
+class SerialPort {
+public:
+    enum {
+        fifo_size = 16
+    };
+
+    SerialPort();
+
+    void set_host(SerialHost *host) {
+        this->host = host;
+    }
+    void set_baud(int baud);
+    void set_wire(SimPin *wire) {
+        this->wire = wire;
+    }
+
+    // MCU side
+    bool readable() const {
+        return !this->rx_fifo.empty();
+    }
+    bool writeable() const {
+        return this->tx_fifo.size() < fifo_size;
+    }
+    // both block until they can go ahead
+    int getc();
+    void putc(int c);
+    void attach(Callback<void()> handler, bool tx);
+
+    // host side, send bytes down the line after any still queued
+    void send(const char *data, int length);
+
+    // stats
+    unsigned long long rx_bytes;
+    unsigned long long tx_bytes;
+    unsigned overruns;
+    // time putc spent blocked on a full TX FIFO
+    sim_time_t tx_blocked_ns;
+
+private:
+    class Handler : public Interrupt {
+    public:
+        Callback<void()> callback;
+    protected:
+        void handle() {
+            if (this->callback) {
+                this->callback();
+            }
+        }
+    };
+
+    SerialHost *host;
+    SimPin *wire;
+    sim_time_t char_ns;
+    // on a wire, the half bit in the byte being sent and the bits read
+    int wire_half_bit;
+    unsigned wire_echo;
+    std::deque<unsigned char> rx_fifo;
+    std::deque<unsigned char> tx_fifo;
+    // sent by the host, not yet on the wire
+    std::deque<unsigned char> rx_line;
+    Handler rx_handler;
+    Handler tx_handler;
+
+    void rx_done();
+    void tx_done();
+    void wire_step();
+    void receive(unsigned char c);
+
+    MemberEvent<SerialPort, &SerialPort::rx_done> rx_event;
+    MemberEvent<SerialPort, &SerialPort::tx_done> tx_event;
+    MemberEvent<SerialPort, &SerialPort::wire_step> wire_event;
+};
+
+// WatchdogModel is the LPC1768 WDT, as much as Watchdog in main.cpp uses:
+// a feed sequence (0xAA, 0x55) restarts it from WDTC when enabled, and it
+// resets the MCU when it runs out
+class WatchdogModel {
+public:
+    WatchdogModel();
+
+    LPC_WDT_TypeDef registers;
+
+    void feed_write(uint32_t value);
+
+    bool running() const {
+        return this->timeout.scheduled();
+    }
+
+    unsigned feeds;
+
+private:
+    uint32_t last_write;
+
+    void expired();
+
+    MemberEvent<WatchdogModel, &WatchdogModel::expired> timeout;
+};
+
+// FlashModel is the LPC1768's 512KB of flash as IAP sees it: 16 4KB
+// sectors then 14 32KB sectors, erased a sector at a time to 0xFF and
+// programmed a 256 byte page at a time, which can only clear bits. Both
+// stall the CPU, with interrupts off, for as long as the part takes.
+// It starts erased, or is kept in a file between runs
+class FlashModel {
+public:
+    enum {
+        size = 512 * 1024,
+        page_size = 256
+    };
+
+    FlashModel();
+
+    // load from path if it exists, and write back to it after every change
+    void keep(const std::string &path);
+
+    static uint32_t sector_size(uint32_t address);
+
+    // false if not aligned to / a whole number of sectors or pages
+    bool erase(uint32_t address, uint32_t length);
+    bool program(uint32_t address, const void *data, uint32_t length);
+    bool read(uint32_t address, void *data, uint32_t length) const;
+
+    unsigned sector_erases;
+    unsigned pages_programmed;
+
+private:
+    std::vector<unsigned char> bytes;
+    std::string path;
+
+    void stall(sim_time_t ns);
+    void save();
+};
+
+// ResetLine is the pin wired to the MCU's reset, reset() in main.cpp pulls
+// it low by switching it to open drain
+class ResetLine : public PinDevice {
+public:
+    void mcu_changed(SimPin &pin);
+};
+
+#endif
@@ -0,0 +1,426 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "OneWireBus.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "../CRC8.h"
+#include "Devices.h"
+
+// DS18B20 ROM and function commands
+#define COMMAND_READ_ROM         0x33
+#define COMMAND_MATCH_ROM        0x55
+#define COMMAND_SKIP_ROM         0xCC
+#define COMMAND_SEARCH_ROM       0xF0
+#define COMMAND_ALARM_SEARCH     0xEC
+#define COMMAND_CONVERT          0x44
+#define COMMAND_READ_SCRATCHPAD  0xBE
+#define COMMAND_WRITE_SCRATCHPAD 0x4E
+#define COMMAND_COPY_SCRATCHPAD  0x48
+#define COMMAND_RECALL_EEPROM    0xB8
+#define COMMAND_READ_POWER       0xB4
+
+// datasheet timings: the device samples a write slot 15us (min) after the
+// master pulls the line low and holds it low for 30us to send a 0, and
+// answers a reset with a presence pulse 30 - 150us after it ends
+#define SLOT_SAMPLE_NS      SIM_US(15)
+#define SLOT_HOLD_NS        SIM_US(30)
+#define MAX_SLOT_NS         SIM_US(120)
+#define MIN_RESET_NS        SIM_US(480)
+#define PRESENCE_START_NS   SIM_US(30)
+#define PRESENCE_END_NS     SIM_US(150)
+// at 12 bits, halving with each bit less
+#define MAX_CONVERSION_NS   SIM_MS(750)
+
+// the power on value of the temperature register, 85C
+#define POWER_ON_READING 0x0550
+
+DS18B20::DS18B20(const unsigned char rom[8]) : random(rom[1] | rom[2] << 8 | rom[3] << 16) {
+    memcpy(this->rom_code, rom, 8);
+    // TH = 75, TL = 70, 12 bits, the factory EEPROM
+    this->eeprom[0] = 0x4B;
+    this->eeprom[1] = 0x46;
+    this->eeprom[2] = 0x7F;
+    this->scratchpad[0] = POWER_ON_READING & 0xFF;
+    this->scratchpad[1] = POWER_ON_READING >> 8;
+    memcpy(this->scratchpad + 2, this->eeprom, 3);
+    this->scratchpad[5] = 0xFF;
+    this->scratchpad[6] = 0x0C;
+    this->scratchpad[7] = 0x10;
+    this->parasite = false;
+    this->is_connected = true;
+    this->crc_errors = 0;
+    this->crc_error_rate = 0;
+    this->fixed_temperature = 20;
+    this->plant = NULL;
+    this->plant_offset = 0;
+    this->current_state = state_idle;
+    this->rx_bits = 0;
+    this->rx_shift = 0;
+    this->rx_count = 0;
+    this->tx_bit = 0;
+    this->tx_bits = 0;
+    this->search_bit = 0;
+    this->search_step = 0;
+    this->hold_from = 0;
+    this->hold_until = 0;
+    this->converting = false;
+    this->convert_done = 0;
+    this->convert_result = 0;
+    this->convert_powered = false;
+    this->conversions = 0;
+    this->failed_conversions = 0;
+    this->scratchpad_reads = 0;
+    this->corrupted_reads = 0;
+}
+
+void DS18B20::set_temperature(double celsius) {
+    this->fixed_temperature = celsius;
+    this->plant = NULL;
+}
+
+void DS18B20::follow(Plant *plant, double offset) {
+    this->plant = plant;
+    this->plant_offset = offset;
+}
+
+double DS18B20::temperature() const {
+    if (this->plant) {
+        return this->plant->temperature() + this->plant_offset;
+    }
+    return this->fixed_temperature;
+}
+
+void DS18B20::set_resolution(int bits) {
+    this->eeprom[2] = ((bits - 9) << 5) | 0x1F;
+    this->scratchpad[4] = this->eeprom[2];
+}
+
+int DS18B20::resolution() const {
+    return 9 + ((this->scratchpad[4] >> 5) & 0x03);
+}
+
+void DS18B20::set_connected(bool connected) {
+    this->is_connected = connected;
+    if (!connected) {
+        this->current_state = state_idle;
+        this->hold_until = 0;
+    }
+}
+
+// the reading the temperature converts to at the current resolution,
+// in 1/16ths of a degree with the undefined low bits cleared
+int DS18B20::conversion_reading() const {
+    double celsius = this->temperature();
+    // the measurement range
+    if (celsius < -55) {
+        celsius = -55;
+    } else if (celsius > 125) {
+        celsius = 125;
+    }
+    int reading = (int)floor(celsius * 16 + 0.5);
+    return reading & ~((1 << (12 - this->resolution())) - 1);
+}
+
+sim_time_t DS18B20::conversion_ns() const {
+    return MAX_CONVERSION_NS >> (12 - this->resolution());
+}
+
+void DS18B20::update_conversion(sim_time_t now) {
+    if (!this->converting || now < this->convert_done) {
+        return;
+    }
+    this->converting = false;
+    int reading = this->convert_result;
+    if (!this->convert_powered) {
+        // browned out, the register is left at its power on value
+        reading = POWER_ON_READING;
+        this->failed_conversions++;
+    }
+    this->scratchpad[0] = reading & 0xFF;
+    this->scratchpad[1] = (reading >> 8) & 0xFF;
+}
+
+void DS18B20::send(const unsigned char *bytes, int bits) {
+    memcpy(this->tx_bytes, bytes, (bits + 7) / 8);
+    this->tx_bit = 0;
+    this->tx_bits = bits;
+    this->current_state = state_send;
+}
+
+void DS18B20::send_scratchpad() {
+    unsigned char data[9];
+    this->update_conversion(sim_clock().now());
+    this->scratchpad[8] = crc8((const char *)this->scratchpad, 8);
+    memcpy(data, this->scratchpad, 9);
+    this->scratchpad_reads++;
+    bool corrupt = false;
+    if (this->crc_errors > 0) {
+        this->crc_errors--;
+        corrupt = true;
+    } else if (this->crc_error_rate > 0) {
+        corrupt = std::uniform_real_distribution<double>(0, 1)(this->random) < this->crc_error_rate;
+    }
+    if (corrupt) {
+        // a flipped bit anywhere, eg: noise on a long cable
+        int bit = std::uniform_int_distribution<int>(0, 71)(this->random);
+        data[bit / 8] ^= 1 << (bit % 8);
+        this->corrupted_reads++;
+    }
+    this->send(data, 72);
+}
+
+bool DS18B20::bit_to_send() const {
+    if (this->current_state == state_search_rom) {
+        bool bit = (this->rom_code[this->search_bit / 8] >> (this->search_bit % 8)) & 0x01;
+        // the bit, then its complement
+        return this->search_step == 0 ? bit : !bit;
+    }
+    return (this->tx_bytes[this->tx_bit / 8] >> (this->tx_bit % 8)) & 0x01;
+}
+
+void DS18B20::reset(sim_time_t released) {
+    if (!this->is_connected) {
+        return;
+    }
+    this->current_state = state_rom_command;
+    this->rx_bits = 0;
+    this->rx_shift = 0;
+    this->hold_from = released + PRESENCE_START_NS;
+    this->hold_until = released + PRESENCE_END_NS;
+}
+
+void DS18B20::slot_start(sim_time_t now) {
+    if (!this->is_connected) {
+        return;
+    }
+    bool send_zero = false;
+    switch (this->current_state) {
+    case state_send:
+        send_zero = this->tx_bit < this->tx_bits && !this->bit_to_send();
+        break;
+
+    case state_search_rom:
+        send_zero = this->search_step < 2 && !this->bit_to_send();
+        break;
+
+    case state_converting:
+        // externally powered devices read 0 until the conversion is done
+        this->update_conversion(now);
+        send_zero = this->converting && !this->parasite;
+        break;
+
+    default:
+        break;
+    }
+    if (send_zero) {
+        this->hold_from = now;
+        this->hold_until = now + SLOT_HOLD_NS;
+    }
+}
+
+void DS18B20::slot_end(bool bit) {
+    if (!this->is_connected) {
+        return;
+    }
+    switch (this->current_state) {
+    case state_idle:
+    case state_converting:
+        break;
+
+    case state_send:
+        if (++this->tx_bit >= this->tx_bits) {
+            this->current_state = state_idle;
+        }
+        break;
+
+    case state_search_rom:
+        if (this->search_step < 2) {
+            this->search_step++;
+            break;
+        }
+        // the master's choice of direction, devices with the other bit drop out
+        if (bit != (bool)((this->rom_code[this->search_bit / 8] >> (this->search_bit % 8)) & 0x01)) {
+            this->current_state = state_idle;
+            break;
+        }
+        this->search_step = 0;
+        if (++this->search_bit == 64) {
+            this->current_state = state_function_command;
+            this->rx_bits = 0;
+        }
+        break;
+
+    default:
+        this->rx_shift |= (unsigned)bit << this->rx_bits;
+        if (++this->rx_bits == 8) {
+            unsigned char byte = this->rx_shift;
+            this->rx_bits = 0;
+            this->rx_shift = 0;
+            this->received_byte(byte);
+        }
+        break;
+    }
+}
+
+void DS18B20::received_byte(unsigned char byte) {
+    switch (this->current_state) {
+    case state_rom_command:
+        switch (byte) {
+        case COMMAND_READ_ROM:
+            this->send(this->rom_code, 64);
+            break;
+        case COMMAND_MATCH_ROM:
+            this->current_state = state_match_rom;
+            this->rx_count = 0;
+            break;
+        case COMMAND_SKIP_ROM:
+            this->current_state = state_function_command;
+            break;
+        case COMMAND_ALARM_SEARCH: {
+            // alarmed if the integer part of the reading is >= TH or <= TL
+            int degrees = (short)(this->scratchpad[0] | this->scratchpad[1] << 8) >> 4;
+            if (degrees < (signed char)this->scratchpad[2] && degrees > (signed char)this->scratchpad[3]) {
+                this->current_state = state_idle;
+                break;
+            }
+        }
+            // fall through, and take part in the search
+        case COMMAND_SEARCH_ROM:
+            this->current_state = state_search_rom;
+            this->search_bit = 0;
+            this->search_step = 0;
+            break;
+        default:
+            this->current_state = state_idle;
+            break;
+        }
+        break;
+
+    case state_match_rom:
+        if (byte != this->rom_code[this->rx_count]) {
+            this->current_state = state_idle;
+        } else if (++this->rx_count == 8) {
+            this->current_state = state_function_command;
+        }
+        break;
+
+    case state_function_command:
+        switch (byte) {
+        case COMMAND_CONVERT:
+            this->conversions++;
+            this->converting = true;
+            this->convert_done = sim_clock().now() + this->conversion_ns();
+            this->convert_result = this->conversion_reading();
+            // parasite devices lose it if the bus isn't held up, see power()
+            this->convert_powered = true;
+            this->current_state = state_converting;
+            break;
+        case COMMAND_READ_SCRATCHPAD:
+            this->send_scratchpad();
+            break;
+        case COMMAND_WRITE_SCRATCHPAD:
+            this->current_state = state_write_scratchpad;
+            this->rx_count = 0;
+            break;
+        case COMMAND_COPY_SCRATCHPAD:
+            memcpy(this->eeprom, this->scratchpad + 2, 3);
+            this->current_state = state_idle;
+            break;
+        case COMMAND_RECALL_EEPROM:
+            memcpy(this->scratchpad + 2, this->eeprom, 3);
+            this->current_state = state_idle;
+            break;
+        case COMMAND_READ_POWER: {
+            unsigned char powered = this->parasite ? 0x00 : 0x01;
+            this->send(&powered, 1);
+            break;
+        }
+        default:
+            this->current_state = state_idle;
+            break;
+        }
+        break;
+
+    case state_write_scratchpad:
+        // TH, TL, then the configuration register whose other bits read as set
+        this->scratchpad[2 + this->rx_count] = this->rx_count == 2 ? (byte & 0x60) | 0x1F : byte;
+        if (++this->rx_count == 3) {
+            this->current_state = state_idle;
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+void DS18B20::power(sim_time_t now, bool strong) {
+    if (this->parasite && this->converting && now < this->convert_done && !strong) {
+        this->convert_powered = false;
+    }
+}
+
+OneWireBus::OneWireBus() {
+    this->resets = 0;
+    this->slots = 0;
+    this->bad_pulses = 0;
+    this->master_low = false;
+    this->fell_at = 0;
+}
+
+void OneWireBus::mcu_changed(SimPin &pin) {
+    sim_time_t now = sim_clock().now();
+    bool low = pin.is_output() && pin.value() == 0;
+    if (low && !this->master_low) {
+        this->fell_at = now;
+        for (size_t i = 0; i < this->devices.size(); i++) {
+            this->devices[i]->slot_start(now);
+        }
+    } else if (!low && this->master_low) {
+        sim_time_t length = now - this->fell_at;
+        if (length >= MIN_RESET_NS) {
+            this->resets++;
+            for (size_t i = 0; i < this->devices.size(); i++) {
+                this->devices[i]->reset(now);
+            }
+        } else if (length <= MAX_SLOT_NS) {
+            this->slots++;
+            for (size_t i = 0; i < this->devices.size(); i++) {
+                this->devices[i]->slot_end(length < SLOT_SAMPLE_NS);
+            }
+        } else {
+            this->bad_pulses++;
+        }
+    }
+    this->master_low = low;
+    // the master driving the line high is the strong pullup
+    bool strong = pin.is_output() && pin.value() == 1;
+    for (size_t i = 0; i < this->devices.size(); i++) {
+        this->devices[i]->power(now, strong);
+    }
+}
+
+pin_drive OneWireBus::drive(const SimPin &pin) const {
+    sim_time_t now = sim_clock().now();
+    for (size_t i = 0; i < this->devices.size(); i++) {
+        if (this->devices[i]->is_connected && this->devices[i]->pulling_low(now)) {
+            return pin_low;
+        }
+    }
+    return pin_pull_up;
+}
@@ -0,0 +1,177 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef SIM_ONE_WIRE_BUS_H
+#define SIM_ONE_WIRE_BUS_H
+
+#include <random>
+#include <vector>
+
+#include "Pins.h"
+#include "VirtualClock.h"
+
+class Plant;
+
+// DS18B20 is a bit level model of a Maxim DS18B20 on a OneWireBus: ROM
+// commands including search, the scratchpad, conversions taking their
+// datasheet time at each resolution, parasite power and faults on demand.
+class DS18B20 {
+public:
+    // rom is the 8 byte ROM code, family code first, with its CRC
+    DS18B20(const unsigned char rom[8]);
+
+    const unsigned char *rom() const {
+        return this->rom_code;
+    }
+
+    // the temperature the next conversion measures, fixed or following a
+    // Plant (plus offset)
+    void set_temperature(double celsius);
+    void follow(Plant *plant, double offset);
+    double temperature() const;
+
+    // 9 - 12 bits, as if configured and copied to EEPROM before power up
+    void set_resolution(int bits);
+    int resolution() const;
+
+    // parasite powered devices report so to read power supply, and their
+    // conversions fail (reading 85C) unless the master holds the bus high
+    void set_parasite(bool parasite) {
+        this->parasite = parasite;
+    }
+
+    // corrupt the next count scratchpad reads / a fraction of them at
+    // random, so that their CRC doesn't match
+    void inject_crc_errors(int count) {
+        this->crc_errors = count;
+    }
+    void set_crc_error_rate(double rate) {
+        this->crc_error_rate = rate;
+    }
+
+    // a disconnected device doesn't answer anything
+    void set_connected(bool connected);
+    bool connected() const {
+        return this->is_connected;
+    }
+
+    // stats
+    unsigned conversions;
+    unsigned failed_conversions;
+    unsigned scratchpad_reads;
+    unsigned corrupted_reads;
+
+private:
+    friend class OneWireBus;
+
+    enum state {
+        // waiting for a reset pulse
+        state_idle,
+        state_rom_command,
+        state_match_rom,
+        state_search_rom,
+        state_function_command,
+        state_write_scratchpad,
+        // sending tx_bytes, then idle
+        state_send,
+        // conversion in progress, read slots return 0 until it is done
+        state_converting
+    };
+
+    unsigned char rom_code[8];
+    unsigned char scratchpad[9];
+    unsigned char eeprom[3];
+    bool parasite;
+    bool is_connected;
+    int crc_errors;
+    double crc_error_rate;
+    double fixed_temperature;
+    Plant *plant;
+    double plant_offset;
+    std::mt19937 random;
+
+    state current_state;
+    // bits received / being sent, least significant first
+    int rx_bits;
+    unsigned rx_shift;
+    int rx_count;
+    unsigned char tx_bytes[9];
+    int tx_bit;
+    int tx_bits;
+    // search ROM: the ROM bit, and which of bit / complement / direction
+    int search_bit;
+    int search_step;
+    // the bus is pulled low from hold_from to hold_until
+    sim_time_t hold_from;
+    sim_time_t hold_until;
+    // conversion in progress, carries on through resets
+    bool converting;
+    sim_time_t convert_done;
+    int convert_result;
+    bool convert_powered;
+
+    void update_conversion(sim_time_t now);
+    int conversion_reading() const;
+    sim_time_t conversion_ns() const;
+    void send(const unsigned char *bytes, int bits);
+    void send_scratchpad();
+    bool bit_to_send() const;
+
+    // bus events
+    void reset(sim_time_t released);
+    void slot_start(sim_time_t now);
+    void slot_end(bool bit);
+    void power(sim_time_t now, bool strong);
+    void received_byte(unsigned char byte);
+    bool pulling_low(sim_time_t now) const {
+        return now >= this->hold_from && now < this->hold_until;
+    }
+};
+
+// OneWireBus is the data line and pullup with the devices on it, decoding
+// the master's reset pulses and time slots from when it pulls the line low
+// and releases it, as a device would.
+class OneWireBus : public PinDevice {
+public:
+    OneWireBus();
+
+    void add(DS18B20 *device) {
+        this->devices.push_back(device);
+    }
+
+    int count() const {
+        return (int)this->devices.size();
+    }
+
+    DS18B20 *device(int index) {
+        return this->devices[index];
+    }
+
+    void mcu_changed(SimPin &pin);
+    pin_drive drive(const SimPin &pin) const;
+
+    // stats
+    unsigned resets;
+    unsigned long long slots;
+    // low pulses too long for a slot and too short for a reset
+    unsigned bad_pulses;
+
+private:
+    std::vector<DS18B20 *> devices;
+    bool master_low;
+    sim_time_t fell_at;
+};
+
+#endif
@@ -0,0 +1,95 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "Pins.h"
+
+#include <algorithm>
+
+SimPin::SimPin() {
+    this->output = false;
+    this->latch = 0;
+    // the LPC1768 resets with every pin's pullup on
+    this->pin_mode = mode_pull_up;
+    this->device = NULL;
+    this->last_level = this->level();
+}
+
+void SimPin::set_output(bool output) {
+    if (this->output != output) {
+        this->output = output;
+        this->mcu_changed();
+    }
+}
+
+void SimPin::set_value(int value) {
+    value = value ? 1 : 0;
+    if (this->latch != value) {
+        this->latch = value;
+        if (this->output) {
+            this->mcu_changed();
+        }
+    }
+}
+
+void SimPin::set_mode(int mode) {
+    if (this->pin_mode != mode) {
+        this->pin_mode = mode;
+        this->mcu_changed();
+    }
+}
+
+int SimPin::level() const {
+    pin_drive drive = this->device ? this->device->drive(*this) : pin_float;
+    if (drive == pin_low) {
+        return 0;
+    }
+    if (this->output) {
+        return this->latch;
+    }
+    if (drive != pin_float) {
+        return 1;
+    }
+    return this->pin_mode == mode_pull_up ? 1 : 0;
+}
+
+void SimPin::mcu_changed() {
+    if (this->device) {
+        this->device->mcu_changed(*this);
+    }
+    this->changed();
+}
+
+void SimPin::changed() {
+    int level = this->level();
+    if (level == this->last_level) {
+        return;
+    }
+    this->last_level = level;
+    // copied, a watcher may unwatch from its handler
+    std::vector<PinWatcher *> watchers(this->watchers);
+    for (size_t i = 0; i < watchers.size(); i++) {
+        watchers[i]->edge(level);
+    }
+}
+
+void SimPin::watch(PinWatcher *watcher) {
+    this->last_level = this->level();
+    this->watchers.push_back(watcher);
+}
+
+void SimPin::unwatch(PinWatcher *watcher) {
+    this->watchers.erase(std::remove(this->watchers.begin(), this->watchers.end(), watcher),
+                         this->watchers.end());
+}
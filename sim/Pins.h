@@ -0,0 +1,110 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef SIM_PINS_H
+#define SIM_PINS_H
+
+#include <vector>
+
+// what a device attached to a pin does to it
+enum pin_drive {
+    pin_float = -1,
+    pin_low = 0,
+    pin_high = 1,
+    // a pullup resistor, the MCU driving the pin overrides it
+    pin_pull_up = 2
+};
+
+class SimPin;
+
+// PinDevice is the hardware on the other end of a pin
+class PinDevice {
+public:
+    virtual ~PinDevice() {}
+
+    // the MCU changed how it drives pin (direction, output level or mode)
+    virtual void mcu_changed(SimPin &pin) {}
+
+    // how the device drives pin right now
+    virtual pin_drive drive(const SimPin &pin) const {
+        return pin_float;
+    }
+};
+
+// PinWatcher is told about edges on a pin, for InterruptIn
+class PinWatcher {
+public:
+    virtual ~PinWatcher() {}
+    virtual void edge(bool rising) = 0;
+};
+
+// SimPin is one MCU pin, the MCU side is set through the mbed API, the
+// other side by at most one PinDevice.
+// A device that drives a pin watched for edges must call changed() when
+// what it drives changes, the 1-Wire bus doesn't as nothing watches it.
+class SimPin {
+public:
+    // mbed's PinMode values for the LPC1768
+    enum {
+        mode_pull_up = 0,
+        mode_repeater = 1,
+        mode_pull_none = 2,
+        mode_pull_down = 3,
+        mode_open_drain = 4
+    };
+
+    SimPin();
+
+    // MCU side
+    void set_output(bool output);
+    void set_value(int value);
+    void set_mode(int mode);
+
+    bool is_output() const {
+        return this->output;
+    }
+    int value() const {
+        return this->latch;
+    }
+    int mode() const {
+        return this->pin_mode;
+    }
+
+    // the level on the pin, resolving the MCU and device drives: the device
+    // pulling low wins (open drain), then the MCU driving, then the device,
+    // then the MCU's pull resistor
+    int level() const;
+
+    // device side
+    void attach(PinDevice *device) {
+        this->device = device;
+    }
+    void changed();
+
+    void watch(PinWatcher *watcher);
+    void unwatch(PinWatcher *watcher);
+
+private:
+    bool output;
+    int latch;
+    int pin_mode;
+    PinDevice *device;
+    std::vector<PinWatcher *> watchers;
+    int last_level;
+
+    void mcu_changed();
+};
+
+#endif
@@ -0,0 +1,83 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "PtyLink.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+static void pty_error(const char *what) {
+    fprintf(stderr, "sim: %s: %s\n", what, strerror(errno));
+    exit(1);
+}
+
+PtyLink::PtyLink(const std::string &link) : link(link) {
+    this->master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (this->master < 0 || grantpt(this->master) != 0 || unlockpt(this->master) != 0) {
+        pty_error("can't open a pty");
+    }
+    this->slave_name = ptsname(this->master);
+    this->slave = open(this->slave_name.c_str(), O_RDWR | O_NOCTTY);
+    if (this->slave < 0) {
+        pty_error("can't open the pty's terminal");
+    }
+    // no echo or line editing, the firmware sees exactly what is sent
+    struct termios settings;
+    if (tcgetattr(this->slave, &settings) != 0) {
+        pty_error("tcgetattr");
+    }
+    cfmakeraw(&settings);
+    cfsetispeed(&settings, B115200);
+    cfsetospeed(&settings, B115200);
+    if (tcsetattr(this->slave, TCSANOW, &settings) != 0) {
+        pty_error("tcsetattr");
+    }
+    if (!this->link.empty()) {
+        unlink(this->link.c_str());
+        if (symlink(this->slave_name.c_str(), this->link.c_str()) != 0) {
+            pty_error(this->link.c_str());
+        }
+    }
+}
+
+PtyLink::~PtyLink() {
+    if (!this->link.empty()) {
+        unlink(this->link.c_str());
+    }
+    close(this->slave);
+    close(this->master);
+}
+
+void PtyLink::write(unsigned char c) {
+    if (::write(this->master, &c, 1) != 1 && errno != EAGAIN) {
+        pty_error("pty write");
+    }
+}
+
+int PtyLink::read(char *buffer, int size) {
+    ssize_t n = ::read(this->master, buffer, size);
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EINTR) {
+            pty_error("pty read");
+        }
+        return 0;
+    }
+    return (int)n;
+}
@@ -0,0 +1,53 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef SIM_PTY_LINK_H
+#define SIM_PTY_LINK_H
+
+#include <string>
+
+// PtyLink is the other end of the simulated serial port as a pseudo
+// terminal, so that host programs (eg: the bridge in bridge/) can talk to
+// the simulated firmware as if it were plugged in over USB.
+class PtyLink {
+public:
+    // open a raw pty, with a symlink to it at link unless link is empty,
+    // exits if that fails
+    PtyLink(const std::string &link);
+    // removes the link
+    ~PtyLink();
+
+    // the terminal for host programs to open, eg: /dev/pts/3
+    const std::string &name() const {
+        return this->slave_name;
+    }
+
+    // a byte from the firmware, dropped if the host isn't keeping up, as
+    // the USB serial bridge would
+    void write(unsigned char c);
+
+    // bytes from the host, returns how many without blocking
+    int read(char *buffer, int size);
+
+private:
+    int master;
+    // held open, so that the master doesn't see a hangup whenever the
+    // host program closes it
+    int slave;
+    std::string slave_name;
+    std::string link;
+};
+
+#endif
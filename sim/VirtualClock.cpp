@@ -0,0 +1,148 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "VirtualClock.h"
+
+#include <algorithm>
+
+VirtualClock &sim_clock() {
+    // never destroyed, events may still be cancelled during exit
+    static VirtualClock *clock = new VirtualClock();
+    return *clock;
+}
+
+ClockEvent::ClockEvent() : is_scheduled(false), at(0), sequence(0) {}
+
+ClockEvent::~ClockEvent() {
+    this->cancel();
+}
+
+void ClockEvent::schedule_at(sim_time_t at) {
+    VirtualClock &clock = sim_clock();
+    this->cancel();
+    this->at = std::max(at, clock.now());
+    this->sequence = clock.next_sequence++;
+    this->is_scheduled = true;
+    clock.events[VirtualClock::event_key(this->at, this->sequence)] = this;
+}
+
+void ClockEvent::schedule_in(sim_time_t ns) {
+    this->schedule_at(sim_clock().now() + ns);
+}
+
+void ClockEvent::cancel() {
+    if (this->is_scheduled) {
+        sim_clock().events.erase(VirtualClock::event_key(this->at, this->sequence));
+        this->is_scheduled = false;
+    }
+}
+
+Interrupt::Interrupt() : is_pending(false) {}
+
+Interrupt::~Interrupt() {
+    this->clear();
+}
+
+void Interrupt::raise() {
+    if (!this->is_pending) {
+        this->is_pending = true;
+        sim_clock().pending.push_back(this);
+    }
+}
+
+void Interrupt::clear() {
+    if (this->is_pending) {
+        std::deque<Interrupt *> &pending = sim_clock().pending;
+        pending.erase(std::find(pending.begin(), pending.end(), this));
+        this->is_pending = false;
+    }
+}
+
+VirtualClock::VirtualClock() {
+    this->now_ns = 0;
+    this->next_sequence = 0;
+    this->primask = false;
+    this->critical_depth = 0;
+    this->isr_depth = 0;
+    this->total_events = 0;
+    this->total_interrupts = 0;
+    this->slept_ns = 0;
+}
+
+void VirtualClock::advance(sim_time_t ns) {
+    this->advance_to(this->now_ns + ns);
+}
+
+void VirtualClock::advance_to(sim_time_t at) {
+    // events and handlers may advance the clock themselves (wait_us in an
+    // ISR), so always take the earliest event left rather than iterating
+    while (!this->events.empty() && this->events.begin()->first.first <= at) {
+        std::map<event_key, ClockEvent *>::iterator next = this->events.begin();
+        ClockEvent *event = next->second;
+        this->events.erase(next);
+        event->is_scheduled = false;
+        this->now_ns = std::max(this->now_ns, event->at);
+        this->total_events++;
+        event->on_time();
+        this->deliver();
+    }
+    this->now_ns = std::max(this->now_ns, at);
+    this->deliver();
+}
+
+bool VirtualClock::sleep() {
+    sim_time_t start = this->now_ns;
+    unsigned long long handled = this->total_interrupts;
+    while (this->pending.empty() && this->total_interrupts == handled) {
+        if (this->events.empty()) {
+            return false;
+        }
+        this->advance_to(this->events.begin()->first.first);
+    }
+    this->slept_ns += this->now_ns - start;
+    return true;
+}
+
+void VirtualClock::disable_irq() {
+    this->primask = true;
+}
+
+void VirtualClock::enable_irq() {
+    this->primask = false;
+    this->deliver();
+}
+
+void VirtualClock::critical_enter() {
+    this->critical_depth++;
+}
+
+void VirtualClock::critical_exit() {
+    if (this->critical_depth > 0) {
+        this->critical_depth--;
+    }
+    this->deliver();
+}
+
+void VirtualClock::deliver() {
+    while (!this->masked() && !this->pending.empty()) {
+        Interrupt *interrupt = this->pending.front();
+        this->pending.pop_front();
+        interrupt->is_pending = false;
+        this->isr_depth++;
+        interrupt->handle();
+        this->isr_depth--;
+        this->total_interrupts++;
+    }
+}
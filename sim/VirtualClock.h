@@ -0,0 +1,173 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef SIM_VIRTUAL_CLOCK_H
+#define SIM_VIRTUAL_CLOCK_H
+
+#include <deque>
+#include <map>
+#include <utility>
+
+// nanoseconds of simulated time since the simulation started
+typedef unsigned long long sim_time_t;
+
+#define SIM_US(us) ((sim_time_t)(us) * 1000)
+#define SIM_MS(ms) ((sim_time_t)(ms) * 1000000)
+
+// ClockEvent is something that happens at a point in simulated time, eg: a
+// timer expiring or a device changing a pin. Events are hardware, they run
+// on time whether or not interrupts are masked, and raise an Interrupt for
+// the firmware to see them.
+class ClockEvent {
+public:
+    ClockEvent();
+    virtual ~ClockEvent();
+
+    // (re)schedule the event, at must not be in the past
+    void schedule_at(sim_time_t at);
+    void schedule_in(sim_time_t ns);
+    void cancel();
+
+    bool scheduled() const {
+        return this->is_scheduled;
+    }
+
+    sim_time_t when() const {
+        return this->at;
+    }
+
+protected:
+    virtual void on_time() = 0;
+
+private:
+    friend class VirtualClock;
+    bool is_scheduled;
+    sim_time_t at;
+    unsigned long long sequence;
+};
+
+// a ClockEvent calling method on owner
+template <class T, void (T::*method)()>
+class MemberEvent : public ClockEvent {
+public:
+    MemberEvent(T *owner) : owner(owner) {}
+
+protected:
+    void on_time() {
+        (this->owner->*method)();
+    }
+
+private:
+    T *owner;
+};
+
+// Interrupt is an interrupt source, raise() pends it and handle() runs as
+// soon as interrupts are unmasked and no other handler is running.
+// Raising an already pending interrupt does nothing, like the NVIC.
+class Interrupt {
+public:
+    Interrupt();
+    virtual ~Interrupt();
+
+    void raise();
+    void clear();
+
+    bool pending() const {
+        return this->is_pending;
+    }
+
+protected:
+    virtual void handle() = 0;
+
+private:
+    friend class VirtualClock;
+    bool is_pending;
+};
+
+// VirtualClock is simulated time. It only moves forward when the firmware
+// waits (wait_us, sleep, a blocking serial write), and then jumps straight
+// from event to event, running each on time, so the firmware runs as fast
+// as the host can execute it while seeing real time timings.
+// Everything else, the firmware's own code included, takes no time at all.
+class VirtualClock {
+public:
+    VirtualClock();
+
+    sim_time_t now() const {
+        return this->now_ns;
+    }
+
+    // move time forward by ns / to at, running the events due on the way
+    // and delivering their interrupts when unmasked
+    void advance(sim_time_t ns);
+    void advance_to(sim_time_t at);
+
+    // wait for an interrupt, like WFI: skips to the next events until one
+    // is pending or has been handled. returns false if nothing is scheduled
+    // to ever happen
+    bool sleep();
+
+    // PRIMASK, __disable_irq / __enable_irq
+    void disable_irq();
+    void enable_irq();
+    // core_util_critical_section_enter / exit, which nest
+    void critical_enter();
+    void critical_exit();
+
+    bool in_isr() const {
+        return this->isr_depth > 0;
+    }
+
+    // totals, for the simulation report
+    unsigned long long events_run() const {
+        return this->total_events;
+    }
+    unsigned long long interrupts_handled() const {
+        return this->total_interrupts;
+    }
+    sim_time_t slept() const {
+        return this->slept_ns;
+    }
+
+private:
+    friend class ClockEvent;
+    friend class Interrupt;
+
+    typedef std::pair<sim_time_t, unsigned long long> event_key;
+
+    sim_time_t now_ns;
+    unsigned long long next_sequence;
+    std::map<event_key, ClockEvent *> events;
+    std::deque<Interrupt *> pending;
+    bool primask;
+    int critical_depth;
+    int isr_depth;
+
+    unsigned long long total_events;
+    unsigned long long total_interrupts;
+    sim_time_t slept_ns;
+
+    bool masked() const {
+        return this->primask || this->critical_depth > 0 || this->isr_depth > 0;
+    }
+
+    void deliver();
+};
+
+// the simulation's clock, created on first use as the firmware's global
+// objects use it during static initialization
+VirtualClock &sim_clock();
+
+#endif
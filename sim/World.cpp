@@ -0,0 +1,591 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "World.h"
+
+#include <signal.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include "../CRC8.h"
+#include "../Protocol.h"
+
+// the pinout in main.cpp
+#define TEMPERATURE_PROBE_PIN p8
+#define TEMPERATURE_PROBE_UART_TX p13
+#define HEATER_PIN p21
+#define WATER_HCSR04_TRIG_PIN p22
+#define WATER_HCSR04_ECHO_PIN p23
+#define RESET_PIN p6
+
+// used without $SIM_SCRIPT
+static const char default_script[] =
+    "# a probe in the pot, the water 6\" below the sensor, polled every second\n"
+    "ds18b20 28FF4B6A641604 plant\n"
+    "hcsr04 distance=6 noise=0.05\n"
+    "every 1000 send \"S+?\\n\"\n"
+    "end 60000\n";
+
+static const char *configured_name = NULL;
+static const char *configured_script = NULL;
+static bool created = false;
+
+// with a pty the simulation runs until it is interrupted
+static volatile sig_atomic_t interrupted = 0;
+
+static void on_interrupt(int) {
+    interrupted = 1;
+}
+
+World &World::get() {
+    // never destroyed, the firmware's globals outlive it otherwise
+    static World *world = new World();
+    return *world;
+}
+
+void World::configure(const char *name, const char *script) {
+    if (created) {
+        fprintf(stderr, "sim: World::configure(%s) after the hardware was used\n", name);
+        exit(1);
+    }
+    configured_name = name;
+    configured_script = script;
+}
+
+World::World()
+    : ssr(&this->plant),
+      ranger(&this->pins[WATER_HCSR04_TRIG_PIN], &this->pins[WATER_HCSR04_ECHO_PIN]),
+      end_event(this),
+      pump_event(this) {
+    created = true;
+    this->pty = NULL;
+    this->observer = NULL;
+    this->wall_start = std::chrono::steady_clock::now();
+    this->transcript = true;
+    this->finishing = false;
+    this->pins[TEMPERATURE_PROBE_PIN].attach(&this->bus);
+    this->pins[HEATER_PIN].attach(&this->ssr);
+    this->pins[WATER_HCSR04_TRIG_PIN].attach(&this->ranger);
+    this->pins[WATER_HCSR04_ECHO_PIN].attach(&this->ranger);
+    this->pins[RESET_PIN].attach(&this->reset_line);
+    this->serial.set_host(this);
+    this->end_event.schedule_at(SIM_MS(60000));
+
+    if (configured_script) {
+        this->load(configured_name, configured_script);
+        return;
+    }
+    const char *path = getenv("SIM_SCRIPT");
+    if (!path) {
+        this->load("<default>", default_script);
+        return;
+    }
+    std::ifstream file(path);
+    if (!file) {
+        fprintf(stderr, "sim: can't read %s\n", path);
+        exit(1);
+    }
+    std::stringstream script;
+    script << file.rdbuf();
+    this->load(path, script.str());
+}
+
+SimPin &World::pin(int name) {
+    if (name < 0 || name >= (int)(sizeof(this->pins) / sizeof(this->pins[0]))) {
+        return this->unconnected;
+    }
+    return this->pins[name];
+}
+
+SerialPort &World::probe_uart() {
+    // TX through the buffer and RX both on the data line, one pin here
+    this->pins[TEMPERATURE_PROBE_PIN].attach(NULL);
+    this->pins[TEMPERATURE_PROBE_UART_TX].attach(&this->bus);
+    this->uart1.set_wire(&this->pins[TEMPERATURE_PROBE_UART_TX]);
+    return this->uart1;
+}
+
+static void script_error(const char *name, int line, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "%s:%d: ", name, line);
+    vfprintf(stderr, format, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    exit(1);
+}
+
+// split a line into words, "quoted" words may contain spaces and escapes
+static bool split(const std::string &line, std::vector<std::string> *words) {
+    size_t i = 0;
+    while (i < line.size()) {
+        char c = line[i];
+        if (c == '#') {
+            break;
+        }
+        if (isspace((unsigned char)c)) {
+            i++;
+            continue;
+        }
+        std::string word;
+        if (c != '"') {
+            while (i < line.size() && !isspace((unsigned char)line[i])) {
+                word += line[i++];
+            }
+            words->push_back(word);
+            continue;
+        }
+        for (i++; i < line.size() && line[i] != '"'; i++) {
+            if (line[i] != '\\' || i + 1 == line.size()) {
+                word += line[i];
+                continue;
+            }
+            switch (line[++i]) {
+            case 'n': word += '\n'; break;
+            case 'r': word += '\r'; break;
+            case 't': word += '\t'; break;
+            case '0': word += '\0'; break;
+            case 'x':
+                if (i + 2 >= line.size()) {
+                    return false;
+                }
+                word += (char)strtol(line.substr(i + 1, 2).c_str(), NULL, 16);
+                i += 2;
+                break;
+            default: word += line[i]; break;
+            }
+        }
+        if (i == line.size()) {
+            return false;
+        }
+        i++;
+        words->push_back(word);
+    }
+    return true;
+}
+
+static bool parse_number(const std::string &text, double *value) {
+    char *end;
+    *value = strtod(text.c_str(), &end);
+    return !text.empty() && *end == '\0';
+}
+
+static bool parse_hex(const std::string &text, std::vector<unsigned char> *bytes) {
+    if (text.size() % 2 != 0) {
+        return false;
+    }
+    for (size_t i = 0; i < text.size(); i += 2) {
+        char *end;
+        std::string pair = text.substr(i, 2);
+        bytes->push_back((unsigned char)strtol(pair.c_str(), &end, 16));
+        if (*end != '\0') {
+            return false;
+        }
+    }
+    return true;
+}
+
+// key=value options, a bare key has the value ""
+static void options(const std::vector<std::string> &words, size_t first,
+                    std::vector<std::pair<std::string, std::string> > *out) {
+    for (size_t i = first; i < words.size(); i++) {
+        size_t equals = words[i].find('=');
+        if (equals == std::string::npos) {
+            out->push_back(std::make_pair(words[i], std::string()));
+        } else {
+            out->push_back(std::make_pair(words[i].substr(0, equals), words[i].substr(equals + 1)));
+        }
+    }
+}
+
+void World::load(const char *name, const std::string &script) {
+    std::istringstream lines(script);
+    std::string line;
+    for (int number = 1; std::getline(lines, line); number++) {
+        std::vector<std::string> words;
+        if (!split(line, &words)) {
+            script_error(name, number, "unterminated string");
+        }
+        if (!words.empty()) {
+            this->parse(name, number, words);
+        }
+    }
+    for (size_t i = 0; i < this->actions.size(); i++) {
+        const std::vector<std::string> &words = this->actions[i]->words;
+        double probe;
+        bool names_probe = words[0] == "temperature" || words[0] == "crc";
+        if (names_probe && parse_number(words[1], &probe) && probe >= this->probes.size()) {
+            script_error(name, this->actions[i]->line, "no probe %s", words[1].c_str());
+        }
+        if (words.size() == 3 && words[1] == "probe" && parse_number(words[2], &probe)
+            && probe >= this->probes.size()) {
+            script_error(name, this->actions[i]->line, "no probe %s", words[2].c_str());
+        }
+    }
+}
+
+void World::parse(const char *name, int line, const std::vector<std::string> &words) {
+    const std::string &command = words[0];
+    std::vector<std::pair<std::string, std::string> > opts;
+    double value;
+
+    if (command == "ds18b20") {
+        std::vector<unsigned char> rom;
+        if (words.size() < 2 || !parse_hex(words[1], &rom) || (rom.size() != 7 && rom.size() != 8)) {
+            script_error(name, line, "ds18b20 needs a 7 or 8 byte hex ROM code");
+        }
+        if (rom.size() == 7) {
+            rom.push_back(crc8((const char *)&rom[0], 7));
+        }
+        DS18B20 *probe = new DS18B20(&rom[0]);
+        options(words, 2, &opts);
+        for (size_t i = 0; i < opts.size(); i++) {
+            const std::string &key = opts[i].first;
+            bool numeric = parse_number(opts[i].second, &value);
+            if (key == "resolution" && numeric && value >= 9 && value <= 12) {
+                probe->set_resolution((int)value);
+            } else if (key == "temperature" && numeric) {
+                probe->set_temperature(value);
+            } else if (key == "plant") {
+                probe->follow(&this->plant, numeric ? value : 0);
+            } else if (key == "parasite" && opts[i].second.empty()) {
+                probe->set_parasite(true);
+            } else if (key == "crc_errors" && numeric) {
+                probe->inject_crc_errors((int)value);
+            } else if (key == "crc_error_rate" && numeric) {
+                probe->set_crc_error_rate(value);
+            } else {
+                script_error(name, line, "bad ds18b20 option %s", key.c_str());
+            }
+        }
+        this->probes.push_back(probe);
+        this->bus.add(probe);
+    } else if (command == "hcsr04") {
+        options(words, 1, &opts);
+        for (size_t i = 0; i < opts.size(); i++) {
+            const std::string &key = opts[i].first;
+            bool numeric = parse_number(opts[i].second, &value);
+            if (key == "distance" && numeric) {
+                this->ranger.set_distance(value);
+            } else if (key == "noise" && numeric) {
+                this->ranger.set_noise(value);
+            } else if (key == "outliers" && numeric) {
+                this->ranger.set_outlier_rate(value);
+            } else if (key == "disconnected" && opts[i].second.empty()) {
+                this->ranger.set_connected(false);
+            } else {
+                script_error(name, line, "bad hcsr04 option %s", key.c_str());
+            }
+        }
+    } else if (command == "plant") {
+        double ambient = 20, start = -1000, heat = 0.25, loss = 0.002, boil = 100;
+        options(words, 1, &opts);
+        for (size_t i = 0; i < opts.size(); i++) {
+            const std::string &key = opts[i].first;
+            if (!parse_number(opts[i].second, &value)) {
+                script_error(name, line, "bad plant option %s", key.c_str());
+            }
+            if (key == "ambient") {
+                ambient = value;
+            } else if (key == "start") {
+                start = value;
+            } else if (key == "heat") {
+                heat = value;
+            } else if (key == "loss") {
+                loss = value;
+            } else if (key == "boil") {
+                boil = value;
+            } else {
+                script_error(name, line, "bad plant option %s", key.c_str());
+            }
+        }
+        this->plant.configure(ambient, start == -1000 ? ambient : start, heat, loss, boil);
+    } else if (command == "transcript") {
+        if (words.size() != 2 || (words[1] != "on" && words[1] != "off")) {
+            script_error(name, line, "transcript on|off");
+        }
+        this->transcript = words[1] == "on";
+    } else if (command == "flash") {
+        if (words.size() != 2) {
+            script_error(name, line, "flash <file>");
+        }
+        this->flash_memory.keep(words[1]);
+    } else if (command == "serial") {
+        if (words.size() < 2 || words.size() > 3 || words[1] != "pty" || this->pty) {
+            script_error(name, line, "serial pty [<link>]");
+        }
+        this->pty = new PtyLink(words.size() == 3 ? words[2] : "");
+        fprintf(stderr, "sim: serial port on %s%s%s\n", this->pty->name().c_str(),
+                words.size() == 3 ? " linked at " : "", words.size() == 3 ? words[2].c_str() : "");
+        this->pump_event.schedule_in(0);
+        signal(SIGINT, on_interrupt);
+        signal(SIGTERM, on_interrupt);
+    } else if (command == "end") {
+        if (words.size() == 2 && words[1] == "never") {
+            this->end_event.cancel();
+        } else if (words.size() != 2 || !parse_number(words[1], &value) || value < 0) {
+            script_error(name, line, "end <ms> | end never");
+        } else {
+            this->end_event.schedule_at((sim_time_t)(value * 1e6));
+        }
+    } else if (command == "at" || command == "every") {
+        if (words.size() < 3 || !parse_number(words[1], &value) || value < 0
+            || (command == "every" && value == 0)) {
+            script_error(name, line, "%s <ms> <action>", command.c_str());
+        }
+        if (!this->valid_action(words, 2)) {
+            script_error(name, line, "bad action");
+        }
+        Action *action = new Action();
+        action->world = this;
+        action->words.assign(words.begin() + 2, words.end());
+        action->period = command == "every" ? (sim_time_t)(value * 1e6) : 0;
+        action->line = line;
+        action->schedule_at((sim_time_t)(value * 1e6));
+        this->actions.push_back(action);
+    } else {
+        script_error(name, line, "unknown command %s", command.c_str());
+    }
+}
+
+bool World::valid_action(const std::vector<std::string> &words, size_t first) {
+    size_t count = words.size() - first;
+    const std::string &verb = words[first];
+    double value;
+    if (verb == "send") {
+        return count == 2;
+    }
+    if (verb == "frame") {
+        std::vector<unsigned char> bytes;
+        for (size_t i = first + 1; i < words.size(); i++) {
+            if (words[i].size() != 2 || !parse_hex(words[i], &bytes)) {
+                return false;
+            }
+        }
+        return count >= 3 && count - 3 <= FRAME_MAX_PAYLOAD;
+    }
+    if (verb == "temperature" || verb == "crc") {
+        return count == 3 && parse_number(words[first + 1], &value) && value >= 0
+            && parse_number(words[first + 2], &value);
+    }
+    if (verb == "distance") {
+        return count == 2 && parse_number(words[first + 1], &value);
+    }
+    if (verb == "connect" || verb == "disconnect") {
+        return (count == 2 && words[first + 1] == "hcsr04")
+            || (count == 3 && words[first + 1] == "probe" && parse_number(words[first + 2], &value)
+                && value >= 0);
+    }
+    return false;
+}
+
+void World::Action::on_time() {
+    if (this->period) {
+        this->schedule_in(this->period);
+    }
+    this->world->run(*this);
+}
+
+void World::run(const Action &action) {
+    const std::vector<std::string> &words = action.words;
+    const std::string &verb = words[0];
+    if (verb == "send") {
+        const std::string &text = words[1];
+        this->send(text);
+    } else if (verb == "frame") {
+        std::vector<unsigned char> bytes;
+        for (size_t i = 1; i < words.size(); i++) {
+            parse_hex(words[i], &bytes);
+        }
+        char out[FRAME_MAX_ENCODED];
+        int length = frame_encode(bytes[0], bytes[1], (const char *)&bytes[2], bytes.size() - 2, out);
+        this->log('>', std::string(out, length));
+        this->serial.send(out, length);
+    } else if (verb == "temperature") {
+        this->probes[atoi(words[1].c_str())]->set_temperature(atof(words[2].c_str()));
+    } else if (verb == "distance") {
+        this->ranger.set_distance(atof(words[1].c_str()));
+    } else if (verb == "crc") {
+        this->probes[atoi(words[1].c_str())]->inject_crc_errors(atoi(words[2].c_str()));
+    } else if (verb == "connect" || verb == "disconnect") {
+        bool connect = verb == "connect";
+        if (words[1] == "hcsr04") {
+            this->ranger.set_connected(connect);
+        } else {
+            this->probes[atoi(words[2].c_str())]->set_connected(connect);
+        }
+    }
+}
+
+// a line of the transcript: seconds, direction, then text lines as they
+// are and binary frames decoded
+void World::log(char direction, const std::string &data) {
+    if (!this->transcript) {
+        return;
+    }
+    std::string text;
+    bool printable = true;
+    for (size_t i = 0; i < data.size(); i++) {
+        unsigned char c = data[i];
+        if (c == '\n' && i + 1 == data.size()) {
+            break;
+        }
+        if (c == '\r') {
+            text += "\\r";
+        } else if (c < 0x20 || c > 0x7E) {
+            printable = false;
+            break;
+        } else {
+            text += c;
+        }
+    }
+    if (!printable) {
+        char type, sequence, payload[FRAME_MAX_PAYLOAD];
+        int length = data.size() && data[data.size() - 1] == 0
+            ? frame_decode(data.data(), data.size() - 1, &type, &sequence, payload) : -1;
+        char hex[4];
+        if (length < 0) {
+            text = "bytes";
+            for (size_t i = 0; i < data.size(); i++) {
+                snprintf(hex, sizeof(hex), " %02X", (unsigned char)data[i]);
+                text += hex;
+            }
+        } else {
+            snprintf(hex, sizeof(hex), "%02X", (unsigned char)type);
+            text = std::string("frame ") + hex;
+            snprintf(hex, sizeof(hex), "%02X", (unsigned char)sequence);
+            text += std::string(" #") + hex;
+            for (int i = 0; i < length; i++) {
+                snprintf(hex, sizeof(hex), " %02X", (unsigned char)payload[i]);
+                text += hex;
+            }
+        }
+    }
+    printf("%13.6f %c %s\n", sim_clock().now() / 1e9, direction, text.c_str());
+}
+
+// sent to the firmware, by the script or through the pty, a line at a time
+void World::log_sent(const std::string &text) {
+    for (size_t start = 0; start < text.size();) {
+        size_t end = std::min(text.find('\n', start), text.size() - 1) + 1;
+        this->log('>', text.substr(start, end - start));
+        start = end;
+    }
+}
+
+void World::send(const std::string &text) {
+    this->log_sent(text);
+    this->serial.send(text.data(), text.size());
+}
+
+void World::received(unsigned char c) {
+    if (this->pty) {
+        this->pty->write(c);
+    }
+    if (this->observer) {
+        this->observer->received(c);
+    }
+    this->output += (char)c;
+    bool text = true;
+    for (size_t i = 0; i < this->output.size() && text; i++) {
+        unsigned char b = this->output[i];
+        text = (b >= 0x20 && b <= 0x7E) || b == '\r' || b == '\n';
+    }
+    // text lines end with a newline, frames with a zero
+    if ((text && c == '\n') || c == 0 || this->output.size() > 256) {
+        this->log('<', this->output);
+        this->output.clear();
+    }
+}
+
+// wait for real time to catch up with simulated time, then pass on what
+// the host sent through the pty
+void World::pump() {
+    if (interrupted) {
+        this->finish("interrupted", 0);
+    }
+    std::chrono::steady_clock::time_point due =
+        this->wall_start + std::chrono::nanoseconds(sim_clock().now());
+    std::this_thread::sleep_until(due);
+    char buffer[64];
+    int length = this->pty->read(buffer, sizeof(buffer));
+    if (length > 0) {
+        this->send(std::string(buffer, length));
+    }
+    this->pump_event.schedule_in(SIM_MS(1));
+}
+
+void World::end() {
+    this->finish("end of script", 0);
+}
+
+void World::finish(const char *why, int status) {
+    if (this->finishing) {
+        return;
+    }
+    this->finishing = true;
+    if (this->observer) {
+        this->observer->finishing(why, status);
+    }
+    if (!this->output.empty()) {
+        this->log('<', this->output);
+    }
+    VirtualClock &clock = sim_clock();
+    double simulated = clock.now() / 1e9;
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - this->wall_start).count();
+    fflush(stdout);
+    fprintf(stderr, "sim: %s after %.6f s simulated, %.3f s wall, %.1fx real time\n",
+            why, simulated, wall, wall > 0 ? simulated / wall : 0);
+    fprintf(stderr, "sim: idle %.1f%%, %llu events, %llu interrupts\n",
+            simulated > 0 ? clock.slept() / 1e9 / simulated * 100 : 0,
+            clock.events_run(), clock.interrupts_handled());
+    fprintf(stderr, "sim: heater on %.3f s (%.1f%%), %u switches, pot at %.2f C\n",
+            this->ssr.on_ns() / 1e9, simulated > 0 ? this->ssr.on_ns() / 1e9 / simulated * 100 : 0,
+            this->ssr.switches, this->plant.temperature());
+    fprintf(stderr, "sim: serial %llu bytes in (%u overruns), %llu bytes out (blocked %.3f s)\n",
+            this->serial.rx_bytes, this->serial.overruns, this->serial.tx_bytes,
+            this->serial.tx_blocked_ns / 1e9);
+    if (this->uart1.tx_bytes) {
+        fprintf(stderr, "sim: uart1 %llu bytes out (%u overruns)\n",
+                this->uart1.tx_bytes, this->uart1.overruns);
+    }
+    fprintf(stderr, "sim: 1-wire %u resets, %llu slots, %u bad pulses\n",
+            this->bus.resets, this->bus.slots, this->bus.bad_pulses);
+    for (size_t i = 0; i < this->probes.size(); i++) {
+        const DS18B20 *probe = this->probes[i];
+        fprintf(stderr, "sim: probe %d ", (int)i);
+        for (int b = 0; b < 8; b++) {
+            fprintf(stderr, "%02X", probe->rom()[b]);
+        }
+        fprintf(stderr, " %u conversions (%u failed), %u reads (%u corrupted)\n",
+                probe->conversions, probe->failed_conversions,
+                probe->scratchpad_reads, probe->corrupted_reads);
+    }
+    fprintf(stderr, "sim: hc-sr04 %u pings\n", this->ranger.pings);
+    fprintf(stderr, "sim: flash %u sector erases, %u pages programmed\n",
+            this->flash_memory.sector_erases, this->flash_memory.pages_programmed);
+    fprintf(stderr, "sim: watchdog fed %u times%s\n", this->wdt.feeds,
+            this->wdt.running() ? "" : ", not running");
+    fflush(stderr);
+    // removes its link
+    delete this->pty;
+    // skip static destructors, the firmware's globals never expect to run them
+    _exit(status);
+}
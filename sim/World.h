@@ -0,0 +1,157 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef SIM_WORLD_H
+#define SIM_WORLD_H
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "Devices.h"
+#include "OneWireBus.h"
+#include "PtyLink.h"
+
+// WorldObserver is told what the firmware sends and when the simulation
+// ends, for programs built against sim/ other than the simulator itself,
+// eg: the replay tool in replay/
+class WorldObserver {
+public:
+    virtual ~WorldObserver() {}
+    // a byte from the firmware, sent at sim_clock().now()
+    virtual void received(unsigned char c) {}
+    // called before the report when the simulation ends
+    virtual void finishing(const char *why, int status) {}
+};
+
+// World is the simulated hardware around the firmware, wired as in
+// main.cpp, and the script driving it.
+//
+// The script is read from the file named by $SIM_SCRIPT (or a built in
+// default) when the firmware's global objects first touch the hardware,
+// during static initialization. It is line based, # starts a comment:
+//
+//   ds18b20 <ROM hex> [resolution=<9-12>] [temperature=<C> | plant[=<offset C>]]
+//           [parasite] [crc_errors=<count>] [crc_error_rate=<fraction>]
+//       a probe on the 1-Wire bus, with 7 ROM bytes (the CRC is added) or 8
+//   hcsr04 [distance=<inches>] [noise=<inches>] [outliers=<fraction>] [disconnected]
+//   plant [ambient=<C>] [start=<C>] [heat=<C/s>] [loss=<1/s>] [boil=<C>]
+//       the pot the SSR heats, for probes following it
+//   transcript off
+//       don't print the serial traffic, eg: when benchmarking
+//   flash <file>
+//       keep the flash, eg: the probes' ROM codes, in file between runs,
+//       otherwise it starts erased
+//   serial pty [<link>]
+//       also connect the serial port to a pseudo terminal, symlinked at
+//       link, for host programs such as the bridge in bridge/ to talk to.
+//       simulated time is then paced to real time
+//   end <ms> | end never
+//       stop the simulation, the default is 60s
+//   at <ms> <action> / every <ms> <action>
+//       do action at ms, or every ms from then, where action is one of
+//       send "<text>"                  C style escapes, eg: "S+?\n"
+//       frame <type> <seq> [<byte> ...] a binary frame, in hex
+//       temperature <probe> <C>        probes are numbered in script order
+//       distance <inches>
+//       crc <probe> <count>            corrupt the next count reads
+//       disconnect|connect probe <n> / disconnect|connect hcsr04
+class World : public SerialHost {
+public:
+    static World &get();
+
+    // use script instead of $SIM_SCRIPT or the default, for programs built
+    // against sim/ other than the firmware, eg: the benchmarks. must be
+    // called before anything touches the hardware
+    static void configure(const char *name, const char *script);
+
+    SimPin &pin(int name);
+
+    SerialPort &console() {
+        return this->serial;
+    }
+
+    // UART1, running the 1-Wire bus when the firmware is built with
+    // ONEWIRE_UART, the bus moves from its pin to UART1's when first used
+    SerialPort &probe_uart();
+
+    WatchdogModel &watchdog() {
+        return this->wdt;
+    }
+
+    FlashModel &flash() {
+        return this->flash_memory;
+    }
+
+    // bytes sent by the firmware
+    void received(unsigned char c);
+
+    // send text to the firmware, after anything still being sent
+    void send(const std::string &text);
+
+    void observe(WorldObserver *observer) {
+        this->observer = observer;
+    }
+
+    // report on the simulation and exit with status
+    void finish(const char *why, int status);
+
+private:
+    class Action : public ClockEvent {
+    public:
+        World *world;
+        std::vector<std::string> words;
+        sim_time_t period;
+        int line;
+    protected:
+        void on_time();
+    };
+
+    SimPin pins[64];
+    SimPin unconnected;
+    OneWireBus bus;
+    std::vector<DS18B20 *> probes;
+    Plant plant;
+    SSR ssr;
+    HCSR04Model ranger;
+    SerialPort serial;
+    SerialPort uart1;
+    WatchdogModel wdt;
+    FlashModel flash_memory;
+    ResetLine reset_line;
+    std::vector<Action *> actions;
+    bool transcript;
+    std::string output;
+    bool finishing;
+    std::chrono::steady_clock::time_point wall_start;
+    PtyLink *pty;
+    WorldObserver *observer;
+
+    void end();
+    MemberEvent<World, &World::end> end_event;
+    // every simulated ms with a pty
+    void pump();
+    MemberEvent<World, &World::pump> pump_event;
+
+    World();
+    void load(const char *name, const std::string &script);
+    void parse(const char *name, int line, const std::vector<std::string> &words);
+    bool valid_action(const std::vector<std::string> &words, size_t first);
+    void run(const Action &action);
+    void log(char direction, const std::string &text);
+    void log_sent(const std::string &text);
+};
+
+#endif
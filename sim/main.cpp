@@ -0,0 +1,28 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "World.h"
+
+// The simulator's entry point: the firmware's globals have already been
+// constructed against the simulated hardware (see World), run its main()
+// until the script ends, then report.
+
+int firmware_main();
+
+int main() {
+    firmware_main();
+    World::get().finish("main() returned", 1);
+    return 1;
+}
@@ -0,0 +1,414 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "mbed.h"
+
+#include <stdarg.h>
+
+#include "Devices.h"
+#include "World.h"
+
+SimPin &sim_pin(PinName name) {
+    return World::get().pin(name);
+}
+
+DigitalOut::DigitalOut(PinName name, int value) : pin(&sim_pin(name)) {
+    this->pin->set_value(value);
+    this->pin->set_output(true);
+}
+
+void DigitalOut::write(int value) {
+    this->pin->set_value(value);
+}
+
+int DigitalOut::read() {
+    return this->pin->value();
+}
+
+DigitalIn::DigitalIn(PinName name, PinMode mode) : pin(&sim_pin(name)) {
+    this->pin->set_output(false);
+    this->pin->set_mode(mode);
+}
+
+int DigitalIn::read() {
+    return this->pin->level();
+}
+
+void DigitalIn::mode(PinMode mode) {
+    this->pin->set_mode(mode);
+}
+
+DigitalInOut::DigitalInOut(PinName name) : pin(&sim_pin(name)) {
+    this->pin->set_output(false);
+}
+
+void DigitalInOut::write(int value) {
+    this->pin->set_value(value);
+}
+
+int DigitalInOut::read() {
+    return this->pin->level();
+}
+
+void DigitalInOut::output() {
+    this->pin->set_output(true);
+}
+
+void DigitalInOut::input() {
+    this->pin->set_output(false);
+}
+
+void DigitalInOut::mode(PinMode mode) {
+    this->pin->set_mode(mode);
+}
+
+int DigitalInOut::is_output() {
+    return this->pin->is_output();
+}
+
+InterruptIn::InterruptIn(PinName name) : pin(&sim_pin(name)) {
+    this->enabled = true;
+    this->pin->set_output(false);
+    this->pin->watch(this);
+}
+
+InterruptIn::~InterruptIn() {
+    this->pin->unwatch(this);
+}
+
+int InterruptIn::read() {
+    return this->pin->level();
+}
+
+void InterruptIn::mode(PinMode mode) {
+    this->pin->set_mode(mode);
+}
+
+void InterruptIn::rise(Callback<void()> handler) {
+    this->on_rise.handler = handler;
+}
+
+void InterruptIn::fall(Callback<void()> handler) {
+    this->on_fall.handler = handler;
+}
+
+void InterruptIn::enable_irq() {
+    this->enabled = true;
+}
+
+void InterruptIn::disable_irq() {
+    this->enabled = false;
+}
+
+void InterruptIn::edge(bool rising) {
+    Edge &edge = rising ? this->on_rise : this->on_fall;
+    if (this->enabled && edge.handler) {
+        edge.raise();
+    }
+}
+
+Timer::Timer() {
+    this->running = false;
+    this->started = 0;
+    this->total = 0;
+}
+
+void Timer::start() {
+    if (!this->running) {
+        this->started = sim_clock().now();
+        this->running = true;
+    }
+}
+
+void Timer::stop() {
+    this->total = this->read_high_resolution_us() * 1000;
+    this->running = false;
+}
+
+void Timer::reset() {
+    this->total = 0;
+    this->started = sim_clock().now();
+}
+
+float Timer::read() {
+    return this->read_high_resolution_us() / 1000000.0f;
+}
+
+int Timer::read_ms() {
+    return (int)(this->read_high_resolution_us() / 1000);
+}
+
+int Timer::read_us() {
+    return (int)this->read_high_resolution_us();
+}
+
+us_timestamp_t Timer::read_high_resolution_us() {
+    sim_time_t elapsed = this->total;
+    if (this->running) {
+        elapsed += sim_clock().now() - this->started;
+    }
+    return elapsed / 1000;
+}
+
+Ticker::Ticker() {
+    this->one_shot = false;
+    this->period = 0;
+}
+
+Ticker::~Ticker() {
+    this->detach();
+}
+
+void Ticker::attach(Callback<void()> handler, float seconds) {
+    this->attach_us(handler, (us_timestamp_t)(seconds * 1000000.0f));
+}
+
+void Ticker::attach_us(Callback<void()> handler, us_timestamp_t us) {
+    this->handler = handler;
+    this->period = SIM_US(us);
+    // a reattached timer doesn't fire for its old time
+    Interrupt::clear();
+    this->schedule_in(this->period);
+}
+
+void Ticker::detach() {
+    this->cancel();
+    Interrupt::clear();
+}
+
+void Ticker::on_time() {
+    this->raise();
+    if (!this->one_shot) {
+        this->schedule_at(this->when() + this->period);
+    }
+}
+
+void Ticker::handle() {
+    // the handler may reattach
+    Callback<void()> handler = this->handler;
+    handler();
+}
+
+void wait(float seconds) {
+    sim_clock().advance((sim_time_t)(seconds * 1e9));
+}
+
+void wait_ms(int ms) {
+    sim_clock().advance(SIM_MS(ms));
+}
+
+void wait_us(int us) {
+    sim_clock().advance(SIM_US(us));
+}
+
+RawSerial::RawSerial(PinName tx, PinName rx, int baud) {
+    if (tx == USBTX && rx == USBRX) {
+        this->port = &World::get().console();
+    } else if (tx == p13 && rx == p14) {
+        this->port = &World::get().probe_uart();
+    } else {
+        error("sim: only the USB serial port and UART1 on p13/p14 are simulated\n");
+    }
+    this->port->set_baud(baud);
+}
+
+void RawSerial::baud(int baudrate) {
+    this->port->set_baud(baudrate);
+}
+
+void RawSerial::format(int bits, int parity, int stop_bits) {}
+
+int RawSerial::readable() {
+    return this->port->readable();
+}
+
+int RawSerial::writeable() {
+    return this->port->writeable();
+}
+
+int RawSerial::getc() {
+    return this->port->getc();
+}
+
+int RawSerial::putc(int c) {
+    this->port->putc(c);
+    return c;
+}
+
+int RawSerial::puts(const char *str) {
+    int count = 0;
+    for (; *str; str++, count++) {
+        this->port->putc(*str);
+    }
+    return count;
+}
+
+int RawSerial::printf(const char *format, ...) {
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (length > (int)sizeof(buffer) - 1) {
+        length = sizeof(buffer) - 1;
+    }
+    for (int i = 0; i < length; i++) {
+        this->port->putc(buffer[i]);
+    }
+    return length;
+}
+
+void RawSerial::attach(Callback<void()> handler, IrqType type) {
+    this->port->attach(handler, type == TxIrq);
+}
+
+static void (*idle_hook)(void) = NULL;
+
+void rtos::Thread::attach_idle_hook(void (*hook)(void)) {
+    idle_hook = hook;
+}
+
+// wakes dispatch(ms) when its time is up
+class DispatchTimeout : public ClockEvent, public Interrupt {
+protected:
+    void on_time() {
+        this->raise();
+    }
+    void handle() {}
+};
+
+EventQueue::EventQueue(unsigned size, unsigned char *buffer) {
+    this->capacity = size / EVENTS_EVENT_SIZE;
+    this->next_id = 0;
+    this->breaking = false;
+}
+
+int EventQueue::call(Callback<void()> f) {
+    if (this->events.size() >= this->capacity) {
+        return 0;
+    }
+    this->events.push_back(f);
+    return ++this->next_id;
+}
+
+void EventQueue::dispatch(int ms) {
+    DispatchTimeout timeout;
+    if (ms >= 0) {
+        timeout.schedule_in(SIM_MS(ms));
+    }
+    this->breaking = false;
+    while (true) {
+        while (!this->events.empty() && !this->breaking) {
+            Callback<void()> event = this->events.front();
+            this->events.pop_front();
+            event();
+        }
+        if (this->breaking || (ms >= 0 && !timeout.scheduled())) {
+            break;
+        }
+        // the idle thread runs, the hook leaves interrupts to post events
+        if (idle_hook) {
+            idle_hook();
+        } else {
+            sleep();
+        }
+    }
+    this->breaking = false;
+}
+
+void EventQueue::break_dispatch() {
+    this->breaking = true;
+}
+
+void sleep() {
+    if (!sim_clock().sleep()) {
+        error("sim: nothing left to wake up for\n");
+    }
+}
+
+void error(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    World::get().finish("error()", 1);
+}
+
+uint32_t us_ticker_read() {
+    return (uint32_t)(sim_clock().now() / 1000);
+}
+
+void __disable_irq() {
+    sim_clock().disable_irq();
+}
+
+void __enable_irq() {
+    sim_clock().enable_irq();
+}
+
+void core_util_critical_section_enter() {
+    sim_clock().critical_enter();
+}
+
+void core_util_critical_section_exit() {
+    sim_clock().critical_exit();
+}
+
+uint32_t SystemCoreClock = 96000000;
+
+int FlashIAP::init() {
+    return 0;
+}
+
+int FlashIAP::deinit() {
+    return 0;
+}
+
+int FlashIAP::read(void *buffer, uint32_t addr, uint32_t size) {
+    return World::get().flash().read(addr, buffer, size) ? 0 : -1;
+}
+
+int FlashIAP::program(const void *buffer, uint32_t addr, uint32_t size) {
+    return World::get().flash().program(addr, buffer, size) ? 0 : -1;
+}
+
+int FlashIAP::erase(uint32_t addr, uint32_t size) {
+    return World::get().flash().erase(addr, size) ? 0 : -1;
+}
+
+uint32_t FlashIAP::get_page_size() const {
+    return FlashModel::page_size;
+}
+
+uint32_t FlashIAP::get_sector_size(uint32_t addr) const {
+    return FlashModel::sector_size(addr);
+}
+
+uint32_t FlashIAP::get_flash_start() const {
+    return 0;
+}
+
+uint32_t FlashIAP::get_flash_size() const {
+    return FlashModel::size;
+}
+
+LPC_WDT_TypeDef *sim_lpc_wdt() {
+    return &World::get().watchdog().registers;
+}
+
+sim_feed_register &sim_feed_register::operator=(uint32_t value) {
+    World::get().watchdog().feed_write(value);
+    return *this;
+}
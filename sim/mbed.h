@@ -0,0 +1,389 @@
+/*
+Copyright 2018 Benjamin Elder (BenTheElder)
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#ifndef SIM_MBED_H
+#define SIM_MBED_H
+
+// The subset of the mbed-os 5 API the firmware uses, implemented for the
+// host on the simulated hardware in this directory. This stands in for
+// mbed-os's mbed.h when building the firmware with ./build.py sim, it is
+// the simulator's hardware abstraction layer: the firmware's code is
+// unchanged, only what is underneath it.
+//
+// Time is VirtualClock time (see VirtualClock.h) and interrupts are
+// delivered as the clock moves, so handlers never interrupt the firmware
+// between two of its own statements, only inside waits and sleeps.
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <deque>
+
+#include "Pins.h"
+#include "VirtualClock.h"
+
+// pins, numbered as on the mbed LPC1768 board
+typedef enum {
+    p5 = 5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18,
+    p19, p20, p21, p22, p23, p24, p25, p26, p27, p28, p29, p30,
+    LED1, LED2, LED3, LED4,
+    USBTX, USBRX,
+    NC = -1
+} PinName;
+
+typedef enum {
+    PullUp = SimPin::mode_pull_up,
+    Repeater = SimPin::mode_repeater,
+    PullNone = SimPin::mode_pull_none,
+    PullDown = SimPin::mode_pull_down,
+    OpenDrain = SimPin::mode_open_drain,
+    PullDefault = PullDown
+} PinMode;
+
+typedef uint32_t timestamp_t;
+typedef unsigned long long us_timestamp_t;
+
+// the simulated pin, the same object for every driver on it
+SimPin &sim_pin(PinName name);
+
+// Callback, for functions and member functions taking no arguments
+template <typename F>
+class Callback;
+
+template <typename R>
+class Callback<R()> {
+public:
+    Callback() : thunk(NULL), object(NULL) {}
+
+    Callback(R (*function)()) : thunk(function ? &function_thunk : NULL), object(NULL) {
+        this->storage.function = function;
+    }
+
+    template <typename T>
+    Callback(T *object, R (T::*method)()) : thunk(&method_thunk<T>), object(object) {
+        memcpy(this->storage.method, &method, sizeof(method));
+    }
+
+    R call() const {
+        if (!this->thunk) {
+            fprintf(stderr, "sim: called an empty Callback\n");
+            abort();
+        }
+        return this->thunk(this);
+    }
+
+    R operator()() const {
+        return this->call();
+    }
+
+    operator bool() const {
+        return this->thunk != NULL;
+    }
+
+private:
+    class Unknown;
+    union {
+        R (*function)();
+        char method[sizeof(void (Unknown::*)())];
+    } storage;
+    R (*thunk)(const Callback *);
+    void *object;
+
+    static R function_thunk(const Callback *self) {
+        return self->storage.function();
+    }
+
+    template <typename T>
+    static R method_thunk(const Callback *self) {
+        R (T::*method)();
+        memcpy(&method, self->storage.method, sizeof(method));
+        return (static_cast<T *>(self->object)->*method)();
+    }
+};
+
+template <typename R>
+Callback<R()> callback(R (*function)()) {
+    return Callback<R()>(function);
+}
+
+template <typename T, typename R>
+Callback<R()> callback(T *object, R (T::*method)()) {
+    return Callback<R()>(object, method);
+}
+
+// digital IO
+class DigitalOut {
+public:
+    DigitalOut(PinName name, int value = 0);
+    void write(int value);
+    int read();
+    DigitalOut &operator=(int value) {
+        this->write(value);
+        return *this;
+    }
+    DigitalOut &operator=(DigitalOut &other) {
+        this->write(other.read());
+        return *this;
+    }
+    operator int() {
+        return this->read();
+    }
+
+private:
+    SimPin *pin;
+};
+
+class DigitalIn {
+public:
+    DigitalIn(PinName name, PinMode mode = PullDefault);
+    int read();
+    void mode(PinMode mode);
+    operator int() {
+        return this->read();
+    }
+
+private:
+    SimPin *pin;
+};
+
+class DigitalInOut {
+public:
+    DigitalInOut(PinName name);
+    void write(int value);
+    int read();
+    void output();
+    void input();
+    void mode(PinMode mode);
+    int is_output();
+    DigitalInOut &operator=(int value) {
+        this->write(value);
+        return *this;
+    }
+    operator int() {
+        return this->read();
+    }
+
+private:
+    SimPin *pin;
+};
+
+class InterruptIn : private PinWatcher {
+public:
+    InterruptIn(PinName name);
+    ~InterruptIn();
+    int read();
+    void mode(PinMode mode);
+    void rise(Callback<void()> handler);
+    void fall(Callback<void()> handler);
+    void enable_irq();
+    void disable_irq();
+    operator int() {
+        return this->read();
+    }
+
+private:
+    class Edge : public Interrupt {
+    public:
+        Callback<void()> handler;
+    protected:
+        void handle() {
+            this->handler();
+        }
+    };
+
+    SimPin *pin;
+    Edge on_rise;
+    Edge on_fall;
+    bool enabled;
+
+    void edge(bool rising);
+};
+
+// time
+class Timer {
+public:
+    Timer();
+    void start();
+    void stop();
+    void reset();
+    float read();
+    int read_ms();
+    int read_us();
+    us_timestamp_t read_high_resolution_us();
+    operator float() {
+        return this->read();
+    }
+
+private:
+    bool running;
+    sim_time_t started;
+    sim_time_t total;
+};
+
+class Ticker : private ClockEvent, private Interrupt {
+public:
+    Ticker();
+    virtual ~Ticker();
+    void attach(Callback<void()> handler, float seconds);
+    void attach_us(Callback<void()> handler, us_timestamp_t us);
+    void detach();
+
+protected:
+    // a Timeout's handler runs once
+    bool one_shot;
+
+private:
+    Callback<void()> handler;
+    sim_time_t period;
+
+    void on_time();
+    void handle();
+};
+
+class Timeout : public Ticker {
+public:
+    Timeout() {
+        this->one_shot = true;
+    }
+};
+
+void wait(float seconds);
+void wait_ms(int ms);
+void wait_us(int us);
+
+// serial, see SerialPort in Devices.h for the UART underneath
+class SerialPort;
+
+class SerialBase {
+public:
+    enum IrqType {
+        RxIrq = 0,
+        TxIrq
+    };
+};
+
+class RawSerial : public SerialBase {
+public:
+    RawSerial(PinName tx, PinName rx, int baud = 9600);
+    void baud(int baudrate);
+    void format(int bits = 8, int parity = 0, int stop_bits = 1);
+    int readable();
+    int writeable();
+    int getc();
+    int putc(int c);
+    int puts(const char *str);
+    int printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+    void attach(Callback<void()> handler, IrqType type = RxIrq);
+
+private:
+    SerialPort *port;
+};
+
+class Serial : public RawSerial {
+public:
+    Serial(PinName tx, PinName rx, int baud = 9600) : RawSerial(tx, rx, baud) {}
+};
+
+// events, the queue is dispatched by the main thread and may be posted
+// to from interrupt handlers
+#define EVENTS_EVENT_SIZE 64
+
+class EventQueue {
+public:
+    EventQueue(unsigned size = 32 * EVENTS_EVENT_SIZE, unsigned char *buffer = NULL);
+
+    // post f to be called from dispatch, returns 0 if the queue is full
+    int call(Callback<void()> f);
+    template <typename F>
+    int call(F f) {
+        return this->call(Callback<void()>(f));
+    }
+    template <typename T, typename R>
+    int call(T *object, R (T::*method)()) {
+        return this->call(Callback<void()>(object, method));
+    }
+
+    // dispatch events for ms, or forever if ms is negative
+    void dispatch(int ms = -1);
+    void dispatch_forever() {
+        this->dispatch(-1);
+    }
+    void break_dispatch();
+
+private:
+    unsigned capacity;
+    int next_id;
+    std::deque<Callback<void()> > events;
+    bool breaking;
+};
+
+namespace rtos {
+class Thread {
+public:
+    // replace the idle thread's default, which just sleeps
+    static void attach_idle_hook(void (*hook)(void));
+};
+}
+using namespace rtos;
+
+// the rest of the platform
+void sleep();
+void error(const char *format, ...) __attribute__((format(printf, 1, 2)));
+uint32_t us_ticker_read();
+
+void __disable_irq();
+void __enable_irq();
+void core_util_critical_section_enter();
+void core_util_critical_section_exit();
+
+extern uint32_t SystemCoreClock;
+
+// the LPC1768's flash through IAP, see FlashModel in Devices.h,
+// functions return 0 on success as in mbed-os
+class FlashIAP {
+public:
+    int init();
+    int deinit();
+    int read(void *buffer, uint32_t addr, uint32_t size);
+    int program(const void *buffer, uint32_t addr, uint32_t size);
+    int erase(uint32_t addr, uint32_t size);
+    uint32_t get_page_size() const;
+    uint32_t get_sector_size(uint32_t addr) const;
+    uint32_t get_flash_start() const;
+    uint32_t get_flash_size() const;
+};
+
+// the watchdog, feeding it is a write to WDFEED
+struct sim_feed_register {
+    sim_feed_register &operator=(uint32_t value);
+};
+
+struct LPC_WDT_TypeDef {
+    uint32_t WDMOD;
+    uint32_t WDTC;
+    sim_feed_register WDFEED;
+    uint32_t WDTV;
+    uint32_t WDCLKSEL;
+};
+
+// a macro as in CMSIS, so that nothing touches the World during static
+// initialization until the firmware's globals do
+LPC_WDT_TypeDef *sim_lpc_wdt();
+#define LPC_WDT (sim_lpc_wdt())
+
+#endif